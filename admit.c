@@ -0,0 +1,103 @@
+/* 캐시 입장 필터, admit.h 참고 */
+#include "admit.h"
+
+/* 키 해시 하나로 비트 위치 여러 개 - h1 + i * h2 (Kirsch-Mitzenmacher)
+   키 해시는 FNV라 아래 비트가 고르지 않다 - 한 번 섞어서 쓴다 */
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+admit_filter* admit_create(unsigned long keys, int window) {
+    admit_filter* f = Calloc(1, sizeof(admit_filter));
+
+    f->keys = keys > 0 ? keys : ADMIT_DEFAULT_KEYS;
+    f->nbits = 64;
+    while (f->nbits < f->keys * ADMIT_BITS_PER_KEY)
+        f->nbits <<= 1;
+    f->bits[0] = Calloc(f->nbits / 64, sizeof(uint64_t));
+    f->bits[1] = Calloc(f->nbits / 64, sizeof(uint64_t));
+    f->window = window;
+    f->gen_start = time(NULL);
+    Sem_init(&f->lock, 0, 1);
+    return f;
+}
+
+/* 꽉 찼으면 -1 */
+int admit_add_bypass(admit_filter* f, const char* prefix) {
+    if (f->nbypass >= ADMIT_MAX_BYPASS)
+        return -1;
+    f->bypass[f->nbypass++] = strdup(prefix);
+    return 0;
+}
+
+/* 직전 필터를 비우고 지금 필터로 삼는다, 다른 쓰레드가 먼저 바꿨으면 안 한다 */
+static void rotate(admit_filter* f, time_t now) {
+    P(&f->lock);
+    if (now - f->gen_start >= f->window || f->count >= f->keys) {
+        memset(f->bits[f->cur ^ 1], 0, f->nbits / 8);
+        if (now - f->gen_start >= 2 * f->window) // 한참 조용했다 - 지금 것도 window보다 오래됐다
+            memset(f->bits[f->cur], 0, f->nbits / 8);
+        f->cur ^= 1;
+        f->count = 0;
+        f->gen_start = now;
+        f->rotations++;
+    }
+    V(&f->lock);
+}
+
+/* 이 키를 캐시에 넣어도 되나: 필터 둘 중 하나에 이미 있으면 (window 안에 두 번째) 1
+   처음 보는 키면 지금 필터에 적어두고 0. 비트는 락 없이 - 바꾸는 중에 켠 비트 하나쯤 잃어도 다음 요청 때 다시 적힌다 */
+int admit_check(admit_filter* f, const char* id, uint64_t hash) {
+    uint64_t h1 = mix(hash), h2 = mix(hash ^ 0x9e3779b97f4a7c15ULL) | 1;
+    uint64_t *cur, *prev;
+    int i, in_cur = 1, in_prev = 1;
+    time_t now = time(NULL);
+
+    __sync_fetch_and_add(&f->checks, 1);
+    for (i = 0; i < f->nbypass; i++) {
+        if (!strncmp(id, f->bypass[i], strlen(f->bypass[i]))) {
+            __sync_fetch_and_add(&f->bypassed, 1);
+            return 1;
+        }
+    }
+    if (now - f->gen_start >= f->window || f->count >= f->keys)
+        rotate(f, now);
+
+    cur = f->bits[f->cur];
+    prev = f->bits[f->cur ^ 1];
+    for (i = 0; i < ADMIT_HASHES; i++) {
+        size_t bit = (h1 + i * h2) & (f->nbits - 1);
+        uint64_t mask = 1ULL << (bit & 63);
+        if (!(cur[bit / 64] & mask)) {
+            in_cur = 0;
+            __sync_fetch_and_or(&cur[bit / 64], mask);
+        }
+        if (!(prev[bit / 64] & mask))
+            in_prev = 0;
+    }
+    if (!in_cur)
+        __sync_fetch_and_add(&f->count, 1);
+    if (in_cur || in_prev)
+        return 1;
+    __sync_fetch_and_add(&f->rejects, 1);
+    return 0;
+}
+
+int admit_stats_text(admit_filter* f, char* buf, size_t len) {
+    int n;
+
+    n = snprintf(buf, len,
+        "admit_window: %d\n"
+        "admit_filter: %lu/%lu keys, %zu bits x 2\n"
+        "admit_checks: %lu\n"
+        "admit_rejects: %lu\n"
+        "admit_bypassed: %lu\n"
+        "admit_rotations: %lu\n",
+        f->window, f->count, f->keys, f->nbits, f->checks, f->rejects, f->bypassed, f->rotations);
+    return n < (int)len ? n : (int)len - 1;
+}
@@ -0,0 +1,46 @@
+/* 캐시 입장 필터 (one-hit wonder 거르기)
+ * 프록시를 지나가는 URL 대부분은 딱 한 번만 요청된다 - 그런 걸 다 캐시에 넣으면 쓸모 있는 객체가 쫓겨나고
+ * 슬롯 할당 + 복사만 공짜로 치른다. 그래서 처음 보는 키는 릴레이만 하고, window 안에 다시 오면 그때 넣는다
+ *
+ * - 키 해시를 Bloom filter 두 개에 적는다 (지금 것, 직전 것)
+ *   지금 것에 window만큼 적었거나 키가 keys개 넘게 들어가면 직전 것을 비우고 둘을 바꾼다
+ *   -> window 안에 다시 온 키는 반드시 들어가고, 2 * window까지는 들어갈 수도 있다
+ * - 틀리는 건 한쪽뿐: 처음 보는 키를 본 적 있다고 하는 것 (false positive, 10비트/키 기준 1% 남짓)
+ * - --admit-bypass=PREFIX로 준 prefix로 시작하는 키는 안 보고 바로 넣는다 (처음부터 hot한 걸 아는 경로)
+ */
+#ifndef __ADMIT_H__
+#define __ADMIT_H__
+
+#include "csapp.h"
+
+#define ADMIT_DEFAULT_KEYS 65536  // 필터 하나에 적을 키 수, 비트는 키당 ADMIT_BITS_PER_KEY
+#define ADMIT_BITS_PER_KEY 10
+#define ADMIT_HASHES 4            // 키 하나에 켜는 비트 수
+#define ADMIT_MAX_BYPASS 16
+
+typedef struct admit_filter {
+    uint64_t* bits[2];        // [cur]이 지금 적는 것, [cur ^ 1]이 직전 것
+    int cur;
+    size_t nbits;             // 2의 거듭제곱
+    unsigned long keys;       // 필터 하나가 이만큼 차면 window 전이라도 바꾼다
+    unsigned long count;      // 지금 필터에 새로 적은 키 수
+    int window;               // 초
+    time_t gen_start;         // 지금 필터를 쓰기 시작한 시각
+    sem_t lock;               // 필터 바꾸기만, 비트는 원자적으로 켠다
+    char* bypass[ADMIT_MAX_BYPASS];
+    int nbypass;
+    unsigned long checks;     // 통계는 __sync로
+    unsigned long rejects;    // 처음 봐서 안 넣은 수
+    unsigned long bypassed;
+    unsigned long rotations;
+} admit_filter;
+
+admit_filter* admit_create(unsigned long keys, int window);
+
+int admit_add_bypass(admit_filter* f, const char* prefix);
+
+int admit_check(admit_filter* f, const char* id, uint64_t hash);
+
+int admit_stats_text(admit_filter* f, char* buf, size_t len);
+
+#endif /* __ADMIT_H__ */
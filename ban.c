@@ -0,0 +1,169 @@
+/* PURGE / ban, ban.h 참고 */
+#include "ban.h"
+
+ban_list* ban_init(void) {
+    ban_list* bans = Calloc(1, sizeof(ban_list));
+
+    bans->root.label = "";
+    Sem_init(&bans->lock, 0, 1);
+    return bans;
+}
+
+static ban_node* new_node(const char* label, size_t len) {
+    ban_node* node = Calloc(1, sizeof(ban_node));
+
+    node->label = Malloc(len + 1);
+    memcpy(node->label, label, len);
+    node->label[len] = '\0';
+    node->label_len = len;
+    return node;
+}
+
+/* key를 따라 내려가며 없는 노드는 만들고 (라벨이 중간에서 갈라지면 쪼갠다) key가 끝나는 노드를 리턴 */
+static ban_node* trie_insert(ban_node* node, const char* key, size_t len) {
+    ban_node* c;
+    size_t common;
+
+    while (len > 0) {
+        for (c = node->child; c != NULL; c = c->sibling)
+            if (c->label[0] == key[0])
+                break;
+        if (c == NULL) {
+            c = new_node(key, len);
+            c->sibling = node->child;
+            node->child = c;
+            return c;
+        }
+
+        for (common = 0; common < c->label_len && common < len && c->label[common] == key[common]; common++)
+            ;
+        if (common < c->label_len) {
+            /* c를 [공통 부분] -> [나머지]로 쪼갠다, 나머지가 c의 자식과 ban을 물려받는다 */
+            ban_node* rest = new_node(c->label + common, c->label_len - common);
+            rest->child = c->child;
+            rest->prefix_seq = c->prefix_seq;
+            rest->prefix_time = c->prefix_time;
+            rest->exact_seq = c->exact_seq;
+            rest->exact_time = c->exact_time;
+            c->child = rest;
+            c->label[common] = '\0';
+            c->label_len = common;
+            c->prefix_seq = c->exact_seq = 0;
+            c->prefix_time = c->exact_time = 0;
+        }
+        node = c;
+        key += common;
+        len -= common;
+    }
+    return node;
+}
+
+/* prefix로 시작하는 키 전부 (exact면 그 키와 그 키의 Vary 변형만) 무효화, ban 번호 리턴 */
+uint32_t ban_add_prefix(ban_list* bans, const char* prefix, int exact) {
+    ban_node* node;
+    uint32_t seq;
+
+    P(&bans->lock);
+    node = trie_insert(&bans->root, prefix, strlen(prefix));
+    seq = bans->seq + 1;
+    if (exact) {
+        node->exact_seq = seq;
+        node->exact_time = time(NULL);
+        bans->purges++;
+    } else {
+        node->prefix_seq = seq;
+        node->prefix_time = time(NULL);
+        bans->prefixes++;
+    }
+    bans->seq = seq; // 다 만든 다음에 올린다 - 객체들은 이걸 보고 확인하러 온다
+    V(&bans->lock);
+    return seq;
+}
+
+/* 패턴이 틀렸으면 err에 이유를 쓰고 -1 */
+int ban_add_regex(ban_list* bans, const char* pattern, char* err, size_t errlen) {
+    ban_regex* ban = Calloc(1, sizeof(ban_regex));
+    int rc;
+
+    if ((rc = regcomp(&ban->re, pattern, REG_EXTENDED | REG_NOSUB)) != 0) {
+        regerror(rc, &ban->re, err, errlen);
+        Free(ban);
+        return -1;
+    }
+    ban->pattern = strdup(pattern);
+    ban->time = time(NULL);
+
+    P(&bans->lock);
+    ban->seq = bans->seq + 1;
+    ban->next = bans->regexes;
+    bans->regexes = ban;
+    bans->regex_total++;
+    if (++bans->regex_count > BAN_MAX_REGEX) { // 제일 오래된 것 버리기
+        ban_regex* prev = bans->regexes;
+        while (prev->next->next != NULL)
+            prev = prev->next;
+        regfree(&prev->next->re);
+        free(prev->next->pattern);
+        Free(prev->next);
+        prev->next = NULL;
+        bans->regex_count--;
+    }
+    bans->seq = ban->seq;
+    V(&bans->lock);
+    return 0;
+}
+
+/* checked번 ban 이후에 생긴 ban 중에 id에 걸리는 게 있으면 1
+   resp_time이 ban 시각보다 뒤인 (ban 이후에 받은) 객체는 안 걸린다
+   확인한 다음엔 *checked를 지금 ban 번호로 올려둔다 - 새 ban이 없으면 락도 안 잡고 끝 */
+int ban_check(ban_list* bans, const char* id, int64_t resp_time, uint32_t* checked) {
+    ban_node* node = &bans->root;
+    ban_node* c;
+    ban_regex* re;
+    size_t pos = 0;
+    uint32_t since = *checked;
+    int hit = 0;
+
+    if (since == bans->seq)
+        return 0;
+
+    P(&bans->lock);
+    bans->checks++;
+    while (!hit) {
+        if (node->prefix_seq > since && resp_time <= node->prefix_time)
+            hit = 1;
+        if (node->exact_seq > since && resp_time <= node->exact_time && (id[pos] == '\0' || id[pos] == '#'))
+            hit = 1;
+        for (c = node->child; c != NULL; c = c->sibling)
+            if (c->label[0] == id[pos])
+                break;
+        if (c == NULL || strncmp(id + pos, c->label, c->label_len))
+            break;
+        node = c;
+        pos += c->label_len;
+    }
+    for (re = bans->regexes; !hit && re != NULL && re->seq > since; re = re->next) {
+        if (resp_time <= re->time && regexec(&re->re, id, 0, NULL, 0) == 0)
+            hit = 1;
+    }
+    if (hit)
+        bans->banned++;
+    *checked = bans->seq;
+    V(&bans->lock);
+    return hit;
+}
+
+int ban_stats_text(ban_list* bans, char* buf, size_t len) {
+    int n;
+
+    n = snprintf(buf, len,
+        "ban_seq: %u\n"
+        "ban_prefixes: %lu\n"
+        "ban_purges: %lu\n"
+        "ban_regexes: %lu (%d active)\n"
+        "ban_checks: %lu\n"
+        "ban_banned: %lu\n",
+        bans->seq, bans->prefixes, bans->purges, bans->regex_total, bans->regex_count,
+        bans->checks, bans->banned);
+    return n < (int)len ? n : (int)len - 1;
+}
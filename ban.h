@@ -0,0 +1,60 @@
+/* PURGE / ban (캐시 무효화)
+ * ban은 걸 때 캐시를 뒤지지 않고 기록만 해둔다 - 걸리는 시간은 trie에 노드 몇 개 넣는 정도
+ * 객체는 다음에 찾아질 때 자기가 마지막으로 확인한 ban 이후의 것들하고만 비교해보고, 걸리면 그때 빠진다
+ *
+ * - prefix ban, PURGE(정확히 그 키와 Vary 변형들): 캐시 키 prefix의 radix trie, 키를 한 번 따라 내려가면 끝
+ * - regex ban: 목록으로 두고 확인할 때 그 객체에 아직 안 돌려본 것만 돌린다
+ * ban보다 늦게 (resp_time이 ban 시각 뒤에) 받은 객체는 걸리지 않는다 - 디스크/공유 캐시에서 올라온 옛날 객체도 같은 기준
+ */
+#ifndef __BAN_H__
+#define __BAN_H__
+
+#include <regex.h>
+#include "cache.h"
+
+#define BAN_MAX_REGEX 64  // 넘으면 제일 오래된 regex ban부터 버린다
+
+/* 압축 radix trie 노드, 자식은 첫 글자가 서로 다르다 */
+typedef struct ban_node {
+    char* label;              // 부모에서 이 노드까지 오는 문자열
+    size_t label_len;
+    struct ban_node* child;
+    struct ban_node* sibling;
+    uint32_t prefix_seq;      // 여기까지가 prefix ban이면 그 번호, 아니면 0
+    int64_t prefix_time;
+    uint32_t exact_seq;       // PURGE: 키가 여기서 끝나거나 '#'(Vary 변형)으로 이어지면
+    int64_t exact_time;
+} ban_node;
+
+typedef struct ban_regex {
+    struct ban_regex* next;   // 최신이 앞
+    regex_t re;
+    char* pattern;
+    uint32_t seq;
+    int64_t time;
+} ban_regex;
+
+typedef struct ban_list {
+    ban_node root;
+    ban_regex* regexes;
+    int regex_count;
+    volatile uint32_t seq;    // 마지막 ban 번호, 객체의 ban_checked가 이거랑 같으면 확인할 게 없다
+    sem_t lock;               // ban 추가와 확인 (확인은 새 ban이 생긴 뒤 객체당 한 번만)
+    unsigned long prefixes;
+    unsigned long purges;
+    unsigned long regex_total;
+    unsigned long checks;
+    unsigned long banned;     // 확인해서 빠진 객체 수
+} ban_list;
+
+ban_list* ban_init(void);
+
+uint32_t ban_add_prefix(ban_list* bans, const char* prefix, int exact);
+
+int ban_add_regex(ban_list* bans, const char* pattern, char* err, size_t errlen);
+
+int ban_check(ban_list* bans, const char* id, int64_t resp_time, uint32_t* checked);
+
+int ban_stats_text(ban_list* bans, char* buf, size_t len);
+
+#endif /* __BAN_H__ */
@@ -1,34 +1,291 @@
+/* Cache header file for cache.c
+ * Author: Aleksander Bapst (abapst)
+ */
 #include "cache.h"
 
-/* cache_list를 초기화 */
-cache_list *init_cache() {
-    cache_list* cur_list = (cache_list*)malloc(sizeof(cache_list));
+static __thread int my_node = 0; /* 이 쓰레드가 도는 NUMA 노드, 새 슬롯은 이 노드 영역에서 먼저 */
+
+/* 파티션 몫을 정한다, 0번은 기본 파티션 (바이트는 apply_limit에서) */
+static void setup_partitions(cache_list* cache, cache_config* config) {
+    cache_partition* def = &cache->parts[0];
+    int i;
+
+    def->name = "default";
+    def->hosts = "";
+    def->min_share = 0;
+    def->max_share = 100;
+    cache->nparts = 1;
+    for (i = 0; i < config->nparts && cache->nparts < CACHE_MAX_PARTITIONS; i++) {
+        cache_partition_config* pc = &config->parts[i];
+        cache_partition* p = !strcmp(pc->name, "default") ? def : &cache->parts[cache->nparts++];
+        p->name = pc->name;
+        if (p != def)
+            p->hosts = pc->hosts;
+        p->min_share = pc->min_share;
+        p->max_share = pc->max_share;
+    }
+}
+
+/* limit이 바뀌면 (시작할 때 포함) 파티션 몫, 큰 객체 몫, 정책의 큐 비율 기준을 다시 맞춘다, write 락 */
+static void apply_limit(cache_list* cache) {
+    int i;
+
+    for (i = 0; i < cache->nparts; i++) {
+        cache_partition* p = &cache->parts[i];
+        p->min = cache->limit * p->min_share / 100;
+        p->max = cache->limit * p->max_share / 100;
+        if (p->policy != NULL) {
+            P(&cache->plock);
+            p->policy->capacity = p->max;
+            V(&cache->plock);
+        }
+    }
+    cache->large_limit = cache->limit * cache->large_share / 100;
+}
+
+/* cache_list를 초기화, 교체 정책은 이름으로 고른다 (policy.h의 POLICY_NAMES)
+   NUMA 노드가 여럿이면 용량을 나눠서 노드마다 영역을 따로 잡는다 (인덱스, 정책, 파티션은 하나)
+   영역은 max_capacity만큼 잡아두고 그 안에서 capacity만 쓴다 - 나중에 cache_resize로 키울 수 있게 */
+cache_list *init_cache(cache_config* config) {
+    cache_list* cur_list = (cache_list*)Calloc(1, sizeof(cache_list));
+    size_t max = config->max_capacity > config->capacity ? config->max_capacity : config->capacity;
+    int i;
+
+    cur_list->narenas = config->numa_nodes > 1 ? config->numa_nodes : 1;
+    if (cur_list->narenas > NUMA_MAX_NODES)
+        cur_list->narenas = NUMA_MAX_NODES;
+    for (i = 0; i < cur_list->narenas; i++) {
+        /* --cache-max까지 주소는 잡되, 미리 건드리는 건 지금 크기 몫만 */
+        cur_list->arenas[i] = slab_create(max / cur_list->narenas, config->capacity / cur_list->narenas, config->huge_pages,
+                                          cur_list->narenas > 1 ? i : -1);
+        cur_list->capacity += cur_list->arenas[i]->size;
+    }
+    cur_list->replicate = config->numa_replicate;
+    cur_list->limit = config->capacity < cur_list->capacity ? config->capacity : cur_list->capacity;
+    cur_list->large_share = config->large_share;
+    setup_partitions(cur_list, config);
+    apply_limit(cur_list);
+    for (i = 0; i < cur_list->nparts; i++) {
+        /* 정책은 파티션마다 따로, 큐 비율은 그 파티션의 최대 몫 기준 */
+        cur_list->parts[i].policy = policy_create(config->policy, cur_list->parts[i].max);
+        if (cur_list->parts[i].policy == NULL) {
+            while (--i >= 0)
+                policy_destroy(cur_list->parts[i].policy);
+            for (i = 0; i < cur_list->narenas; i++)
+                slab_destroy(cur_list->arenas[i]);
+            Free(cur_list);
+            return NULL;
+        }
+    }
+
     cur_list->start = NULL;
     cur_list->end   = NULL;
-    cur_list->left_space = MAX_CACHE_SIZE;
+    /* 버킷은 객체 평균 4KB로 잡고 2의 거듭제곱으로 */
+    cur_list->nbuckets = CACHE_MIN_BUCKETS;
+    while (cur_list->nbuckets < max / 4096)
+        cur_list->nbuckets <<= 1;
+    cur_list->buckets = Calloc(cur_list->nbuckets, sizeof(cache_object*));
+    cur_list->left_space = cur_list->capacity;
+
+    cur_list->max_object = config->max_object;
+    cur_list->max_large_object = config->max_large_object;
+    cur_list->dedup = config->dedup;
+    if (cur_list->dedup)
+        cur_list->bodies = Calloc(cur_list->nbuckets, sizeof(cache_body*));
 
     cur_list->readcnt = 0;
-    Sem_init(&cur_list->r, 0, 1); 
+    Sem_init(&cur_list->r, 0, 1);
     Sem_init(&cur_list->w, 0, 1);
     Sem_init(&cur_list->serviceQueue , 0, 1);
+    Sem_init(&cur_list->plock, 0, 1);
+    Sem_init(&cur_list->shrink_wake, 0, 0);
 
     return cur_list;
 }
 
-/* cache로 쓸 object를 초기화 */
-cache_object *init_object(char* id, unsigned int size) {
-    cache_object* cur_object = (cache_object*)malloc(sizeof(cache_object));
+/* 이 쓰레드가 도는 노드를 정한다 (워커가 시작할 때), 안 부른 쓰레드는 0번 노드 */
+void cache_set_node(int node) {
+    my_node = node;
+}
 
-    cur_object->id = (char*)malloc(strlen(id)+1);
-    strcpy(cur_object->id, id); // id가 char배열 지역변수로 들어오기 때문에, 이렇게 해줘야만 소멸 방지 가능 
+/* 이 쓰레드 노드의 영역부터, 꽉 찼으면 다른 노드 영역에서라도 슬롯을 잡는다 (쫓아내기 전에)
+   다 꽉 찼으면 NULL, node에는 잡은 영역 번호 */
+static void* cache_alloc(cache_list* cache, size_t size, size_t* charged, int* node) {
+    int home = my_node % cache->narenas, i;
+    void* ptr;
 
-    cur_object->length = size; 
-    cur_object->data = malloc(size);
+    for (i = 0; i < cache->narenas; i++) {
+        int n = (home + i) % cache->narenas;
+        if ((ptr = slab_alloc(cache->arenas[n], size, charged)) != NULL) {
+            if (i > 0)
+                __sync_fetch_and_add(&cache->stats.numa_spills, 1);
+            if (node != NULL)
+                *node = n;
+            return ptr;
+        }
+    }
+    return NULL;
+}
+
+/* ptr이 속한 영역을 주소로 찾아서 돌려준다 */
+static void cache_free(cache_list* cache, void* ptr) {
+    int i;
+
+    for (i = 0; i < cache->narenas - 1; i++) {
+        slab_arena* a = cache->arenas[i];
+        if ((char*)ptr >= a->base && (char*)ptr < a->base + a->size)
+            break;
+    }
+    slab_free(cache->arenas[i], ptr);
+}
+
+/* 키(절대 URL)의 호스트로 파티션을 찾는다, 어느 묶음에도 없으면 기본 파티션 0 */
+int cache_partition_of(cache_list* cache, const char* id) {
+    const char *host, *h, *end;
+    size_t len, n;
+    int i;
+
+    if (cache->nparts == 1)
+        return 0;
+    host = strstr(id, "://");
+    host = host != NULL ? host + 3 : id;
+    len = strcspn(host, ":/#");
+
+    for (i = 1; i < cache->nparts; i++) {
+        for (h = cache->parts[i].hosts; *h; h = *end ? end + 1 : end) {
+            end = h + strcspn(h, ",");
+            n = end - h;
+            if (n == len && !strncasecmp(h, host, n))
+                return i;
+            if (n > 0 && h[0] == '.' && len > n && !strncasecmp(h, host + len - n, n)) // ".example.com"
+                return i;
+        }
+    }
+    return 0;
+}
+
+/* cache로 쓸 object를 초기화
+   [cache_object | id | data] 가 slab 슬롯 하나에 연속으로 들어간다
+   arena에 자리가 없으면 NULL, write 락을 잡고 불러야 함 (자리가 없으면 바로 evict 해야 하니까)
+   refcnt는 1로 시작하고, 이건 캐시 인덱스가 들고 있는 몫이다 */
+cache_object *init_object(cache_list* cache, char* id, uint64_t hash, unsigned int size) {
+    size_t id_len = strlen(id) + 1;
+    size_t charged;
+    int node;
+    cache_object* cur_object = cache_alloc(cache, sizeof(cache_object) + id_len + size, &charged, &node);
+    if (cur_object == NULL)
+        return NULL;
+
+    memset(cur_object, 0, sizeof(cache_object));
+    cur_object->id = (char*)(cur_object + 1);
+    memcpy(cur_object->id, id, id_len); // id가 char배열 지역변수로 들어오기 때문에, 이렇게 해줘야만 소멸 방지 가능
+    cur_object->hash = hash;
+
+    cur_object->length = size;
+    cur_object->data = cur_object->id + id_len;
+    cur_object->charge = charged;
+    cur_object->refcnt = 1;
     cur_object->next = NULL;
-    
+    cur_object->heap_idx = -1;
+    cur_object->part = cache_partition_of(cache, id);
+    cur_object->node = node;
+
     return cur_object;
 }
 
+/* ---------- 공유 본문 ---------- */
+
+static cache_body** body_bucket(cache_list* cache, const uint64_t h[2]) {
+    return &cache->bodies[h[0] & (cache->nbuckets - 1)];
+}
+
+/* 내용까지 같은 본문을 표에서 찾는다, write 락을 잡고 불러야 함 */
+static cache_body* find_body(cache_list* cache, const uint64_t h[2], const char* data, unsigned int len) {
+    cache_body* body;
+
+    for (body = *body_bucket(cache, h); body != NULL; body = body->hnext)
+        if (body->h[0] == h[0] && body->h[1] == h[1] && body->len == len && !memcmp(body->data, data, len))
+            return body;
+    return NULL;
+}
+
+/* 새 본문 자리, 아직 표에는 안 넣는다 (내용은 락 밖에서 채우니까 - 넣는 건 객체가 인덱스에 들어갈 때) */
+static cache_body* new_body(cache_list* cache, const uint64_t h[2], unsigned int len, int part) {
+    size_t charged;
+    cache_body* body = cache_alloc(cache, sizeof(cache_body) + len, &charged, NULL);
+
+    if (body == NULL)
+        return NULL;
+    memset(body, 0, sizeof(cache_body));
+    body->h[0] = h[0];
+    body->h[1] = h[1];
+    body->len = len;
+    body->refs = 1;
+    body->part = part;
+    body->charge = charged;
+    return body;
+}
+
+static void release_body(cache_list* cache, cache_body* body) {
+    if (__sync_sub_and_fetch(&body->refs, 1) == 0)
+        cache_free(cache, body);
+}
+
+/* 본문을 가리키는 객체가 인덱스에 들어갔다, 첫 객체면 용량을 잡고 표에 넣는다 */
+static void link_body(cache_list* cache, cache_body* body) {
+    if (body->users++ > 0) {
+        cache->stats.dedup_saved += body->len;
+        return;
+    }
+    cache->left_space -= body->charge;
+    cache->parts[body->part].used += body->charge;
+    cache->stats.dedup_bodies++;
+    if (find_body(cache, body->h, body->data, body->len) == NULL) {
+        cache_body** bucket = body_bucket(cache, body->h);
+        body->hnext = *bucket;
+        *bucket = body;
+        body->hashed = 1;
+    }
+}
+
+/* 마지막 객체가 인덱스에서 빠지면 표에서도 빼고 용량을 돌려준다, 메모리는 refs가 0이 될 때 */
+static void unlink_body(cache_list* cache, cache_body* body) {
+    if (--body->users > 0) {
+        cache->stats.dedup_saved -= body->len;
+        return;
+    }
+    cache->left_space += body->charge;
+    cache->parts[body->part].used -= body->charge;
+    cache->stats.dedup_bodies--;
+    if (body->hashed) {
+        cache_body** pp = body_bucket(cache, body->h);
+        while (*pp != body)
+            pp = &(*pp)->hnext;
+        *pp = body->hnext;
+        body->hnext = NULL;
+        body->hashed = 0;
+    }
+}
+
+/* 청크와 복제본까지 전부 slab에 돌려준다, refcnt가 0이 된 다음에만 */
+static void free_object(cache_list* cache, cache_object* obj) {
+    cache_chunk* chunk = obj->chunks;
+    while (obj->replicas != NULL) {
+        cache_object* r = obj->replicas;
+        obj->replicas = r->hnext;
+        cache_free(cache, r);
+    }
+    if (obj->body != NULL)
+        release_body(cache, obj->body);
+    while (chunk != NULL) {
+        cache_chunk* next = chunk->next;
+        cache_free(cache, chunk);
+        __sync_fetch_and_sub(&cache->large_used, CACHE_CHUNK_SIZE);
+        chunk = next;
+    }
+    cache_free(cache, obj);
+}
+
 /* 각 쓰레드는 동시에 cache에서 읽을 수 있다, 따라서 reader를 관리하는 readcnt변수에 대해서만 Mutual Exclusion 적용 */
 void open_reader(cache_list* cache) {
     /* 쓰레드들이 공유리소스인 캐시에 접근하는 진입점에는 serviceQueue를 사용해 공정성 보장 */
@@ -36,7 +293,7 @@ void open_reader(cache_list* cache) {
     P(&cache->r); // a. readcnt를 사용하기 위해 잠그고
     cache->readcnt++;
     if (cache->readcnt == 1) { // 첫번째 reader야
-        P(&cache->w); // reader가 한명이라도 존재하는 동안 writer는 못씀 
+        P(&cache->w); // reader가 한명이라도 존재하는 동안 writer는 못씀
     }
     V(&cache->serviceQueue);
     V(&cache->r); // b. 다시 풀어줌
@@ -46,156 +303,971 @@ void open_reader(cache_list* cache) {
 
 /* 읽기를 완료 */
 void close_reader(cache_list* cache) {
-    /* serviceQueue 세마포어는 쓰레드들 사이의 공정성을 유지하는 것이 목적이기 때문에, 
+    /* serviceQueue 세마포어는 쓰레드들 사이의 공정성을 유지하는 것이 목적이기 때문에,
         공유 리소스에(캐시)에 대한 접근이 시작되는 entry section에서만 사용
         여기서는 이미 순서가 정해진채로, 반납만 하는거니까 serviceQueue 사용 X
         => reader와 writer 모두 진입점에대해 serviceQueue를 사용하기 때문에, 둘간의 공정성이 보장된다
         => 세마포어가 쓰레드를 block-release함에 있어 FIFO를 유지한다면, 처리 순서는 FIFO가 느슨하게 유지됨
         => 왜냐, V가 P를 구제해주는거는 랜덤으로 이뤄지기에, 완전히 FIFO라 볼 수는 없기 때문
     */
-    P(&cache->r); 
+    P(&cache->r);
     cache->readcnt--;
     if (cache->readcnt == 0) { // 마지막으로 나가는 reader가 writer를 열어줌
         V(&cache->w); // 이제 P를 호출했는데 w가 0이어서 멈춰있던 writer중 하나는 쓸 수 있음
     }
-    V(&cache->r);    
+    V(&cache->r);
+}
+
+static void write_lock(cache_list* cache) {
+    P(&cache->serviceQueue);
+    P(&cache->w); // 한번에 한 writer만 쓸 수 있다
+    V(&cache->serviceQueue);
+}
+
+static void write_unlock(cache_list* cache) {
+    V(&cache->w);
+}
+
+static cache_object** bucket_of(cache_list* list, uint64_t hash) {
+    return &list->buckets[hash & (list->nbuckets - 1)];
+}
+
+/* 예전엔 리스트 전체를 strcmp로 훑었다, 이제는 버킷 하나만 보고 해시가 같을 때만 strcmp */
+static cache_object* find_object(cache_list* list, const char* id, uint64_t hash) {
+    cache_object* searcher = *bucket_of(list, hash);
+    while (searcher != NULL) {
+        if (searcher->hash == hash && !strcmp(searcher->id, id))
+            break;
+        searcher = searcher->hnext;
+    }
+    return searcher;
 }
 
 /*  캐시에서 원하는 값을 찾는다
-    값이 찾아지면, 내용과 길이는 object와 size에 써진다
-    이 object는 연결리스트의 최근에 사용됐기에 마지막으로 간다
-    그리고 0을 리턴한다
+    값이 찾아지면 참조를 하나 잡은 채로 객체를 돌려준다
+    -> 락을 풀고 나서 천천히 클라이언트에 써도 그 사이에 slab으로 돌아가지 않음, 다 쓰면 cache_release
+    hit 사실은 교체 정책에 알려준다 (LRU라면 맨 뒤로 가는 것)
 
-    못찾으면 -1을 리턴한다
+    못찾으면 NULL을 리턴한다
  */
-int search_cache(cache_list* list, char* id, void* object, unsigned int* size) {
-    // 읽을거니까 크리티컬 섹션(close와 얘 사이)에 대한 writer의 접근을 lock해놓음 
+cache_object* cache_lookup(cache_list* list, cache_key* key) {
+    // 읽을거니까 크리티컬 섹션(close와 얘 사이)에 대한 writer의 접근을 lock해놓음
     open_reader(list);
 
-    cache_object* searcher = list->start;
-    while(searcher != NULL) {
-        if (!strcmp(searcher->id, id))
-            break;
-        searcher = searcher->next;
-    }
+    cache_object* searcher = find_object(list, key->id, key->hash);
 
     if (searcher) { // cache hit
-        *size = searcher->length;
-        memcpy(object, searcher->data, *size);
+        __sync_fetch_and_add(&searcher->refcnt, 1);
+
+        /* 예전에는 여기서 reader를 닫고 writer로 다시 잡아서 delete_object + add_to_end를 했는데,
+           정책 메타데이터는 plock으로 따로 보호하니 읽기 락을 쥔 채로 처리할 수 있다 */
+        cache_partition* part = &list->parts[searcher->part];
+        P(&list->plock);
+        part->policy->on_hit(part->policy, searcher);
+        part->hits++;
+        list->stats.hits++;
+        V(&list->plock);
     }
     else { // cache miss
-        close_reader(list);
-        return -1;
+        int part = cache_partition_of(list, key->id);
+        P(&list->plock);
+        list->parts[part].misses++;
+        list->stats.misses++;
+        V(&list->plock);
     }
 
     // 다 읽음
     close_reader(list);
-    
-    P(&list->serviceQueue);
-    P(&list->w); // 한번에 한 writer만 쓸 수 있다
-    V(&list->serviceQueue);
-    searcher = delete_object(list, id);
-    if (searcher == NULL) {
-        V(&list->w); // 이 경우에 대해서도 lock 풀어줘야 함, write가 끝난거니까
+    return searcher;
+}
+
+/* 찾기만 한다 - 정책 순서도 hit/miss 통계도 안 건드린다 (형제 프록시가 물어볼 때)
+   찾으면 참조를 잡아서 돌려주니 cache_release */
+cache_object* cache_peek(cache_list* list, cache_key* key) {
+    cache_object* obj;
+
+    open_reader(list);
+    obj = find_object(list, key->id, key->hash);
+    if (obj)
+        __sync_fetch_and_add(&obj->refcnt, 1);
+    close_reader(list);
+    return obj;
+}
+
+/* obj를 이 쓰레드의 노드에 복제한다, 넣은 (또는 그새 다른 쓰레드가 넣은) 복제본 리턴
+   복제본은 인덱스에도 정책에도 안 들어가고 원본에 매달려 있다가 원본과 같이 빠진다 - 용량은 원본 파티션 몫으로
+   이 노드 영역이 꽉 찼으면 복제하려고 쫓아내지는 않고 NULL */
+static cache_object* replicate(cache_list* cache, cache_object* obj, int node) {
+    size_t id_len = strlen(obj->id) + 1, charged;
+    cache_object* r = slab_alloc(cache->arenas[node], sizeof(cache_object) + id_len + obj->length, &charged);
+    cache_object* other;
+
+    if (r == NULL) {
+        obj->remote_hits = 0; // 한참 뒤에 다시
+        return NULL;
+    }
+    memset(r, 0, sizeof(cache_object));
+    r->id = (char*)(r + 1);
+    memcpy(r->id, obj->id, id_len);
+    r->hash = obj->hash;
+    r->data = r->id + id_len;
+    r->length = obj->length;
+    r->charge = charged;
+    r->refcnt = 1;
+    r->heap_idx = -1;
+    r->part = obj->part;
+    r->node = node;
+    cache_object_read(obj, 0, r->data, obj->length); // 공유 본문도 여기로 합친다 - 본문까지 이 노드에 있어야 하니까
+
+    write_lock(cache);
+    for (other = obj->replicas; other != NULL && other->node != node; other = other->hnext)
+        ;
+    if (other != NULL || find_object(cache, obj->id, obj->hash) != obj // 한발 늦었거나 원본이 그새 빠졌다
+        || cache->capacity - cache->left_space + charged > cache->limit) { // 복제본 때문에 limit을 넘기지는 않는다
+        write_unlock(cache);
+        slab_free(cache->arenas[node], r);
+        return other;
+    }
+    r->meta = obj->meta;
+    r->ban_checked = obj->ban_checked;
+    r->hnext = obj->replicas;
+    __sync_synchronize(); // 다 채운 다음에 보이게 - 읽는 쪽은 락 없이 체인을 따라간다
+    obj->replicas = r;
+    cache->left_space -= charged;
+    cache->parts[obj->part].used += charged;
+    cache->stats.numa_replicas++;
+    write_unlock(cache);
+    return r;
+}
+
+/* obj를 보낼 때 이 쓰레드 노드에서 읽을 객체: 같은 노드에 있으면 그대로, 복제본이 있으면 복제본
+   다른 노드 것을 replicate번 넘게 보냈으면 이 노드에 복제본을 만든다 (슬롯 하나짜리 객체만)
+   복제본은 원본 참조를 쥐고 있는 동안만 쓸 수 있다 - release는 원본으로 */
+cache_object* cache_local(cache_list* cache, cache_object* obj) {
+    int node = my_node % cache->narenas;
+    cache_object* r;
+
+    if (cache->narenas == 1 || obj->node == node)
+        return obj;
+    for (r = obj->replicas; r != NULL; r = r->hnext) // 체인은 앞에 붙기만 하고 원본이 돌아갈 때까지 안 바뀐다
+        if (r->node == node)
+            return r;
+    __sync_fetch_and_add(&cache->stats.numa_remote_hits, 1);
+    if (cache->replicate == 0 || obj->data == NULL || obj->dead
+        || __sync_add_and_fetch(&obj->remote_hits, 1) < cache->replicate)
+        return obj;
+    r = replicate(cache, obj, node);
+    return r != NULL ? r : obj;
+}
+
+/* 참조 반납, 마지막 참조였으면 (이미 캐시에서 빠진 객체) 메모리를 돌려준다 */
+void cache_release(cache_list* cache, cache_object* obj) {
+    if (__sync_sub_and_fetch(&obj->refcnt, 1) == 0)
+        free_object(cache, obj);
+}
+
+/* 객체 본문의 [offset, offset+len) 부분을 fd에 쓴다, 큰 객체는 청크 단위로
+   클라이언트가 끊겨도 프록시가 죽으면 안되니 Rio_writen 대신 rio_writen */
+ssize_t cache_object_write(int fd, cache_object* obj, size_t offset, size_t len) {
+    cache_chunk* chunk;
+    size_t left = len, n;
+
+    if (offset + len > (size_t)obj->length)
         return -1;
+
+    if (obj->data != NULL) { // 슬롯 안 [0, split), 공유 본문이 있으면 나머지는 거기
+        size_t split = obj->body != NULL ? obj->length - obj->body->len : (size_t)obj->length;
+        if (offset < split) {
+            n = split - offset < left ? split - offset : left;
+            if (rio_writen(fd, (char*)obj->data + offset, n) != (ssize_t)n)
+                return -1;
+            offset += n;
+            left -= n;
+        }
+        if (left > 0 && rio_writen(fd, obj->body->data + (offset - split), left) != (ssize_t)left)
+            return -1;
+        return len;
     }
-    add_to_end(searcher, list);
-    V(&list->w); // 정상적인 write 사이클이 다 끝난경우 lock풀어줌
 
+    for (chunk = obj->chunks; chunk != NULL && left > 0; chunk = chunk->next) {
+        if (offset >= chunk->len) {
+            offset -= chunk->len;
+            continue;
+        }
+        n = chunk->len - offset < left ? chunk->len - offset : left;
+        if (rio_writen(fd, chunk->data + offset, n) != (ssize_t)n)
+            return -1;
+        left -= n;
+        offset = 0;
+    }
+    return len;
+}
+
+/* 객체 본문의 [offset, offset+len) 부분을 buf에 복사, 복사한 길이 리턴 */
+size_t cache_object_read(cache_object* obj, size_t offset, void* buf, size_t len) {
+    cache_chunk* chunk;
+    size_t done = 0, n;
+
+    if (offset >= (size_t)obj->length)
+        return 0;
+    if (offset + len > (size_t)obj->length)
+        len = obj->length - offset;
+
+    if (obj->data != NULL) {
+        size_t split = obj->body != NULL ? obj->length - obj->body->len : (size_t)obj->length;
+        if (offset < split) {
+            done = split - offset < len ? split - offset : len;
+            memcpy(buf, (char*)obj->data + offset, done);
+            offset += done;
+        }
+        if (done < len)
+            memcpy((char*)buf + done, obj->body->data + (offset - split), len - done);
+        return len;
+    }
+
+    for (chunk = obj->chunks; chunk != NULL && done < len; chunk = chunk->next) {
+        if (offset >= chunk->len) {
+            offset -= chunk->len;
+            continue;
+        }
+        n = chunk->len - offset < len - done ? chunk->len - offset : len - done;
+        memcpy((char*)buf + done, chunk->data + offset, n);
+        done += n;
+        offset = 0;
+    }
+    return done;
+}
+
+/* [offset, offset+len)이 메모리에 한 덩어리로 있으면 그 포인터 (복사 없이 읽기), 청크나 헤더/공유 본문 경계에 걸치면 NULL */
+const char* cache_object_ptr(cache_object* obj, size_t offset, size_t len) {
+    size_t split;
+
+    if (obj->data == NULL || offset + len > (size_t)obj->length)
+        return NULL;
+    if (obj->body == NULL)
+        return (char*)obj->data + offset;
+    split = obj->length - obj->body->len;
+    if (offset >= split)
+        return obj->body->data + (offset - split);
+    return offset + len <= split ? (char*)obj->data + offset : NULL;
+}
+
+/* 캐시에서 떼어낸다 (인덱스 + 정책 + 큰 객체 리스트), 메모리는 참조가 다 빠질 때 돌아간다 */
+static void remove_object(cache_list* cache, cache_object* obj, int evicted);
+
+static int evict_from(cache_list* cache, cache_partition* part);
+
+static int evict_for(cache_list* cache, int part);
+
+/* limit 안에 size가 들어갈 자리를 만든다 (slab에는 자리가 있어도), write 락
+   줄이는 중이라 이미 limit을 넘어있으면 넣는 만큼만 쫓아낸다 - 나머지는 shrinker가 조금씩 */
+static int make_room(cache_list* cache, size_t size, int part) {
+    size_t used = cache->capacity - cache->left_space;
+    size_t goal = used > cache->limit ? used : cache->limit;
+
+    while (cache->capacity - cache->left_space + size > goal) {
+        if (evict_for(cache, part) == -1)
+            return -1;
+    }
     return 0;
 }
 
-/* LRU에 따라 연결리스트의 맨 끝에 삽입하고, 캐시 사이즈 키워주는 애 */
-int add_to_cache(cache_list *cache, char *id, char *data, unsigned int length) {
-    cache_object *obj = init_object(id, length);
-    memcpy(obj->data, data, length);
+/* 다 만들어진 객체를 인덱스와 정책에 넣는다, write 락을 잡고 불러야 함
+   같은 id가 이미 있으면 새로 받아온 게 더 최신이니 교체 */
+static void insert_object(cache_list* cache, cache_object* obj) {
+    cache_partition* part = &cache->parts[obj->part];
+    cache_object* old = find_object(cache, obj->id, obj->hash);
+    size_t need;
+    if (old != NULL)
+        remove_object(cache, old, 0);
+
+    /* 파티션 최대 몫을 넘으면 같은 파티션 것부터 쫓아낸다 (새 공유 본문이면 그 몫까지) */
+    need = obj->charge + (obj->body != NULL && obj->body->users == 0 ? obj->body->charge : 0);
+    while (part->used + need > part->max && evict_from(cache, part) == 0)
+        ;
+
+    add_to_end(obj, cache);
+    part->policy->on_insert(part->policy, obj);
+    part->inserts++;
+    cache->stats.inserts++;
+
+    if (obj->chunks != NULL) { // 큰 객체는 FIFO 뒤에
+        obj->lnext = NULL;
+        obj->lprev = cache->large_end;
+        if (cache->large_end)
+            cache->large_end->lnext = obj;
+        else
+            cache->large_start = obj;
+        cache->large_end = obj;
+        cache->stats.large_inserts++;
+    }
+}
+
+/* 정책이 고른 자리가 날 때까지 쫓아내고, 인덱스 맨 끝에 삽입하고, 캐시 사이즈 줄여주는 애
+   본문 중복 제거를 켜면 헤더 뒤의 본문은 따로 - 같은 본문이 이미 있으면 그걸 같이 쓰고 헤더 슬롯만 잡는다
+   out이 NULL이 아니면 넣은 객체의 참조를 하나 더 잡아서 돌려준다 */
+static int insert_copy(cache_list *cache, char *id, uint64_t hash, cache_meta* meta, uint32_t ban_checked, char *data, unsigned int length, cache_object** out) {
+    cache_object *obj;
+    cache_body* body = NULL;
+    unsigned int split = length; // 슬롯에 들어가는 앞부분
+    uint64_t h[2];
+    int shared = 0, part = cache_partition_of(cache, id);
+
+    if (sizeof(cache_object) + strlen(id) + 1 + length > cache->arenas[0]->size // 슬롯은 한 영역 안에
+        || sizeof(cache_object) + strlen(id) + 1 + length > cache->limit)
+        return -1;
+    if (cache->dedup && meta != NULL && meta->hdr_len <= length && length - meta->hdr_len >= CACHE_DEDUP_MIN) {
+        split = meta->hdr_len;
+        cache_hash128(data + split, length - split, h); // 해시는 락 밖에서
+    }
 
     // 쓸거니까 write lock걸기
-    P(&cache->serviceQueue);
-    P(&(cache->w));
-    V(&cache->serviceQueue);
-    
-        /* 캐시 사이즈 키우기 */
-    while (cache->left_space < obj->length) {
-        if (evict_object(cache) == -1) {  // 수용가능할때까지 LRU로 쫓아냄
-            V(&cache->w); 
-            return -1;
+    write_lock(cache);
+
+    if (split < length && (body = find_body(cache, h, data + split, length - split)) != NULL) {
+        __sync_fetch_and_add(&body->refs, 1);
+        shared = 1;
+    }
+    if (make_room(cache, sizeof(cache_object) + strlen(id) + 1 + (shared ? split : length), part) == -1)
+        goto fail;
+    if (split < length && !shared) {
+        while ((body = new_body(cache, h, length - split, part)) == NULL) {
+            if (evict_for(cache, part) == -1)
+                goto fail;
         }
     }
 
-    add_to_end(obj, cache);
+        /* 캐시 사이즈 키우기: slab에 자리가 날 때까지 */
+    while ((obj = init_object(cache, id, hash, split)) == NULL) {
+        if (evict_for(cache, part) == -1)  // 수용가능할때까지 정책이 고른 애를 쫓아냄
+            goto fail;
+    }
+    write_unlock(cache);
+
+    /* 슬롯은 아직 인덱스에 없어서 아무도 못 건드림 -> 복사는 락 밖에서 */
+    memcpy(obj->data, data, split);
+    if (body != NULL) {
+        if (!shared)
+            memcpy(body->data, data + split, length - split);
+        obj->body = body;
+        obj->length = length;
+    }
+    if (meta != NULL)
+        obj->meta = *meta;
+    obj->ban_checked = ban_checked;
 
+    if (out != NULL) {
+        obj->refcnt++;
+        *out = obj;
+    }
+
+    write_lock(cache);
+    if (shared)
+        cache->stats.dedup_hits++;
+    insert_object(cache, obj);
     // write lock 풀기
-    V(&(cache->w));
+    write_unlock(cache);
 
     return 0;
+
+fail:
+    cache->stats.insert_fails++;
+    write_unlock(cache);
+    if (body != NULL)
+        release_body(cache, body);
+    return -1;
+}
+
+int add_to_cache(cache_list *cache, cache_key* key, char *data, unsigned int length) {
+    return insert_copy(cache, (char*)key->id, key->hash, NULL, 0, data, length, NULL);
 }
 
-/* 캐시에 object를 추가(맨끝에 ) */
-void add_to_end(cache_object* obj, cache_list* list) { // LRU를 위해 연결리스트의 끝에 연결?
+/* 캐시 인덱스에 object를 추가(맨끝에), 순서는 정책이 따로 관리하고 여기는 찾기용 */
+void add_to_end(cache_object* obj, cache_list* list) {
+    cache_object** bucket = bucket_of(list, obj->hash);
+
+    list->left_space -= obj->charge;
+    list->parts[obj->part].used += obj->charge;
+    if (obj->body != NULL)
+        link_body(list, obj->body);
+    obj->hnext = *bucket;
+    *bucket = obj;
+    obj->next = NULL;
+    obj->prev = list->end;
 
     if (list->start != NULL) { // list가 아예 빈값이 아니면
-        list->left_space -= obj->length;
         list->end->next = obj;
         list->end = obj;
     }
     else {
-        list->left_space -= obj->length;
         list->start = obj;
         list->end = obj;
     }
 }
 
-/* id가 같은애를 찾아서 없애주면 됨 */
-cache_object * delete_object(cache_list* cache, char* query_id) {
-    cache_object* searcher = cache->start;
-    cache_object* follower = NULL;
-    while (searcher != NULL) {
+/* 인덱스에서만 떼어낸다, 정책에는 호출하는 쪽이 알려줘야 함 */
+static void unlink_object(cache_list* cache, cache_object* obj) {
+    cache_object** pp = bucket_of(cache, obj->hash);
+    cache_object* r;
+    while (*pp != obj)
+        pp = &(*pp)->hnext;
+    *pp = obj->hnext;
+    obj->hnext = NULL;
 
-        if (!strcmp(searcher->id, query_id)) { // 같은거 찾음
-            if (follower == NULL)  // 삭제하려는 값이 리스트의 시작
-            {
-                cache->start = searcher->next;
-                free(follower);
-            }
-            else                 // 삭제하려는 값이 리스트의 중간또는 끝
-            {
-                follower->next = searcher->next;
-                free(follower);
-            }
+    if (obj->prev)
+        obj->prev->next = obj->next;
+    else
+        cache->start = obj->next;
+    if (obj->next)
+        obj->next->prev = obj->prev;
+    else
+        cache->end = obj->prev;
+    obj->prev = obj->next = NULL;
 
-            /* 캐시 사이즈 늘리기 */
-            if (cache->left_space + searcher->length > MAX_CACHE_SIZE) {
-                cache->left_space = MAX_CACHE_SIZE;
-            } else {
-                cache->left_space += searcher->length;
-            }
+    if (obj->chunks != NULL) {
+        if (obj->lprev)
+            obj->lprev->lnext = obj->lnext;
+        else
+            cache->large_start = obj->lnext;
+        if (obj->lnext)
+            obj->lnext->lprev = obj->lprev;
+        else
+            cache->large_end = obj->lprev;
+        obj->lprev = obj->lnext = NULL;
+    }
 
-            return searcher;
-        }
-        
-        follower = searcher;
-        searcher = searcher->next;
+    /* 캐시 사이즈 늘리기 */
+    cache->left_space += obj->charge;
+    cache->parts[obj->part].used -= obj->charge;
+    if (obj->body != NULL)
+        unlink_body(cache, obj->body);
+    for (r = obj->replicas; r != NULL; r = r->hnext) { // 복제본 몫도 (메모리는 원본이 돌아갈 때)
+        cache->left_space += r->charge;
+        cache->parts[obj->part].used -= r->charge;
     }
-    return NULL;
 }
 
-/* LRU원칙에 따라 연결리스트의 첫번째 인자를 삭제 */
+static void remove_object(cache_list* cache, cache_object* obj, int evicted) {
+    unlink_object(cache, obj);
+    cache->parts[obj->part].policy->on_remove(cache->parts[obj->part].policy, obj, evicted);
+    if (evicted) {
+        cache->stats.evictions++;
+        cache->parts[obj->part].evictions++;
+        if (obj->chunks != NULL)
+            cache->stats.large_evictions++;
+        if (cache->evict_hook != NULL)
+            cache->evict_hook(cache->evict_hook_arg, obj);
+    }
+    obj->dead = 1;
+    cache_release(cache, obj); // 인덱스가 들고 있던 참조
+}
+
+/* id가 같은애를 찾아서 캐시에서 떼어낸다, 읽고 있는 쓰레드가 없으면 바로 메모리도 돌아감
+   write 락을 잡고 불러야 함. 찾았으면 0, 없으면 -1 */
+int delete_object(cache_list* cache, cache_key* key) {
+    cache_object* searcher = find_object(cache, key->id, key->hash);
+    if (searcher == NULL)
+        return -1;
+
+    remove_object(cache, searcher, 0);
+    return 0;
+}
+
+/* 그 파티션의 교체 정책이 고른 객체 하나를 삭제 */
+static int evict_from(cache_list* cache, cache_partition* part) {
+    cache_object* obj = part->policy->choose_victim(part->policy);
+    if (obj == NULL)
+        return -1;
+
+    remove_object(cache, obj, 1);
+    return 0;
+}
+
+/* part 파티션에 넣을 자리를 만들려고 하나 쫓아낸다 (part < 0이면 누구 자리든)
+   1. part가 최소 몫을 넘었으면 자기 것부터
+   2. 아니면 최소 몫을 제일 많이 넘은 다른 파티션
+   3. 다들 최소 몫 이하면 자기 것 - 남의 최소 몫은 건드리지 않는다 */
+static int evict_for(cache_list* cache, int part) {
+    cache_partition* best = NULL;
+    int i;
+
+    if (part >= 0 && cache->parts[part].used > cache->parts[part].min && evict_from(cache, &cache->parts[part]) == 0)
+        return 0;
+    for (i = 0; i < cache->nparts; i++) {
+        cache_partition* p = &cache->parts[i];
+        if (i != part && p->used > p->min && (best == NULL || p->used - p->min > best->used - best->min))
+            best = p;
+    }
+    if (best != NULL && evict_from(cache, best) == 0)
+        return 0;
+    if (part >= 0)
+        return evict_from(cache, &cache->parts[part]);
+    for (i = 0; i < cache->nparts; i++)
+        if (evict_from(cache, &cache->parts[i]) == 0)
+            return 0;
+    return -1;
+}
+
+/* 정책이 고른 객체 하나를 삭제, 어느 파티션이든 최소 몫을 제일 많이 넘은 곳부터 */
 int evict_object(cache_list * cache) {
-    cache_object* obj = cache->start;
-    if (obj == NULL) 
+    return evict_for(cache, -1);
+}
+
+/* 큰 객체 중 가장 오래된 것을 삭제 (큰 객체 몫이 꽉 찼을 때) */
+static int evict_large(cache_list* cache) {
+    if (cache->large_start == NULL)
         return -1;
-    
-    if (obj == cache->end)
-        cache->end = NULL;
-    
-    cache->start = obj->next;
-    cache->left_space += obj->length;
 
-    Free(obj->id);
-    Free(obj->data);
-    Free(obj);
+    remove_object(cache, cache->large_start, 1);
+    return 0;
+}
+
+void destory_cache(cache_list* list) {
+    int i;
+
+    while (list->start != NULL)
+        remove_object(list, list->start, 0);
+    for (i = 0; i < list->nparts; i++)
+        policy_destroy(list->parts[i].policy);
+    for (i = 0; i < list->narenas; i++)
+        slab_destroy(list->arenas[i]);
+    Free(list->buckets);
+    if (list->bodies != NULL)
+        Free(list->bodies);
+    Free(list);
+}
+
+/* 지금 캐시에 있는 객체들을 참조를 잡아서 배열로 돌려준다 (스냅샷 등)
+   인덱스에 들어온 순서대로, 다 쓰면 각각 cache_release 하고 배열은 Free */
+int cache_collect(cache_list* cache, cache_object*** out) {
+    cache_object* obj;
+    cache_object** arr;
+    int n = 0;
+
+    open_reader(cache);
+    for (obj = cache->start; obj != NULL; obj = obj->next)
+        n++;
+    arr = Malloc((n ? n : 1) * sizeof(cache_object*));
+    n = 0;
+    for (obj = cache->start; obj != NULL; obj = obj->next) {
+        __sync_fetch_and_add(&obj->refcnt, 1);
+        arr[n++] = obj;
+    }
+    close_reader(cache);
+
+    *out = arr;
+    return n;
+}
 
+/* ---------- 릴레이하면서 채우기 ---------- */
+
+void cache_fill_begin(cache_fill* fill, cache_list* cache, cache_key* key) {
+    fill->cache = cache;
+    fill->id = (char*)key->id;
+    fill->hash = key->hash;
+    memset(&fill->meta, 0, sizeof(cache_meta));
+    fill->ban_checked = 0;
+    fill->buf = NULL;
+    fill->len = 0;
+    fill->obj = NULL;
+    fill->tail = NULL;
+    fill->failed = 0;
+}
+
+/* 지금까지 받은 걸 버리고 캐시는 포기 */
+void cache_fill_abort(cache_fill* fill) {
+    if (fill->obj != NULL)
+        cache_release(fill->cache, fill->obj);
+    if (fill->buf != NULL)
+        Free(fill->buf);
+    fill->obj = NULL;
+    fill->buf = NULL;
+    fill->failed = 1;
+}
+
+/* 청크 하나 받기, 큰 객체 몫을 넘으면 오래된 큰 객체부터, slab이 꽉 찼으면 정책대로 쫓아낸다 */
+static cache_chunk* new_chunk(cache_list* cache, int part) {
+    cache_chunk* chunk = NULL;
+    size_t charged;
+
+    write_lock(cache);
+    while (cache->large_used + CACHE_CHUNK_SIZE > cache->large_limit) {
+        if (evict_large(cache) == -1)
+            goto out;
+    }
+    if (make_room(cache, CACHE_CHUNK_SIZE, part) == -1)
+        goto out;
+    while ((chunk = cache_alloc(cache, CACHE_CHUNK_SIZE, &charged, NULL)) == NULL) {
+        if (evict_for(cache, part) == -1)
+            goto out;
+    }
+    __sync_fetch_and_add(&cache->large_used, CACHE_CHUNK_SIZE);
+    chunk->next = NULL;
+    chunk->len = 0;
+out:
+    if (chunk == NULL)
+        cache->stats.insert_fails++;
+    write_unlock(cache);
+    return chunk;
+}
+
+static int fill_chunks(cache_fill* fill, const char* data, size_t n) {
+    cache_object* obj = fill->obj;
+    size_t room;
+
+    while (n > 0) {
+        if (fill->tail == NULL || fill->tail->len == CACHE_CHUNK_DATA) {
+            cache_chunk* chunk = new_chunk(fill->cache, obj->part);
+            if (chunk == NULL)
+                return -1;
+            if (fill->tail)
+                fill->tail->next = chunk;
+            else
+                obj->chunks = chunk;
+            fill->tail = chunk;
+            obj->charge += CACHE_CHUNK_SIZE;
+        }
+        room = CACHE_CHUNK_DATA - fill->tail->len;
+        if (room > n)
+            room = n;
+        memcpy(fill->tail->data + fill->tail->len, data, room);
+        fill->tail->len += room;
+        obj->length += room;
+        data += room;
+        n -= room;
+    }
     return 0;
 }
 
+/* 서버에서 받은 n바이트를 이어붙인다
+   max_object까지는 버퍼에 모으고, 넘어가는 순간 헤더 슬롯 + 청크로 바꿔서 계속 채운다 */
+void cache_fill_append(cache_fill* fill, const void* data, size_t n) {
+    cache_list* cache = fill->cache;
+
+    if (fill->failed)
+        return;
+
+    if (fill->obj == NULL) {
+        if (fill->len + n <= cache->max_object) {
+            if (fill->buf == NULL)
+                fill->buf = Malloc(cache->max_object);
+            memcpy(fill->buf + fill->len, data, n);
+            fill->len += n;
+            return;
+        }
+
+        /* 청크 모드로 전환 */
+        if (cache->max_large_object <= cache->max_object) {
+            cache_fill_abort(fill);
+            return;
+        }
+        write_lock(cache);
+        while ((fill->obj = init_object(cache, fill->id, fill->hash, 0)) == NULL) {
+            if (evict_for(cache, cache_partition_of(cache, fill->id)) == -1)
+                break;
+        }
+        write_unlock(cache);
+        if (fill->obj == NULL) {
+            cache_fill_abort(fill);
+            return;
+        }
+        fill->obj->data = NULL;
+        if (fill_chunks(fill, fill->buf, fill->len) == -1) {
+            cache_fill_abort(fill);
+            return;
+        }
+        Free(fill->buf);
+        fill->buf = NULL;
+    }
+
+    if (fill->obj->length + n > cache->max_large_object || fill_chunks(fill, data, n) == -1)
+        cache_fill_abort(fill);
+}
+
+/* 다 받았으니 캐시에 올린다, 성공하면 0
+   out이 NULL이 아니면 올라간 객체의 참조를 잡아서 돌려준다 */
+int cache_fill_commit(cache_fill* fill, cache_object** out) {
+    cache_list* cache = fill->cache;
+    int ret;
+
+    if (fill->failed)
+        return -1;
+
+    if (fill->obj == NULL) { // 작은 객체: 슬롯 하나로
+        ret = insert_copy(cache, fill->id, fill->hash, &fill->meta, fill->ban_checked, fill->buf, fill->len, out);
+        if (fill->buf != NULL)
+            Free(fill->buf);
+        fill->buf = NULL;
+        return ret;
+    }
+
+    fill->obj->meta = fill->meta;
+    fill->obj->ban_checked = fill->ban_checked;
+    if (out != NULL) {
+        fill->obj->refcnt++;
+        *out = fill->obj;
+    }
+    write_lock(cache);
+    insert_object(cache, fill->obj);
+    write_unlock(cache);
+    fill->obj = NULL;
+    return 0;
+}
+
+/* 304로 재검증된 객체의 메타데이터만 새로 바꾼다, 본문은 그대로 */
+void cache_update_meta(cache_list* cache, cache_object* obj, cache_meta* meta) {
+    cache_object* r;
+
+    write_lock(cache);
+    obj->meta = *meta;
+    for (r = obj->replicas; r != NULL; r = r->hnext)
+        r->meta = *meta;
+    write_unlock(cache);
+}
+
+/* obj가 아직 인덱스에 있으면 떼어낸다 (PURGE, ban) - 그 사이 같은 키로 새로 들어온 객체는 안 건드린다
+   읽고 있던 쓰레드들은 참조를 쥐고 있으니 마저 쓴다. 떼어냈으면 0 */
+int cache_remove(cache_list* cache, cache_object* obj) {
+    int ret = -1;
+
+    write_lock(cache);
+    if (find_object(cache, obj->id, obj->hash) == obj) {
+        remove_object(cache, obj, 0);
+        ret = 0;
+    }
+    write_unlock(cache);
+    return ret;
+}
+
+/* L1에서 hit한 객체를 가끔 정책에도 알려준다 - 안 그러면 제일 hot한 객체가 공유 캐시에선 안 쓰이는 걸로 보인다
+   인덱스에서 빠진 객체에 on_hit을 부르면 안 되니 reader 락 안에서 dead를 본다 */
+void cache_touch(cache_list* cache, cache_object* obj) {
+    open_reader(cache);
+    if (!obj->dead) {
+        cache_policy* policy = cache->parts[obj->part].policy;
+        P(&cache->plock);
+        policy->on_hit(policy, obj);
+        V(&cache->plock);
+    }
+    close_reader(cache);
+}
+
+/* limit을 줄였으면 넘친 만큼 뒤에서 쫓아낸다 - write 락은 CACHE_SHRINK_BATCH개마다 놓아서 요청들이 사이사이 들어온다
+   다 줄였으면 빈 페이지들을 커널에 돌려준다 (다시 쓰면 그때 page fault) */
+static void* shrink_thread(void* arg) {
+    cache_list* cache = arg;
+    int i, done;
+
+    Pthread_detach(Pthread_self());
+    while (1) {
+        P(&cache->shrink_wake);
+        done = 0;
+        while (!done) {
+            write_lock(cache);
+            for (i = 0; i < CACHE_SHRINK_BATCH; i++) {
+                if (cache->capacity - cache->left_space <= cache->limit || evict_for(cache, -1) == -1) {
+                    done = 1;
+                    break;
+                }
+                cache->stats.shrink_evictions++;
+            }
+            write_unlock(cache);
+            sched_yield();
+        }
+        for (i = 0; i < cache->narenas; i++)
+            __sync_fetch_and_add(&cache->stats.shrink_trimmed, slab_trim(cache->arenas[i]));
+    }
+    return NULL;
+}
+
+/* 캐시 크기를 바꾼다 (CACHE_MIN_LIMIT ~ 잡아둔 영역 크기로 자른다), 바뀐 크기 리턴
+   몫은 바로 바뀌고, 줄인 거면 넘친 객체는 shrinker 쓰레드가 조금씩 쫓아낸다 (evict_object를 락 안에서 한참 돌리지 않게) */
+size_t cache_resize(cache_list* cache, size_t size) {
+    size_t old;
+    int start, i;
+
+    if (size < CACHE_MIN_LIMIT)
+        size = CACHE_MIN_LIMIT;
+    if (size > cache->capacity)
+        size = cache->capacity;
+
+    write_lock(cache);
+    old = cache->limit;
+    cache->limit = size;
+    apply_limit(cache);
+    cache->stats.resizes++;
+    for (i = 0; i < cache->narenas; i++)
+        slab_set_limit(cache->arenas[i], size / cache->narenas);
+    start = size < old && !cache->shrinker;
+    if (start)
+        cache->shrinker = 1;
+    write_unlock(cache);
+
+    if (start) {
+        pthread_t tid;
+        Pthread_create(&tid, NULL, shrink_thread, cache);
+    }
+    if (size < old)
+        V(&cache->shrink_wake);
+    return size;
+}
+
+/* 통계를 사람이 읽을 수 있는 텍스트로 buf에 쓴다, 쓴 길이 리턴 */
+int cache_stats_text(cache_list* cache, char* buf, size_t len) {
+    cache_stats st;
+    size_t left_space, slab_used = 0, huge_bytes = 0, limit;
+    unsigned int free_pages = 0, npages = 0;
+    cache_partition parts[CACHE_MAX_PARTITIONS];
+    int n, i;
+
+    open_reader(cache);
+    P(&cache->plock);
+    st = cache->stats;
+    memcpy(parts, cache->parts, sizeof(parts));
+    V(&cache->plock);
+    left_space = cache->left_space;
+    limit = cache->limit;
+    for (i = 0; i < cache->narenas; i++) {
+        slab_used += cache->arenas[i]->used;
+        free_pages += cache->arenas[i]->free_pages;
+        npages += cache->arenas[i]->npages;
+        huge_bytes += slab_huge_bytes(cache->arenas[i]);
+    }
+    close_reader(cache);
+
+    n = snprintf(buf, len,
+        "policy: %s\n"
+        "capacity: %zu\n"
+        "capacity_max: %zu\n"
+        "used: %zu\n"
+        "slab_used: %zu\n"
+        "slab_free_pages: %u/%u\n"
+        "slab_huge_pages: %s (%zu bytes)\n"
+        "hits: %lu\n"
+        "misses: %lu\n"
+        "hit_ratio: %.4f\n"
+        "inserts: %lu\n"
+        "evictions: %lu\n"
+        "insert_fails: %lu\n"
+        "large_used: %zu/%zu\n"
+        "large_inserts: %lu\n"
+        "large_evictions: %lu\n",
+        cache->parts[0].policy->name,
+        limit, cache->capacity,
+        cache->capacity - left_space,
+        slab_used,
+        free_pages, npages,
+        cache->arenas[0]->huge == SLAB_HUGE_TLB ? "hugetlb" : cache->arenas[0]->huge == SLAB_HUGE_THP ? "thp" : "none",
+        huge_bytes,
+        st.hits, st.misses,
+        st.hits + st.misses ? (double)st.hits / (st.hits + st.misses) : 0.0,
+        st.inserts, st.evictions, st.insert_fails,
+        cache->large_used, cache->large_limit,
+        st.large_inserts, st.large_evictions);
+    if (cache->dedup && n < len)
+        n += snprintf(buf + n, len - n,
+            "dedup_hits: %lu\n"
+            "dedup_bodies: %lu\n"
+            "dedup_saved: %zu\n",
+            st.dedup_hits, st.dedup_bodies, st.dedup_saved);
+    if (st.resizes > 0 && n < (int)len)
+        n += snprintf(buf + n, len - n,
+            "resizes: %lu\n"
+            "shrink_evictions: %lu\n"
+            "shrink_trimmed: %zu\n",
+            st.resizes, st.shrink_evictions, st.shrink_trimmed);
+    if (cache->narenas > 1 && n < (int)len)
+        n += snprintf(buf + n, len - n,
+            "numa_spills: %lu\n"
+            "numa_remote_hits: %lu\n"
+            "numa_replicas: %lu\n",
+            st.numa_spills, st.numa_remote_hits, st.numa_replicas);
+    for (i = 0; cache->narenas > 1 && i < cache->narenas && n < (int)len; i++) {
+        slab_arena* a = cache->arenas[i];
+        n += snprintf(buf + n, len - n, "numa node %d: size=%zu used=%zu free_pages=%u/%u%s\n",
+            i, a->size, a->used, a->free_pages, a->npages, a->node < 0 ? " (unbound)" : "");
+    }
+    for (i = 0; cache->nparts > 1 && i < cache->nparts && n < (int)len; i++) {
+        cache_partition* p = &parts[i];
+        n += snprintf(buf + n, len - n,
+            "partition %s: used=%zu min=%zu max=%zu hits=%lu misses=%lu hit_ratio=%.4f inserts=%lu evictions=%lu\n",
+            p->name, p->used, p->min, p->max, p->hits, p->misses,
+            p->hits + p->misses ? (double)p->hits / (p->hits + p->misses) : 0.0, p->inserts, p->evictions);
+    }
+    return n < (int)len ? n : (int)len - 1; // 잘렸으면 실제로 쓴 만큼
+}
+
+/* 64비트 FNV-1a, 키를 비교 없이 구분할 때 쓴다 */
+uint64_t cache_hash(const char* s, size_t len) {
+    return cache_hash_continue(CACHE_HASH_INIT, s, len);
+}
+
+/* 여러 조각을 이어서 해시할 때 (스냅샷 체크섬 등), 처음엔 h = CACHE_HASH_INIT */
+uint64_t cache_hash_continue(uint64_t h, const void* s, size_t len) {
+    const unsigned char* p = s;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/* 본문 중복 제거용 128비트 해시 (MurmurHash3 x64_128, seed 0)
+   FNV처럼 바이트마다 곱하지 않고 16바이트씩 먹어서 100KB 본문도 금방 끝난다 */
+void cache_hash128(const void* s, size_t len, uint64_t out[2]) {
+    const unsigned char* p = s;
+    const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 0, h2 = 0, k1, k2;
+    size_t i, nblocks = len / 16;
+    const unsigned char* tail;
+
+    for (i = 0; i < nblocks; i++) {
+        memcpy(&k1, p + i * 16, 8);
+        memcpy(&k2, p + i * 16 + 8, 8);
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    tail = p + nblocks * 16;
+    k1 = k2 = 0;
+    for (i = len & 15; i > 8; i--)
+        k2 |= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+    if (k2) {
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    for (i = (len & 15) < 8 ? (len & 15) : 8; i > 0; i--)
+        k1 |= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+    if (k1) {
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= len; h2 ^= len;
+    h1 += h2; h2 += h1;
+    h1 = fmix64(h1); h2 = fmix64(h2);
+    h1 += h2; h2 += h1;
+    out[0] = h1;
+    out[1] = h2;
+}
+
+/* id로 키를 만든다 (해시는 여기서 한 번만) */
+void cache_key_init(cache_key* key, const char* id) {
+    key->id = id;
+    key->len = strlen(id);
+    key->hash = cache_hash(id, key->len);
+}
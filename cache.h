@@ -1,56 +1,307 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
 #include "csapp.h"
+#include "policy.h"
+#include "slab.h"
+#include "numa.h"
 
-/* Recommended max cache and object sizes */
+/* Recommended max cache and object sizes - 기본값일 뿐, 실제로는 --cache-size, --max-object로 정한다
+   캐시 크기는 돌아가는 중에도 바꿀 수 있다 (cache_resize, --cache-max까지) */
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
 
+#define CACHE_MIN_LIMIT (256 * 1024) // 줄여도 이 밑으로는 안 간다
+#define CACHE_SHRINK_BATCH 32        // 줄일 때 write 락 한 번에 쫓아내는 객체 수, 사이사이 다른 쓰레드가 들어온다
+
+/* MAX_OBJECT_SIZE를 넘는 큰 객체는 slab 페이지 한 장짜리 청크들을 이어서 저장한다 */
+#define MAX_LARGE_OBJECT_SIZE (8 * 1024 * 1024)
+#define LARGE_SHARE_PERCENT 50 // 큰 객체들이 차지할 수 있는 캐시 비율
+
+typedef struct cache_chunk {
+    struct cache_chunk* next;
+    unsigned int len;
+    char data[];
+} cache_chunk;
+
+#define CACHE_CHUNK_SIZE SLAB_PAGE_SIZE
+#define CACHE_CHUNK_DATA (CACHE_CHUNK_SIZE - sizeof(cache_chunk))
+
+/* 캐시 키: 정규화한 절대 URL (http://host[:port]/path?query)과 그 해시
+   요청마다 한 번만 만들어서 lookup, 삽입, 교체, 디스크/공유 캐시까지 해시를 그대로 들고 다닌다 */
+typedef struct cache_key {
+    const char* id;
+    size_t len;
+    uint64_t hash;
+} cache_key;
+
+#define CACHE_MIN_BUCKETS 1024
+
+/* 응답을 캐시에 넣을 때 한 번 파싱해둔 HTTP 메타데이터 (http.c)
+   디스크/공유 캐시/스냅샷에도 그대로 같이 저장된다 */
+typedef struct cache_meta {
+    int64_t resp_time;   // 응답을 받은 시각 (epoch 초)
+    int64_t date;        // Date 헤더, 없으면 resp_time
+    uint32_t age;        // 받았을 때 이미 지난 나이 (RFC 7234의 corrected_initial_age)
+    uint32_t lifetime;   // freshness lifetime (초)
+    uint32_t hdr_len;    // 저장된 응답 중 헤더 길이 (\r\n\r\n 포함), 0이면 HTTP 메타데이터 없음
+    uint32_t status;
+    int64_t last_modified; // Last-Modified, 없으면 -1 (재검증용 If-Modified-Since)
+    uint32_t flags;        // CACHE_META_*
+    uint32_t swr;          // 만료 후 이 기간 안이면 stale로 바로 답하고 뒤에서 재검증 (stale-while-revalidate)
+    uint32_t sie;          // 만료 후 이 기간 안이면 원 서버 에러 때 stale로 답한다 (stale-if-error)
+    uint64_t vary_hash;    // Vary 변형이면 그 요청 헤더 값들의 해시 (같은 자리의 다른 변형과 구분)
+    uint32_t raw_len;      // CACHE_META_GZIP이면 압축 풀기 전 본문 길이
+} cache_meta;
+
+#define CACHE_META_ETAG 1  // 저장된 헤더에 ETag가 있다 (값은 헤더에서 꺼내 쓴다)
+#define CACHE_META_VARY 2  // 본문 대신 Vary 헤더 이름 목록만 든 표시 객체, 실제 응답은 변형 키에
+#define CACHE_META_NEGATIVE 4 // 에러 응답/연결 실패를 짧게 기억해두는 합성 응답
+#define CACHE_META_GZIP 8  // 본문이 gzip으로 압축돼 저장돼 있다, 헤더는 원래 그대로 (compress.c)
+
+/* 본문 중복 제거: 내용이 같은 본문은 URL이 달라도 한 번만 저장하고 객체들이 같이 가리킨다
+   128비트 해시로 찾고 길이와 내용까지 비교한다, 슬롯 하나에 들어가는 객체만 (청크로 저장되는 큰 객체는 따로) */
+#define CACHE_DEDUP_MIN 2048  // 이보다 작은 본문은 슬롯을 따로 잡는 게 더 손해
+
+typedef struct cache_body {
+    struct cache_body* hnext; // 본문 해시 표 체인
+    uint64_t h[2];            // 본문의 128비트 해시
+    unsigned int len;
+    int refs;        // 가리키는 객체 수 (인덱스에서 빠졌어도 아직 읽히는 중인 것 포함), 0이 되면 slab으로
+    int users;       // 인덱스에 있는 객체 중 가리키는 수, write 락 안에서만. 0이 되면 표에서 빠지고 용량도 돌려준다
+    int hashed;      // 표에 들어가 있다 (같은 내용이 동시에 두 번 들어오면 먼저 올라간 쪽만)
+    int part;        // 용량을 물고 있는 파티션 (처음 넣은 객체의 것)
+    size_t charge;
+    char data[];
+} cache_body;
+
 typedef struct cache_object {
+    struct cache_object* prev;
     struct cache_object* next;
-    char* id; // 유저는 파일이름으로 찾자나....
-    void* data;
+    struct cache_object* hnext; // 해시 버킷 체인
+    char* id; // 예전엔 path만 썼는데 그러면 호스트가 달라도 /index.html이 겹친다 -> 절대 URL
+    uint64_t hash; // id의 cache_hash, 비교할 때 해시부터 보고 같을 때만 strcmp
+    void* data;           // 작은 객체: 슬롯 안에 바로 붙어있는 본문, 큰 객체면 NULL
+    cache_body* body;     // 본문을 공유하면 [length - body->len, length)는 여기에 (슬롯에는 헤더까지만)
+    cache_chunk* chunks;  // 큰 객체: 청크 리스트
     int length;
+    size_t charge;    // slab에서 실제로 차지하는 크기 (헤더+키+본문이 든 슬롯 크기, 큰 객체는 청크 포함)
+    int refcnt;       // 캐시 인덱스가 1개, 읽고 있는 쓰레드마다 1개씩. 0이 되면 slab으로 돌아간다
+    cache_meta meta;  // 저장된 헤더에는 Age가 빠져있다, hit 때 meta로 계산해서 넣어준다
+    int refreshing;   // 백그라운드 refresh가 진행 중이다 (객체마다 한 번에 하나만)
+    uint32_t ban_checked; // 마지막으로 확인한 ban 번호 (ban.c), 0이면 아직 한 번도
+    int dead;         // 인덱스에서 빠졌다 (교체, 퇴거, PURGE) - 쓰레드별 L1이 보고 버린다
+    int part;         // 속한 파티션 (cache_list->parts), 키의 호스트로 정해진다
+    int node;         // 슬롯이 있는 NUMA 노드 (cache_list->arenas 번호)
+    unsigned int remote_hits; // 다른 노드 워커가 hit한 수, cache_list->replicate에 닿으면 그 노드에 복제본을 만든다
+    struct cache_object* replicas; // 다른 노드에 둔 복제본들 (hnext로 이어짐), 원본이 slab으로 돌아갈 때 같이
+
+    /* 큰 객체끼리는 따로 FIFO로 묶어서 LARGE_SHARE_PERCENT를 넘지 않게 한다 */
+    struct cache_object* lprev;
+    struct cache_object* lnext;
+
+    /* 교체 정책이 쓰는 메타데이터 - 어떤 정책이 쓰는지는 policy.c 참고 */
+    struct cache_object* pprev;
+    struct cache_object* pnext;
+    int queue;        // 객체가 들어있는 정책 큐 번호
+    unsigned int freq;
+    double priority;  // GDSF의 H값
+    int heap_idx;     // GDSF 힙에서의 위치
 } cache_object;
 
+/* 캐시 통계, /stats 로 확인 */
+typedef struct cache_stats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long inserts;
+    unsigned long evictions;
+    unsigned long insert_fails;
+    unsigned long large_inserts;
+    unsigned long large_evictions;
+    unsigned long dedup_hits;     // 이미 있던 본문을 같이 쓰게 된 삽입 수
+    unsigned long dedup_bodies;   // 지금 인덱스에 있는 공유 본문 수
+    size_t dedup_saved;           // 공유 덕에 안 쓰고 있는 바이트 (본문 길이 x (가리키는 객체 수 - 1))
+    unsigned long numa_spills;    // 자기 노드 영역이 꽉 차서 다른 노드 영역에 잡은 슬롯 수
+    unsigned long numa_remote_hits; // 다른 노드 메모리에 있는 객체를 보낸 수 (복제본으로 보낸 건 빼고)
+    unsigned long numa_replicas;  // 만든 복제본 수
+    unsigned long resizes;
+    unsigned long shrink_evictions; // 크기를 줄이느라 뒤에서 쫓아낸 수
+    size_t shrink_trimmed;        // 줄인 다음 커널에 돌려준 빈 페이지 바이트 (누적)
+} cache_stats;
+
+/* 원 서버(호스트 묶음)별 파티션
+   - 최소 몫(min)까지는 다른 파티션 때문에 쫓겨나지 않는다
+   - 최대 몫(max)을 넘으면 자기 것부터 쫓아낸다
+   - 자리가 모자라면 넣는 파티션이 최소 몫을 넘었으면 자기 것부터, 아니면 최소 몫을 제일 많이 넘은 파티션에서
+   파티션마다 교체 정책을 따로 두어서 희생자도 그 안에서만 고른다
+   0번은 기본 파티션 (어느 묶음에도 안 걸린 호스트 전부), 파티션을 안 나누면 이것 하나뿐이라 예전과 같다 */
+#define CACHE_MAX_PARTITIONS 16
+
+typedef struct cache_partition {
+    const char* name;
+    const char* hosts;      // 쉼표로 구분, ".example.com"은 그 아래 호스트 전부
+    size_t min;             // 몫은 지금 캐시 크기(limit)의 %로, 크기가 바뀌면 다시 계산한다
+    size_t max;
+    int min_share;
+    int max_share;
+    size_t used;            // 인덱스에 있는 객체들의 charge (공유 본문은 처음 넣은 객체의 파티션에), write 락
+    cache_policy* policy;
+    unsigned long hits;     // hits/misses/inserts/evictions는 plock (inserts, evictions는 write 락)
+    unsigned long misses;
+    unsigned long inserts;
+    unsigned long evictions;
+} cache_partition;
+
+/* --partition=NAME:HOSTS:MIN%:MAX% 하나 */
+typedef struct cache_partition_config {
+    const char* name;
+    const char* hosts;
+    int min_share;
+    int max_share;
+} cache_partition_config;
+
+/* 시작할 때 커맨드라인으로 정하는 캐시 설정 */
+typedef struct cache_config {
+    const char* policy;
+    size_t capacity;          // 캐시 전체 메모리 예산
+    size_t max_capacity;      // 나중에 키울 수 있는 최대 (영역은 이만큼 잡는다), 0이면 capacity
+    size_t max_object;        // 이 크기까지는 슬롯 하나에 통째로
+    size_t max_large_object;  // 이 크기까지는 청크로 나눠서, 넘으면 캐시 안 함
+    int large_share;          // 큰 객체가 쓸 수 있는 예산 비율(%)
+    int dedup;                // 같은 본문을 한 번만 저장
+    int huge_pages;           // 캐시 영역을 2MB huge page로 (안 되면 보통 페이지)
+    int numa_nodes;           // 영역을 이만큼 나눠서 노드마다 하나씩 (numa.c), 1이면 예전처럼 하나
+    unsigned int numa_replicate; // 다른 노드에서 이만큼 hit하면 그 노드에 복제본, 0이면 안 함
+    cache_partition_config parts[CACHE_MAX_PARTITIONS]; // 이름이 default면 기본 파티션의 몫만 정한다
+    int nparts;
+} cache_config;
+
 typedef struct cache_list {
     cache_object* start;
     cache_object* end;
-    unsigned int left_space;
+    cache_object** buckets;  // 찾기용 해시 인덱스, start/end 리스트는 전체를 훑을 때만 (스냅샷 등)
+    unsigned int nbuckets;   // 2의 거듭제곱
+    size_t left_space;       // arena들에서 아직 안 쓴 바이트, 슬롯 크기 기준이라 정확하다
+    size_t capacity;         // arena 크기의 합, 캐시 크기를 이 이상으로는 못 키운다
+    size_t limit;            // 지금 캐시 크기, 넘으면 쫓아낸다 (write 락)
+    int large_share;
+    sem_t shrink_wake;       // limit을 줄이면 shrinker 쓰레드를 깨운다
+    int shrinker;            // shrinker 쓰레드를 띄웠다
+    slab_arena* arenas[NUMA_MAX_NODES]; // 캐시 객체는 전부 여기서만 할당, NUMA 노드마다 하나
+    int narenas;
+    unsigned int replicate;  // cache_config->numa_replicate
     // reader개수, 세마포어 필요한데...
     int readcnt; // 현재 읽고 있는 사람수
-    sem_t r; // r은 readcnt에 접근하는 세마포어 
-    sem_t w; // w는 크리티컬 섹션에 대한 접근 제어    
+    sem_t r; // r은 readcnt에 접근하는 세마포어
+    sem_t w; // w는 크리티컬 섹션에 대한 접근 제어
     sem_t serviceQueue; // request의 순서를 저장
 
+    cache_partition parts[CACHE_MAX_PARTITIONS]; // 파티션마다 교체 정책이 하나씩, 시작할 때 정해진다
+    int nparts;
+    sem_t plock;          // reader들이 동시에 on_hit을 부를 수 있으므로 정책 메타데이터와 통계는 따로 잠근다
+    cache_stats stats;
+
+    size_t max_object;
+    size_t max_large_object;
+    size_t large_limit;       // 큰 객체 청크가 쓸 수 있는 바이트 (채우는 중인 것 포함)
+    size_t large_used;
+    cache_object* large_start; // 큰 객체 FIFO, 앞이 오래된 것
+    cache_object* large_end;
+
+    int dedup;
+    cache_body** bodies;      // 공유 본문 해시 표, write 락으로 보호 (크기는 nbuckets와 같다)
+
+    /* 정책이 쫓아낸 객체를 넘겨받을 곳 (디스크 L2 등)
+       write 락을 잡은 채로 불리니 빨리 끝내야 하고, 객체는 리턴하고 나면 사라질 수 있다 */
+    void (*evict_hook)(void* arg, cache_object* obj);
+    void* evict_hook_arg;
 } cache_list;
 
+/* 서버 응답을 릴레이하면서 조금씩 캐시에 채워넣는 상태
+   max_object까지는 buf에 모았다가 슬롯 하나로, 넘어가면 청크를 하나씩 받아서 채운다 */
+typedef struct cache_fill {
+    cache_list* cache;
+    char* id;
+    uint64_t hash;
+    cache_meta meta;     // 커밋하기 전에 채워두면 객체에 같이 들어간다
+    uint32_t ban_checked; // 원 서버에서 새로 받는 거면 받기 시작할 때의 ban 번호 (그 전 ban에는 안 걸린다)
+    char* buf;
+    unsigned int len;
+    cache_object* obj;   // 청크 모드로 바뀐 뒤에만
+    cache_chunk* tail;
+    int failed;          // 너무 크거나 자리가 없어서 캐시는 포기, 릴레이만 계속
+} cache_fill;
+
 typedef struct thread_args { // Pthread_create가 void*만 인자로 받기때문에, 구조체 만들어서 얘에대한 포인터줘야함
 // 안그러면 캐시가 막 바뀌어버리는ㄴ..
     int *connfd;
     cache_list *cache;
 } thread_args;
 
-cache_list *init_cache();
+cache_list *init_cache(cache_config* config);
+
+cache_object *init_object(cache_list* cache, char* id, uint64_t hash, unsigned int size);
 
-cache_object *init_object(char* id, unsigned int size);
+void open_reader(cache_list* cache);
 
-void open_reader();
+void close_reader(cache_list* cache);
 
-void close_reader();
+cache_object* cache_lookup(cache_list* cache, cache_key* key);
 
-int search_cache(cache_list* list, char* id, void* object, unsigned int* size) ;
+cache_object* cache_peek(cache_list* cache, cache_key* key);
+
+void cache_set_node(int node);
+
+cache_object* cache_local(cache_list* cache, cache_object* obj);
+
+void cache_release(cache_list* cache, cache_object* obj);
+
+ssize_t cache_object_write(int fd, cache_object* obj, size_t offset, size_t len);
+
+size_t cache_object_read(cache_object* obj, size_t offset, void* buf, size_t len);
+
+const char* cache_object_ptr(cache_object* obj, size_t offset, size_t len);
 
 void add_to_end(cache_object* obj, cache_list* list);
 
-cache_object * delete_object(cache_list* cache, char* query_id);
+int delete_object(cache_list* cache, cache_key* key);
 
 int evict_object(cache_list * cache);
 
-int add_to_cache();
-
 void destory_cache(cache_list* list);
 
-int add_to_cache(cache_list *cache, char *id, char *data, unsigned int length);
+int add_to_cache(cache_list *cache, cache_key* key, char *data, unsigned int length);
+
+void cache_fill_begin(cache_fill* fill, cache_list* cache, cache_key* key);
+
+void cache_fill_append(cache_fill* fill, const void* data, size_t n);
+
+int cache_fill_commit(cache_fill* fill, cache_object** out);
+
+void cache_fill_abort(cache_fill* fill);
+
+void cache_update_meta(cache_list* cache, cache_object* obj, cache_meta* meta);
+
+int cache_remove(cache_list* cache, cache_object* obj);
+
+void cache_touch(cache_list* cache, cache_object* obj);
+
+int cache_stats_text(cache_list* cache, char* buf, size_t len);
+
+size_t cache_resize(cache_list* cache, size_t size);
+
+int cache_collect(cache_list* cache, cache_object*** out);
+
+int cache_partition_of(cache_list* cache, const char* id);
+
+#define CACHE_HASH_INIT 14695981039346656037ULL
+
+uint64_t cache_hash(const char* s, size_t len);
+
+uint64_t cache_hash_continue(uint64_t h, const void* s, size_t len);
+
+void cache_hash128(const void* s, size_t len, uint64_t out[2]);
+
+void cache_key_init(cache_key* key, const char* id);
 
-/* Cache header file for cache.c
- * Author: Aleksander Bapst (abapst)
- */
+#endif /* __CACHE_H__ */
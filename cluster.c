@@ -0,0 +1,224 @@
+/* 클러스터 consistent hash 링과 노드 연결 풀, cluster.h 참고 */
+#include "cluster.h"
+#include "cache.h"
+
+typedef struct ring_point {
+    uint64_t hash;
+    int node;
+} ring_point;
+
+static cluster_node nodes[CLUSTER_MAX_NODES];
+static int nnodes = 0;
+static int self = -1;
+static ring_point ring[CLUSTER_MAX_NODES * CLUSTER_VNODES];
+static int npoints = 0;
+static sem_t lock;                // 멤버, 링, 풀 전부 (찾는 건 이분 탐색 한 번이라 짧다)
+static int initialized = 0;
+static unsigned long local_keys = 0, forwarded = 0;
+
+static void cluster_init(void) {
+    if (!initialized) {
+        Sem_init(&lock, 0, 1);
+        initialized = 1;
+    }
+}
+
+/* cache_hash(FNV)는 비슷한 문자열끼리 윗자리가 몰린다 - 링에 올리기 전에 한 번 섞는다 (MurmurHash3 fmix64) */
+static uint64_t spread(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static int point_cmp(const void* a, const void* b) {
+    uint64_t x = ((const ring_point*)a)->hash, y = ((const ring_point*)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+/* 살아있는 노드들로 링을 다시 만든다 - lock을 잡고 부른다
+   점의 자리는 노드 이름으로만 정해지니 다른 노드의 점들은 그대로다 */
+static void rebuild_ring(void) {
+    char vname[MAXLINE + 16];
+    int i, v;
+
+    npoints = 0;
+    for (i = 0; i < nnodes; i++) {
+        if (!nodes[i].active)
+            continue;
+        for (v = 0; v < CLUSTER_VNODES; v++) {
+            int n = snprintf(vname, sizeof(vname), "%s#%d", nodes[i].name, v);
+            ring[npoints].hash = spread(cache_hash(vname, n));
+            ring[npoints].node = i;
+            npoints++;
+        }
+    }
+    qsort(ring, npoints, sizeof(ring_point), point_cmp);
+}
+
+static int find_node(const char* name) {
+    int i;
+
+    for (i = 0; i < nnodes; i++)
+        if (!strcmp(nodes[i].name, name))
+            return i;
+    return -1;
+}
+
+/* 노드를 링에 넣는다 (이미 있으면 다시 살린다), 이름이 "host:port" 꼴이 아니거나 자리가 없으면 -1 */
+int cluster_add(const char* name) {
+    const char* colon = strrchr(name, ':');
+    cluster_node* node;
+    int i;
+
+    if (colon == NULL || colon == name || colon[1] == '\0' || strlen(name) >= MAXLINE || strlen(colon + 1) >= sizeof(node->port))
+        return -1;
+    cluster_init();
+    P(&lock);
+    if ((i = find_node(name)) < 0) {
+        if (nnodes >= CLUSTER_MAX_NODES) {
+            V(&lock);
+            return -1;
+        }
+        i = nnodes++;
+        node = &nodes[i];
+        memset(node, 0, sizeof(*node));
+        strcpy(node->name, name);
+        memcpy(node->host, name, colon - name);
+        node->host[colon - name] = '\0';
+        strcpy(node->port, colon + 1);
+    }
+    nodes[i].active = 1;
+    rebuild_ring();
+    V(&lock);
+    return 0;
+}
+
+/* 노드를 링에서 뺀다, 쉬는 연결은 닫는다 - 없는 노드면 -1 */
+int cluster_remove(const char* name) {
+    int i;
+
+    cluster_init();
+    P(&lock);
+    if ((i = find_node(name)) < 0 || !nodes[i].active) {
+        V(&lock);
+        return -1;
+    }
+    nodes[i].active = 0;
+    while (nodes[i].nidle > 0)
+        Close(nodes[i].idle[--nodes[i].nidle]);
+    rebuild_ring();
+    V(&lock);
+    return 0;
+}
+
+/* 이 노드의 이름, 멤버에 없으면 넣는다 - --cluster를 다 읽은 다음에 */
+void cluster_set_self(const char* name) {
+    if (cluster_add(name) == 0)
+        self = find_node(name);
+}
+
+int cluster_enabled(void) {
+    return self >= 0;
+}
+
+const char* cluster_self(void) {
+    return self >= 0 ? nodes[self].name : "";
+}
+
+/* hash 키의 주인, 내가 주인이거나 클러스터가 아니면 NULL */
+cluster_node* cluster_owner(uint64_t hash) {
+    int lo = 0, hi, owner;
+
+    if (self < 0)
+        return NULL;
+    hash = spread(hash);
+    P(&lock);
+    hi = npoints;
+    if (npoints == 0) {
+        V(&lock);
+        return NULL;
+    }
+    while (lo < hi) { // hash 이상인 첫 점, 없으면 한 바퀴 돌아서 처음 점
+        int mid = (lo + hi) / 2;
+        if (ring[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    owner = ring[lo == npoints ? 0 : lo].node;
+    if (owner == self)
+        local_keys++;
+    else {
+        forwarded++;
+        nodes[owner].forwards++;
+    }
+    V(&lock);
+    return owner == self ? NULL : &nodes[owner];
+}
+
+/* 주인 노드로 가는 연결, 풀에 쉬는 게 있으면 그걸 (*reused = 1) - 못 붙으면 -1 */
+int cluster_connect(cluster_node* node, int* reused) {
+    int fd = -1;
+
+    P(&lock);
+    if (node->nidle > 0) {
+        fd = node->idle[--node->nidle];
+        node->reused++;
+    }
+    V(&lock);
+    *reused = fd >= 0;
+    if (fd >= 0)
+        return fd;
+
+    if ((fd = open_clientfd(node->host, node->port)) < 0) {
+        __sync_fetch_and_add(&node->failures, 1);
+        return -1;
+    }
+    __sync_fetch_and_add(&node->connects, 1);
+    return fd;
+}
+
+/* 다 쓴 연결을 돌려준다, 응답 끝을 정확히 알았을 때만 (reusable) 풀에 - 아니면, 또 풀이 차 있으면 닫는다 */
+void cluster_release(cluster_node* node, int fd, int reusable) {
+    P(&lock);
+    if (reusable && node->active && node->nidle < CLUSTER_POOL_SIZE) {
+        node->idle[node->nidle++] = fd;
+        fd = -1;
+    }
+    V(&lock);
+    if (fd >= 0)
+        Close(fd);
+}
+
+int cluster_stats_text(char* buf, size_t len) {
+    int n, i, p;
+    uint64_t owned[CLUSTER_MAX_NODES];
+
+    if (self < 0)
+        return 0;
+    P(&lock);
+    /* 노드마다 링에서 맡은 몫: 점과 그 앞 점 사이 구간은 그 점의 노드 것 */
+    memset(owned, 0, sizeof(owned));
+    for (p = 0; p < npoints; p++)
+        owned[ring[p].node] += ring[p].hash - (p > 0 ? ring[p - 1].hash : ring[npoints - 1].hash);
+    if (npoints == 1)
+        owned[ring[0].node] = UINT64_MAX;
+    n = snprintf(buf, len,
+        "cluster_self: %s\n"
+        "cluster_nodes: %d\n"
+        "cluster_local_keys: %lu\n"
+        "cluster_forwarded: %lu\n",
+        nodes[self].name, npoints / CLUSTER_VNODES, local_keys, forwarded);
+    for (i = 0; i < nnodes && n < (int)len; i++) {
+        if (!nodes[i].active)
+            continue;
+        n += snprintf(buf + n, len - n, "node %s: share=%.1f%% forwards=%lu reused=%lu connects=%lu failures=%lu idle=%d\n",
+                      nodes[i].name, owned[i] / (double)UINT64_MAX * 100, nodes[i].forwards, nodes[i].reused,
+                      nodes[i].connects, nodes[i].failures, nodes[i].nidle);
+    }
+    V(&lock);
+    return n < (int)len ? n : (int)len - 1; // 잘렸으면 실제로 쓴 만큼
+}
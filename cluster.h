@@ -0,0 +1,52 @@
+/* 클러스터: 캐시 키마다 주인 노드를 정해서 노드들이 캐시를 나눠 갖는다
+ * 노드마다 다 캐시하면 노드를 늘려도 캐시할 수 있는 양은 그대로 - 주인만 캐시하면 노드 수만큼 늘어난다
+ *
+ * - 정규화한 캐시 키의 해시를 consistent hash 링에 올려서 시계 방향으로 처음 만나는 노드가 주인
+ *   노드마다 가상 노드 CLUSTER_VNODES개를 링에 흩어놔서 노드 사이 몫이 고르게
+ *   노드가 들어오고 나가도 그 노드 몫의 키만 주인이 바뀐다
+ * - 내가 주인이 아닌 키는 주인에게 절대 URL로 넘긴다 (X-Cluster-Hop 헤더를 붙여서, 받은 쪽은 다시 넘기지 않는다)
+ *   주인과의 연결은 노드마다 풀에 들고 있다가 다시 쓴다 (keep-alive)
+ * - 멤버는 시작할 때 --cluster로, 돌면서는 관리용 포트의 JOIN/LEAVE로 바꾼다
+ */
+#ifndef __CLUSTER_H__
+#define __CLUSTER_H__
+
+#include "csapp.h"
+
+#define CLUSTER_MAX_NODES 64
+#define CLUSTER_VNODES 128        // 노드 하나가 링에 올리는 점 수
+#define CLUSTER_POOL_SIZE 4       // 노드마다 들고 있는 쉬는 연결 수 (받는 쪽 워커 하나씩을 쥐고 있다)
+#define CLUSTER_IDLE_TIMEOUT 30   // 받는 쪽이 다음 요청을 기다려주는 시간 (초)
+
+typedef struct cluster_node {
+    char name[MAXLINE];           // "host:port" - 링 위의 자리도 이 이름으로 정한다 (노드마다 같은 링이 나오게)
+    char host[MAXLINE];
+    char port[16];
+    int active;                   // LEAVE로 빠지면 0, 자리는 그대로 둔다 (쓰는 중인 연결이 있을 수 있다)
+    int idle[CLUSTER_POOL_SIZE];  // 쉬는 연결 fd
+    int nidle;
+    unsigned long forwards;       // 이 노드에게 넘긴 요청
+    unsigned long reused;         // 그 중 풀의 연결을 다시 쓴 것
+    unsigned long connects;       // 새로 연결한 수
+    unsigned long failures;       // 연결이 안 되거나 답이 없어서 직접 처리한 수
+} cluster_node;
+
+int cluster_add(const char* name);
+
+int cluster_remove(const char* name);
+
+void cluster_set_self(const char* name);
+
+int cluster_enabled(void);
+
+cluster_node* cluster_owner(uint64_t hash);
+
+int cluster_connect(cluster_node* node, int* reused);
+
+void cluster_release(cluster_node* node, int fd, int reusable);
+
+const char* cluster_self(void);
+
+int cluster_stats_text(char* buf, size_t len);
+
+#endif /* __CLUSTER_H__ */
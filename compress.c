@@ -0,0 +1,347 @@
+/* 캐시 본문 압축, compress.h 참고 */
+#include <ctype.h>
+#include "compress.h"
+
+#define GZIP_WINDOW (15 + 16) // zlib에서 gzip 형식
+
+static compress_stats stats;
+
+/* 압축해서 이득이 있을 만한 응답인지 - 헤더만 본다 */
+int compress_eligible(const char* hdr, size_t hdr_len) {
+    static const char* types[] = { "text/", "application/json", "application/javascript", "application/x-javascript",
+                                   "application/xml", "+xml", "+json", "image/svg" };
+    char value[MAXLINE];
+    size_t i;
+
+    if (http_get_header(hdr, hdr_len, "Content-Encoding", value, sizeof(value)) == 0 && strcasecmp(value, "identity"))
+        return 0; // 이미 인코딩돼 있다
+    if (http_get_header(hdr, hdr_len, "Cache-Control", value, sizeof(value)) == 0 && strstr(value, "no-transform") != NULL)
+        return 0; // 원 서버가 손대지 말랬다
+    if (http_get_header(hdr, hdr_len, "Content-Type", value, sizeof(value)) < 0)
+        return 1; // 모르면 일단 해보고 압축률로 거른다
+    for (i = 0; value[i]; i++)
+        value[i] = tolower((unsigned char)value[i]);
+    for (i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+        if (strstr(value, types[i]) != NULL)
+            return 1;
+    return 0;
+}
+
+/* 커밋 직전의 fill 버퍼 (헤더 + 본문)에서 본문만 gzip으로 바꾼다, 압축했으면 0
+   청크 모드로 넘어간 큰 객체는 건드리지 않는다 */
+int compress_fill(cache_fill* fill, int level) {
+    size_t hdr_len = fill->meta.hdr_len, body_len, cap;
+    z_stream z;
+    char* out;
+    int ret;
+
+    if (fill->failed || fill->obj != NULL || fill->buf == NULL || hdr_len == 0 || fill->len < hdr_len)
+        return -1;
+    body_len = fill->len - hdr_len;
+    if (body_len < COMPRESS_MIN_SIZE || fill->meta.status != 200 || !compress_eligible(fill->buf, hdr_len)) {
+        __sync_fetch_and_add(&stats.bypassed, 1);
+        return -1;
+    }
+
+    cap = hdr_len + body_len * COMPRESS_MAX_RATIO / 100;
+    out = Malloc(fill->cache->max_object);
+    memcpy(out, fill->buf, hdr_len);
+
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, level, Z_DEFLATED, GZIP_WINDOW, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        Free(out);
+        return -1;
+    }
+    z.next_in = (Bytef*)fill->buf + hdr_len;
+    z.avail_in = body_len;
+    z.next_out = (Bytef*)out + hdr_len;
+    z.avail_out = cap - hdr_len;
+    ret = deflate(&z, Z_FINISH);
+    deflateEnd(&z);
+    if (ret != Z_STREAM_END) { // 90% 안에 안 들어간다
+        Free(out);
+        __sync_fetch_and_add(&stats.bypassed, 1);
+        return -1;
+    }
+
+    Free(fill->buf);
+    fill->buf = out;
+    fill->len = hdr_len + z.total_out;
+    fill->meta.flags |= CACHE_META_GZIP;
+    fill->meta.raw_len = body_len;
+    __sync_fetch_and_add(&stats.stored, 1);
+    __sync_fetch_and_add(&stats.raw_bytes, body_len);
+    __sync_fetch_and_add(&stats.stored_bytes, z.total_out);
+    return 0;
+}
+
+/* 압축된 본문을 풀면서 원래 본문의 [skip, skip+len) 부분만 fd에 쓴다 (Range도 이걸로) */
+ssize_t compress_inflate_write(int fd, cache_object* obj, size_t skip, size_t len) {
+    size_t hdr_len = obj->meta.hdr_len, comp_len = obj->length - hdr_len, left = len, have, n;
+    char out[16384];
+    char* in = NULL;
+    z_stream z;
+    int ret = Z_OK;
+
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, GZIP_WINDOW) != Z_OK)
+        return -1;
+    if ((z.next_in = (Bytef*)cache_object_ptr(obj, hdr_len, comp_len)) == NULL) { // 청크로 들어간 객체
+        in = Malloc(comp_len);
+        cache_object_read(obj, hdr_len, in, comp_len);
+        z.next_in = (Bytef*)in;
+    }
+    z.avail_in = comp_len;
+
+    while (left > 0 && ret != Z_STREAM_END) {
+        z.next_out = (Bytef*)out;
+        z.avail_out = sizeof(out);
+        ret = inflate(&z, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END)
+            break;
+        have = sizeof(out) - z.avail_out;
+        if (skip >= have) {
+            skip -= have;
+            continue;
+        }
+        n = have - skip < left ? have - skip : left;
+        if (rio_writen(fd, out + skip, n) != (ssize_t)n)
+            break;
+        skip = 0;
+        left -= n;
+    }
+    inflateEnd(&z);
+    if (in != NULL)
+        Free(in);
+    return left == 0 ? (ssize_t)len : -1;
+}
+
+/* 클라이언트가 받는 것 중 제일 작게 나오는 인코딩 */
+int compress_pick(http_request* req) {
+    if (http_accepts(req, "br"))
+        return COMPRESS_BR;
+    if (http_accepts(req, "gzip"))
+        return COMPRESS_GZIP;
+    return COMPRESS_NONE;
+}
+
+const char* compress_name(int coding) {
+    return coding == COMPRESS_BR ? "br" : "gzip";
+}
+
+/* 빈 줄로 끝나는 헤더 블록 hdr에 Vary: Accept-Encoding을 더한다, 바뀐 길이 리턴 (cap을 넘으면 -1)
+   원래 Vary가 있으면 줄을 하나 더 붙이지 않고 합친다 - *이거나 이미 Accept-Encoding이 있으면 그대로 */
+int compress_vary(char* hdr, size_t len, size_t cap) {
+    char names[MAXLINE], tokens[MAXLINE + 2];
+    size_t n;
+
+    if (len < 2 || len > cap)
+        return -1;
+    if (http_vary_names(hdr, len, names, sizeof(names)) > 0) {
+        snprintf(tokens, sizeof(tokens), ",%s,", names);
+        if (strstr(tokens, ",*,") != NULL || strstr(tokens, ",accept-encoding,") != NULL)
+            return len;
+        n = http_remove_header(hdr, len, "Vary") - 2;
+        n += snprintf(hdr + n, cap - n, "Vary: %s, Accept-Encoding\r\n", names);
+    } else {
+        n = len - 2;
+        n += snprintf(hdr + n, cap - n, "Vary: Accept-Encoding\r\n");
+    }
+    if (n + 2 >= cap)
+        return -1;
+    memcpy(hdr + n, "\r\n", 2);
+    return n + 2;
+}
+
+/* 원래 응답 헤더를 압축한 응답의 헤더로 바꾼다, out 길이 리턴 (모자라면 -1)
+   Content-Length는 압축한 길이로 (body_len < 0이면 모르니까 빼고 연결 끊는 걸로 끝을 알린다)
+   ETag는 원래 표현의 것이니 인코딩 이름을 붙여서 구분한다 ("abc" -> "abc-gzip") */
+int compress_header(const char* hdr, size_t len, int coding, long body_len, char* out, size_t outlen) {
+    char etag[MAXLINE];
+    int has_etag = http_get_header(hdr, len, "ETag", etag, sizeof(etag)) == 0;
+    size_t n;
+
+    if (len < 2 || len > outlen)
+        return -1;
+    memcpy(out, hdr, len);
+    n = http_remove_header(out, len, "Content-Length");
+    n = http_remove_header(out, n, "ETag") - 2; // 끝의 빈 줄 앞에 붙인다
+    n += snprintf(out + n, outlen - n, "Content-Encoding: %s\r\n", compress_name(coding));
+    if (body_len >= 0 && n < outlen)
+        n += snprintf(out + n, outlen - n, "Content-Length: %ld\r\n", body_len);
+    if (has_etag && n < outlen) {
+        size_t e = strlen(etag);
+        if (e > 0 && etag[e - 1] == '"')
+            n += snprintf(out + n, outlen - n, "ETag: %.*s-%s\"\r\n", (int)(e - 1), etag, compress_name(coding));
+        else
+            n += snprintf(out + n, outlen - n, "ETag: %s-%s\r\n", etag, compress_name(coding));
+    }
+    if (n + 2 >= outlen)
+        return -1;
+    memcpy(out + n, "\r\n", 2);
+    return compress_vary(out, n + 2, outlen);
+}
+
+/* in을 한 번에 압축해서 out에, 압축한 길이 리턴 - cap 안에 안 들어가면 0 */
+size_t compress_buffer(int coding, int level, const char* in, size_t len, char* out, size_t cap) {
+    z_stream z;
+    int ret;
+
+    if (coding == COMPRESS_BR) {
+        size_t n = cap;
+        int quality = level > BROTLI_MAX_QUALITY ? BROTLI_MAX_QUALITY : level;
+        if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len, (const uint8_t*)in, &n, (uint8_t*)out))
+            return 0;
+        return n;
+    }
+
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, level, Z_DEFLATED, GZIP_WINDOW, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return 0;
+    z.next_in = (Bytef*)in;
+    z.avail_in = len;
+    z.next_out = (Bytef*)out;
+    z.avail_out = cap;
+    ret = deflate(&z, Z_FINISH);
+    deflateEnd(&z);
+    return ret == Z_STREAM_END ? z.total_out : 0;
+}
+
+/* 캐시된 객체의 원래 본문을 Malloc한 버퍼로 (gzip으로 저장된 거면 풀어서), 다 쓰면 Free */
+char* compress_raw_body(cache_object* obj, size_t* len) {
+    size_t hdr_len = obj->meta.hdr_len, comp_len = obj->length - hdr_len;
+    char* out;
+    char* in = NULL;
+    z_stream z;
+    int ret;
+
+    if (!(obj->meta.flags & CACHE_META_GZIP)) {
+        *len = comp_len;
+        out = Malloc(comp_len ? comp_len : 1);
+        cache_object_read(obj, hdr_len, out, comp_len);
+        return out;
+    }
+
+    *len = obj->meta.raw_len;
+    out = Malloc(*len ? *len : 1);
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, GZIP_WINDOW) != Z_OK) {
+        Free(out);
+        return NULL;
+    }
+    if ((z.next_in = (Bytef*)cache_object_ptr(obj, hdr_len, comp_len)) == NULL) {
+        in = Malloc(comp_len);
+        cache_object_read(obj, hdr_len, in, comp_len);
+        z.next_in = (Bytef*)in;
+    }
+    z.avail_in = comp_len;
+    z.next_out = (Bytef*)out;
+    z.avail_out = *len;
+    ret = inflate(&z, Z_FINISH);
+    inflateEnd(&z);
+    if (in != NULL)
+        Free(in);
+    if (ret != Z_STREAM_END || z.total_out != *len) {
+        Free(out);
+        return NULL;
+    }
+    return out;
+}
+
+/* ---------- 릴레이 스트림 압축 ---------- */
+
+/* 압축돼서 나온 걸 클라이언트에게 보내고 캡처에도 붙인다 */
+static void stream_emit(compress_stream* s, const char* data, size_t n) {
+    if (n == 0)
+        return;
+    if (s->client_ok && rio_writen(s->fd, (void*)data, n) != (ssize_t)n)
+        s->client_ok = 0;
+    if (s->capture != NULL) {
+        if (s->capture_len + n > s->capture_max) {
+            Free(s->capture);
+            s->capture = NULL;
+        } else {
+            memcpy(s->capture + s->capture_len, data, n);
+            s->capture_len += n;
+        }
+    }
+}
+
+int compress_stream_begin(compress_stream* s, int coding, int level, int fd, size_t capture_max) {
+    memset(s, 0, sizeof(*s));
+    s->coding = coding;
+    s->fd = fd;
+    s->client_ok = 1;
+    if (coding == COMPRESS_BR) {
+        if ((s->br = BrotliEncoderCreateInstance(NULL, NULL, NULL)) == NULL)
+            return -1;
+        BrotliEncoderSetParameter(s->br, BROTLI_PARAM_QUALITY, level > BROTLI_MAX_QUALITY ? BROTLI_MAX_QUALITY : level);
+        BrotliEncoderSetParameter(s->br, BROTLI_PARAM_MODE, BROTLI_MODE_TEXT);
+    } else if (deflateInit2(&s->z, level, Z_DEFLATED, GZIP_WINDOW, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    if (capture_max > 0) {
+        s->capture = Malloc(capture_max);
+        s->capture_max = capture_max;
+    }
+    __sync_fetch_and_add(&stats.streams, 1);
+    return 0;
+}
+
+/* finish면 남은 걸 다 내보낸다 */
+static void stream_run(compress_stream* s, const void* data, size_t n, int finish) {
+    char out[16384];
+
+    if (s->coding == COMPRESS_BR) {
+        const uint8_t* next_in = data;
+        size_t avail_in = n;
+        BrotliEncoderOperation op = finish ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
+        do {
+            uint8_t* next_out = (uint8_t*)out;
+            size_t avail_out = sizeof(out);
+            if (!BrotliEncoderCompressStream(s->br, op, &avail_in, &next_in, &avail_out, &next_out, NULL))
+                return;
+            stream_emit(s, out, sizeof(out) - avail_out);
+        } while (avail_in > 0 || BrotliEncoderHasMoreOutput(s->br) || (finish && !BrotliEncoderIsFinished(s->br)));
+        return;
+    }
+
+    s->z.next_in = (Bytef*)data;
+    s->z.avail_in = n;
+    do {
+        s->z.next_out = (Bytef*)out;
+        s->z.avail_out = sizeof(out);
+        if (deflate(&s->z, finish ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR)
+            return;
+        stream_emit(s, out, sizeof(out) - s->z.avail_out);
+    } while (s->z.avail_out == 0);
+}
+
+void compress_stream_write(compress_stream* s, const void* data, size_t n) {
+    stream_run(s, data, n, 0);
+}
+
+/* 스트림을 닫는다, 캡처는 s->capture에 남아있다 (호출한 쪽이 Free) */
+int compress_stream_end(compress_stream* s) {
+    stream_run(s, NULL, 0, 1);
+    if (s->coding == COMPRESS_BR)
+        BrotliEncoderDestroyInstance(s->br);
+    else
+        deflateEnd(&s->z);
+    return s->client_ok ? 0 : -1;
+}
+
+int compress_stats_text(char* buf, size_t len) {
+    int n;
+
+    n = snprintf(buf, len,
+        "compress_stored: %lu\n"
+        "compress_bypassed: %lu\n"
+        "compress_raw_bytes: %llu\n"
+        "compress_stored_bytes: %llu\n"
+        "compress_ratio: %.2f\n"
+        "compress_streams: %lu\n",
+        stats.stored, stats.bypassed, stats.raw_bytes, stats.stored_bytes,
+        stats.stored_bytes ? (double)stats.raw_bytes / stats.stored_bytes : 0.0, stats.streams);
+    return n < (int)len ? n : (int)len - 1;
+}
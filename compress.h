@@ -0,0 +1,74 @@
+/* 캐시 안에서의 본문 압축 (gzip, zlib)
+ * 캐시에 넣을 때 텍스트류 본문을 gzip으로 줄여서 저장한다 - slab에서 차지하는 크기(charge)도 압축된 크기라
+ * 같은 MAX_CACHE_SIZE에 몇 배 많이 들어간다. 헤더는 그대로 두어서 재검증, 304, Range는 예전처럼 헤더를 읽는다
+ *
+ * hit 때 클라이언트가 gzip을 받으면 압축된 그대로 (Content-Encoding: gzip), 아니면 풀면서 보낸다
+ * 이미 인코딩된 응답, 이미지/영상/압축 파일 같은 타입, 너무 작거나 잘 안 줄어드는 본문은 그대로 둔다
+ * 청크로 저장되는 큰 객체는 압축하지 않는다
+ *
+ * 응답 압축 단계 (--encode): 원 서버가 압축 안 해준 텍스트 응답을 클라이언트가 받는 인코딩(br > gzip)으로 줄여서 보낸다
+ * miss 때는 릴레이하면서 스트림으로 압축하고, 압축 결과는 URL#enc=<인코딩> 자리에 따로 캐시해서
+ * 다음 hit부터는 압축을 다시 하지 않는다 (proxy.c의 serve_encoded)
+ */
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#include <zlib.h>
+#include <brotli/encode.h>
+#include "cache.h"
+#include "http.h"
+
+#define COMPRESS_MIN_SIZE 256     // 이보다 작은 본문은 그대로
+#define COMPRESS_MAX_RATIO 90     // 압축해도 원래의 90%보다 크면 그대로
+
+#define COMPRESS_NONE 0
+#define COMPRESS_GZIP 1
+#define COMPRESS_BR 2
+
+/* 릴레이하면서 압축해서 fd로 흘려보내는 상태, 나온 결과는 capture 크기까지 모아둔다 (캐시할 변형) */
+typedef struct compress_stream {
+    int coding;
+    z_stream z;
+    BrotliEncoderState* br;
+    int fd;
+    int client_ok;        // 클라이언트가 끊기면 0, 그래도 캡처는 마저 한다
+    char* capture;
+    size_t capture_len;
+    size_t capture_max;   // 넘으면 캡처는 포기 (capture == NULL)
+} compress_stream;
+
+typedef struct compress_stats {
+    unsigned long stored;         // 압축해서 넣은 객체 수
+    unsigned long bypassed;       // 타입/크기/압축률 때문에 그대로 넣은 수
+    unsigned long long raw_bytes; // 압축한 객체들의 원래 본문 크기 합
+    unsigned long long stored_bytes;
+    unsigned long streams;        // 릴레이하면서 압축한 응답 수
+} compress_stats;
+
+int compress_fill(cache_fill* fill, int level);
+
+int compress_eligible(const char* hdr, size_t hdr_len);
+
+ssize_t compress_inflate_write(int fd, cache_object* obj, size_t skip, size_t len);
+
+int compress_pick(http_request* req);
+
+const char* compress_name(int coding);
+
+int compress_vary(char* hdr, size_t len, size_t cap);
+
+int compress_header(const char* hdr, size_t len, int coding, long body_len, char* out, size_t outlen);
+
+size_t compress_buffer(int coding, int level, const char* in, size_t len, char* out, size_t cap);
+
+char* compress_raw_body(cache_object* obj, size_t* len);
+
+int compress_stream_begin(compress_stream* s, int coding, int level, int fd, size_t capture_max);
+
+void compress_stream_write(compress_stream* s, const void* data, size_t n);
+
+int compress_stream_end(compress_stream* s);
+
+int compress_stats_text(char* buf, size_t len);
+
+#endif /* __COMPRESS_H__ */
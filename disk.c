@@ -0,0 +1,347 @@
+/* 디스크 2차 캐시, disk.h 참고 */
+#include "disk.h"
+
+static disk_entry** entry_slot(disk_store* disk, uint64_t hash, const char* key) {
+    disk_entry** pp = &disk->buckets[hash % DISK_INDEX_BUCKETS];
+    while (*pp && ((*pp)->hash != hash || strcmp((*pp)->key, key)))
+        pp = &(*pp)->hnext;
+    return pp;
+}
+
+/* 인덱스(해시 버킷)에서만 뺀다, 엔트리 자체는 세그먼트 리스트가 들고 있다가 세그먼트를 비울 때 free */
+static void unindex_entry(disk_store* disk, disk_entry* e) {
+    disk_entry** pp = entry_slot(disk, e->hash, e->key);
+    *pp = e->hnext;
+    e->live = 0;
+    disk->entries--;
+    disk->bytes -= e->body_len;
+}
+
+/* 세그먼트를 재사용하기 전에 거기 있던 엔트리를 전부 버린다 */
+static void drop_segment(disk_store* disk, int seg) {
+    disk_entry* e = disk->seg_entries[seg];
+    while (e != NULL) {
+        disk_entry* next = e->snext;
+        if (e->live)
+            unindex_entry(disk, e);
+        Free(e->key);
+        Free(e);
+        e = next;
+    }
+    disk->seg_entries[seg] = NULL;
+    disk->gens[seg]++;
+    disk->stats.segment_recycles++;
+}
+
+static int pwrite_all(int fd, const void* buf, size_t n, off_t off) {
+    const char* p = buf;
+    while (n > 0) {
+        ssize_t w = pwrite(fd, p, n, off);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += w;
+        off += w;
+        n -= w;
+    }
+    return 0;
+}
+
+static int pread_all(int fd, void* buf, size_t n, off_t off) {
+    char* p = buf;
+    while (n > 0) {
+        ssize_t r = pread(fd, p, n, off);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        off += r;
+        n -= r;
+    }
+    return 0;
+}
+
+/* 로그 끝에 레코드 하나를 붙이고 인덱스에 올린다, lock을 잡고 불러야 함 */
+static int append_record(disk_store* disk, disk_job* job) {
+    disk_record rec;
+    disk_entry* e;
+    disk_entry** pp;
+    size_t key_len = strlen(job->key);
+    size_t total = sizeof(rec) + key_len + job->len;
+
+    if (total > disk->seg_size)
+        return -1;
+
+    if (disk->cur_off + total > disk->seg_size) { // 다음 세그먼트로, 한 바퀴 돌았으면 제일 오래된 걸 비운다
+        disk->cur_seg = (disk->cur_seg + 1) % disk->nsegs;
+        disk->cur_off = 0;
+        drop_segment(disk, disk->cur_seg);
+    }
+
+    rec.magic = DISK_RECORD_MAGIC;
+    rec.key_len = key_len;
+    rec.body_len = job->len;
+    rec.reserved = 0;
+    rec.hash = job->hash;
+    rec.meta = job->meta;
+    if (pwrite_all(disk->fds[disk->cur_seg], &rec, sizeof(rec), disk->cur_off) < 0
+        || pwrite_all(disk->fds[disk->cur_seg], job->key, key_len, disk->cur_off + sizeof(rec)) < 0
+        || pwrite_all(disk->fds[disk->cur_seg], job->body, job->len, disk->cur_off + sizeof(rec) + key_len) < 0)
+        return -1;
+
+    pp = entry_slot(disk, job->hash, job->key);
+    if (*pp != NULL) // 예전 버전은 인덱스에서만 빼둔다
+        unindex_entry(disk, *pp);
+
+    e = Malloc(sizeof(disk_entry));
+    e->hash = job->hash;
+    e->key = job->key;
+    job->key = NULL;
+    e->seg = disk->cur_seg;
+    e->gen = disk->gens[disk->cur_seg];
+    e->offset = disk->cur_off;
+    e->body_len = job->len;
+    e->resp_time = job->meta.resp_time;
+    e->live = 1;
+    e->hnext = disk->buckets[e->hash % DISK_INDEX_BUCKETS];
+    disk->buckets[e->hash % DISK_INDEX_BUCKETS] = e;
+    e->snext = disk->seg_entries[e->seg];
+    disk->seg_entries[e->seg] = e;
+    disk->entries++;
+    disk->bytes += e->body_len;
+
+    disk->cur_off += total;
+    return 0;
+}
+
+/* 캐시의 evict_hook: 쫓겨나는 객체를 복사해서 대기열에 넣는다 (캐시 write 락 안) */
+static void demote_hook(void* arg, cache_object* obj) {
+    disk_store* disk = arg;
+    uint64_t hash = obj->hash;
+    disk_job* job;
+
+    /* 여기서 disk->lock을 잡으면 demote 쓰레드의 디스크 쓰기를 캐시 write 락을 쥔 채로 기다리게 된다
+       -> 이미 디스크에 있는지는 demote 쓰레드가 확인 */
+    P(&disk->qlock);
+    if (disk->qbytes + obj->length > DISK_DEMOTE_BYTES) {
+        __sync_fetch_and_add(&disk->stats.demote_drops, 1);
+        V(&disk->qlock);
+        return;
+    }
+    disk->qbytes += obj->length;
+    V(&disk->qlock);
+
+    job = Malloc(sizeof(disk_job));
+    job->next = NULL;
+    job->hash = hash;
+    job->key = strdup(obj->id);
+    job->len = obj->length;
+    job->meta = obj->meta;
+    job->body = Malloc(obj->length ? obj->length : 1);
+    cache_object_read(obj, 0, job->body, obj->length);
+
+    P(&disk->qlock);
+    if (disk->qtail)
+        disk->qtail->next = job;
+    else
+        disk->qhead = job;
+    disk->qtail = job;
+    V(&disk->qlock);
+    V(&disk->items);
+}
+
+/* demote 쓰레드: 대기열에서 하나씩 꺼내 로그에 쓴다, 요청 처리 쓰레드는 디스크를 기다리지 않는다 */
+static void* demoter(void* arg) {
+    disk_store* disk = arg;
+    disk_job* job;
+    disk_entry* e;
+
+    Pthread_detach(Pthread_self());
+    while (1) {
+        P(&disk->items);
+        P(&disk->qlock);
+        job = disk->qhead;
+        disk->qhead = job->next;
+        if (disk->qhead == NULL)
+            disk->qtail = NULL;
+        disk->qbytes -= job->len;
+        V(&disk->qlock);
+
+        P(&disk->lock);
+        e = *entry_slot(disk, job->hash, job->key);
+        if (e != NULL && e->body_len == job->len && e->resp_time == job->meta.resp_time)
+            ; // 디스크에서 올라왔던 그대로라면 다시 쓸 필요 없음
+        else if (append_record(disk, job) == 0)
+            disk->stats.demotions++;
+        else
+            __sync_fetch_and_add(&disk->stats.demote_drops, 1);
+        V(&disk->lock);
+
+        if (job->key)
+            Free(job->key);
+        Free(job->body);
+        Free(job);
+    }
+    return NULL;
+}
+
+/* dir 아래에 size 바이트만큼 세그먼트 파일을 미리 잡아두고 캐시의 evict_hook에 물린다 */
+disk_store* disk_open(const char* dir, size_t size, cache_list* cache) {
+    disk_store* disk = Calloc(1, sizeof(disk_store));
+    char path[MAXLINE];
+    pthread_t tid;
+    int i, err;
+
+    if (size < DISK_MIN_SEGMENTS * SLAB_PAGE_SIZE) { // 세그먼트 하나도 못 만든다
+        fprintf(stderr, "disk cache: %zu bytes is too small (at least %d)\n", size, DISK_MIN_SEGMENTS * SLAB_PAGE_SIZE);
+        Free(disk);
+        return NULL;
+    }
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "disk cache: cannot create %s: %s\n", dir, strerror(errno));
+        Free(disk);
+        return NULL;
+    }
+
+    /* 세그먼트 하나를 비울 때 디스크 전체가 날아가지 않게 최소 DISK_MIN_SEGMENTS개로 나눈다 */
+    disk->seg_size = size / DISK_MIN_SEGMENTS < DISK_SEGMENT_SIZE ? size / DISK_MIN_SEGMENTS : DISK_SEGMENT_SIZE;
+    if (disk->seg_size < SLAB_PAGE_SIZE)
+        disk->seg_size = SLAB_PAGE_SIZE;
+    disk->nsegs = size / disk->seg_size;
+    disk->fds = Calloc(disk->nsegs, sizeof(int));
+    disk->gens = Calloc(disk->nsegs, sizeof(unsigned int));
+    disk->seg_entries = Calloc(disk->nsegs, sizeof(disk_entry*));
+
+    for (i = 0; i < disk->nsegs; i++) {
+        snprintf(path, sizeof(path), "%s/segment-%03d.log", dir, i);
+        if ((disk->fds[i] = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+            fprintf(stderr, "disk cache: cannot open %s: %s\n", path, strerror(errno));
+            goto fail;
+        }
+        if ((err = posix_fallocate(disk->fds[i], 0, disk->seg_size)) != 0) {
+            fprintf(stderr, "disk cache: cannot allocate %s: %s\n", path, strerror(err));
+            i++; // 이건 열렸으니 같이 닫는다
+            goto fail;
+        }
+    }
+
+    disk->cache = cache;
+    Sem_init(&disk->lock, 0, 1);
+    Sem_init(&disk->qlock, 0, 1);
+    Sem_init(&disk->items, 0, 0);
+    Pthread_create(&tid, NULL, demoter, disk);
+
+    cache->evict_hook = demote_hook;
+    cache->evict_hook_arg = disk;
+    return disk;
+
+fail: /* 앞에서 연 세그먼트 i개를 닫고 다 놓는다 */
+    while (--i >= 0)
+        if (disk->fds[i] >= 0)
+            close(disk->fds[i]);
+    Free(disk->fds);
+    Free(disk->gens);
+    Free(disk->seg_entries);
+    Free(disk);
+    return NULL;
+}
+
+/* 메모리 캐시에서 miss 났을 때 디스크에서 찾아서 메모리로 올린다
+   올라갔으면 0, out에는 참조를 잡은 객체가 들어온다 (다 쓰면 cache_release)
+   없거나 읽는 사이 세그먼트가 재사용됐으면 -1 */
+int disk_promote(disk_store* disk, cache_key* ck, cache_object** out) {
+    const char* key = ck->id;
+    uint64_t hash = ck->hash;
+    disk_entry* e;
+    disk_record rec;
+    char buf[MAXBUF];
+    cache_fill fill;
+    int fd, seg, ok;
+    unsigned int gen, left, n;
+    size_t key_len = ck->len;
+    off_t off;
+
+    P(&disk->lock);
+    e = *entry_slot(disk, hash, key);
+    if (e == NULL) {
+        disk->stats.misses++;
+        V(&disk->lock);
+        return -1;
+    }
+    seg = e->seg;
+    gen = e->gen;
+    off = e->offset;
+    left = e->body_len;
+    fd = disk->fds[seg];
+    V(&disk->lock);
+
+    /* 레코드 헤더와 키가 맞는지부터 */
+    if (pread_all(fd, &rec, sizeof(rec), off) < 0 || rec.magic != DISK_RECORD_MAGIC
+        || rec.hash != hash || rec.key_len != key_len || rec.body_len != left
+        || pread_all(fd, buf, key_len < sizeof(buf) ? key_len : sizeof(buf), off + sizeof(rec)) < 0
+        || memcmp(buf, key, key_len < sizeof(buf) ? key_len : sizeof(buf))) {
+        P(&disk->lock);
+        disk->stats.stale_reads++;
+        V(&disk->lock);
+        return -1;
+    }
+
+    cache_fill_begin(&fill, disk->cache, ck);
+    fill.meta = rec.meta;
+    off += sizeof(rec) + key_len;
+    while (left > 0) {
+        n = left < sizeof(buf) ? left : sizeof(buf);
+        if (pread_all(fd, buf, n, off) < 0) {
+            cache_fill_abort(&fill);
+            return -1;
+        }
+        cache_fill_append(&fill, buf, n);
+        off += n;
+        left -= n;
+    }
+
+    /* 읽는 동안 세그먼트가 재사용됐으면 내용을 믿을 수 없다 */
+    P(&disk->lock);
+    ok = disk->gens[seg] == gen;
+    if (ok)
+        disk->stats.hits++;
+    else
+        disk->stats.stale_reads++;
+    V(&disk->lock);
+
+    if (!ok) {
+        cache_fill_abort(&fill);
+        return -1;
+    }
+    return cache_fill_commit(&fill, out);
+}
+
+int disk_stats_text(disk_store* disk, char* buf, size_t len) {
+    disk_stats st;
+    unsigned long entries, bytes;
+    int n;
+
+    P(&disk->lock);
+    st = disk->stats;
+    entries = disk->entries;
+    bytes = disk->bytes;
+    V(&disk->lock);
+
+    n = snprintf(buf, len,
+        "disk_capacity: %zu\n"
+        "disk_objects: %lu\n"
+        "disk_bytes: %lu\n"
+        "disk_hits: %lu\n"
+        "disk_misses: %lu\n"
+        "disk_demotions: %lu\n"
+        "disk_demote_drops: %lu\n"
+        "disk_stale_reads: %lu\n"
+        "disk_segment_recycles: %lu\n",
+        disk->seg_size * disk->nsegs, entries, bytes,
+        st.hits, st.misses, st.demotions, st.demote_drops,
+        st.stale_reads, st.segment_recycles);
+    return n < (int)len ? n : (int)len - 1;
+}
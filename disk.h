@@ -0,0 +1,88 @@
+/* 디스크 2차 캐시 (L2)
+ * 미리 크기를 잡아둔 세그먼트 파일들에 append-only 로그로 객체를 쌓는다
+ * 메모리 캐시에서 쫓겨난 객체가 여기로 내려오고(demote), 메모리에서 miss 나면 여기서 찾아 다시 올린다(promote)
+ * 세그먼트가 한 바퀴 돌면 가장 오래된 세그먼트를 통째로 비우고 재사용한다 (FIFO)
+ */
+#ifndef __DISK_H__
+#define __DISK_H__
+
+#include "cache.h"
+
+#define DISK_SEGMENT_SIZE (64 * 1024 * 1024)
+#define DISK_MIN_SEGMENTS 8
+#define DISK_INDEX_BUCKETS 65536
+#define DISK_DEMOTE_BYTES (16 * 1024 * 1024) // 내려보낼 객체 대기열 크기, 꽉 차면 그냥 버린다
+#define DISK_RECORD_MAGIC 0x4c32524bU
+
+/* 로그 레코드 헤더, 뒤에 key, body가 이어진다 */
+typedef struct disk_record {
+    uint32_t magic;
+    uint32_t key_len;
+    uint32_t body_len;
+    uint32_t reserved;
+    uint64_t hash;
+    cache_meta meta;            // 응답을 받은 시각, 수명 등 (http.c)
+} disk_record;
+
+typedef struct disk_entry {
+    uint64_t hash;
+    char* key;
+    int seg;
+    unsigned int gen;           // 레코드를 쓸 때의 세그먼트 세대, 세그먼트가 재사용되면 어긋난다
+    off_t offset;               // 레코드 헤더 위치
+    unsigned int body_len;
+    int64_t resp_time;          // 같은 응답이 다시 내려오면 안 쓰려고
+    int live;                   // 같은 키가 다시 써지면 0, 세그먼트를 비울 때 같이 정리된다
+    struct disk_entry* hnext;   // 해시 버킷
+    struct disk_entry* snext;   // 같은 세그먼트에 있는 엔트리들
+} disk_entry;
+
+/* 내려보낼 객체의 사본, slab 슬롯은 바로 돌려줘야 하니 쫓겨날 때 복사해둔다 */
+typedef struct disk_job {
+    struct disk_job* next;
+    uint64_t hash;
+    char* key;
+    char* body;
+    unsigned int len;
+    cache_meta meta;
+} disk_job;
+
+typedef struct disk_stats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long demotions;
+    unsigned long demote_drops;
+    unsigned long stale_reads;
+    unsigned long segment_recycles;
+} disk_stats;
+
+typedef struct disk_store {
+    int nsegs;
+    int* fds;
+    unsigned int* gens;
+    disk_entry** seg_entries;
+    size_t seg_size;
+    int cur_seg;
+    off_t cur_off;
+    disk_entry* buckets[DISK_INDEX_BUCKETS];
+    unsigned long entries;
+    unsigned long bytes;
+    sem_t lock;                 // 인덱스와 쓰기 위치
+
+    cache_list* cache;
+    disk_job* qhead;            // demote 쓰레드가 처리할 대기열
+    disk_job* qtail;
+    size_t qbytes;
+    sem_t qlock;
+    sem_t items;
+
+    disk_stats stats;
+} disk_store;
+
+disk_store* disk_open(const char* dir, size_t size, cache_list* cache);
+
+int disk_promote(disk_store* disk, cache_key* ck, cache_object** out);
+
+int disk_stats_text(disk_store* disk, char* buf, size_t len);
+
+#endif /* __DISK_H__ */
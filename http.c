@@ -0,0 +1,564 @@
+/* HTTP 헤더 파싱과 freshness 계산, http.h 참고 */
+#define _XOPEN_SOURCE 700 // strptime
+#define _DEFAULT_SOURCE    // timegm
+#include "http.h"
+
+/* "Sun, 06 Nov 1994 08:49:37 GMT" (RFC 1123) 외에 옛날 형식 두 가지도 받는다, 못 읽으면 -1 */
+time_t http_parse_date(const char* s) {
+    static const char* formats[] = {
+        "%a, %d %b %Y %H:%M:%S GMT",
+        "%A, %d-%b-%y %H:%M:%S GMT",
+        "%a %b %d %H:%M:%S %Y",
+    };
+    struct tm tm;
+    size_t i;
+
+    while (*s == ' ' || *s == '\t')
+        s++;
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        memset(&tm, 0, sizeof(tm));
+        if (strptime(s, formats[i], &tm) != NULL)
+            return timegm(&tm);
+    }
+    return -1;
+}
+
+/* RFC 1123 형식으로, 쓴 길이 리턴 */
+int http_format_date(time_t t, char* out, size_t len) {
+    struct tm tm;
+
+    gmtime_r(&t, &tm);
+    return strftime(out, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+/* "max-age=60" 같은 디렉티브 값, 숫자가 아니면 -1 */
+static long directive_value(const char* p) {
+    char* end;
+    long v;
+
+    while (*p == ' ')
+        p++;
+    if (*p != '=')
+        return -1;
+    p++;
+    if (*p == '"')
+        p++;
+    v = strtol(p, &end, 10);
+    return end == p || v < 0 ? -1 : v;
+}
+
+/* Cache-Control 값 하나를 쉼표로 나눠서 본다 */
+static void parse_cache_control(const char* value, http_info* info) {
+    const char* p = value;
+    size_t n;
+
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++;
+        n = strcspn(p, "=,\r\n");
+        if (n == 0)
+            break;
+        if (!strncasecmp(p, "no-store", n) && n == 8)
+            info->no_store = 1;
+        else if (!strncasecmp(p, "no-cache", n) && n == 8)
+            info->no_cache = 1;
+        else if (!strncasecmp(p, "private", n) && n == 7)
+            info->is_private = 1;
+        else if (!strncasecmp(p, "public", n) && n == 6)
+            info->is_public = 1;
+        else if (!strncasecmp(p, "max-age", n) && n == 7)
+            info->max_age = directive_value(p + n);
+        else if (!strncasecmp(p, "s-maxage", n) && n == 8)
+            info->s_maxage = directive_value(p + n);
+        else if (!strncasecmp(p, "stale-while-revalidate", n) && n == 22)
+            info->stale_while_revalidate = directive_value(p + n);
+        else if (!strncasecmp(p, "stale-if-error", n) && n == 14)
+            info->stale_if_error = directive_value(p + n);
+        else if ((!strncasecmp(p, "must-revalidate", n) && n == 15) || (!strncasecmp(p, "proxy-revalidate", n) && n == 16))
+            info->must_revalidate = 1;
+        p += strcspn(p, ",\r\n");
+        if (*p == '\r' || *p == '\n')
+            break;
+    }
+}
+
+/* 헤더 이름이 name이면 값 시작 위치, 아니면 NULL */
+static const char* header_value(const char* line, const char* name) {
+    size_t n = strlen(name);
+    if (strncasecmp(line, name, n) || line[n] != ':')
+        return NULL;
+    line += n + 1;
+    while (*line == ' ' || *line == '\t')
+        line++;
+    return line;
+}
+
+/* 헤더 블록에서 name 헤더 줄을 전부 지운다 (그 자리에서), 줄어든 길이 리턴 */
+size_t http_remove_header(char* hdr, size_t len, const char* name) {
+    size_t n = strlen(name), off = 0, line_len;
+    char* eol;
+
+    while (off < len) {
+        eol = memchr(hdr + off, '\n', len - off);
+        line_len = (eol ? eol - hdr + 1 : len) - off;
+        if (line_len > n && !strncasecmp(hdr + off, name, n) && hdr[off + n] == ':') {
+            memmove(hdr + off, hdr + off + line_len, len - off - line_len);
+            len -= line_len;
+        } else {
+            off += line_len;
+        }
+    }
+    return len;
+}
+
+/* 상태줄 + 헤더들 (\r\n\r\n까지)을 파싱한다, 상태줄이 이상하면 -1 */
+int http_parse_response(const char* hdr, size_t len, http_info* info) {
+    char line[MAXLINE];
+    const char* p = hdr;
+    const char* end = hdr + len;
+    const char* v;
+    size_t n;
+
+    memset(info, 0, sizeof(http_info));
+    info->max_age = info->s_maxage = info->age = info->content_length = -1;
+    info->stale_while_revalidate = info->stale_if_error = -1;
+    info->date = info->expires = info->last_modified = -1;
+
+    if (len < 12 || strncmp(hdr, "HTTP/1.", 7) || sscanf(hdr + 8, " %d", &info->status) != 1)
+        return -1;
+
+    while (p < end) {
+        const char* eol = memchr(p, '\n', end - p);
+        n = (eol ? eol + 1 : end) - p;
+        if (n >= sizeof(line))
+            n = sizeof(line) - 1;
+        memcpy(line, p, n);
+        line[n] = '\0';
+        p = eol ? eol + 1 : end;
+
+        if ((v = header_value(line, "Cache-Control")) != NULL)
+            parse_cache_control(v, info);
+        else if ((v = header_value(line, "Pragma")) != NULL && !strncasecmp(v, "no-cache", 8))
+            info->no_cache = 1;
+        else if ((v = header_value(line, "Date")) != NULL)
+            info->date = http_parse_date(v);
+        else if ((v = header_value(line, "Expires")) != NULL) {
+            info->expires = http_parse_date(v);
+            if (info->expires < 0)
+                info->expires = 0; // "0" 같은 잘못된 값은 이미 만료된 걸로
+        }
+        else if ((v = header_value(line, "Last-Modified")) != NULL)
+            info->last_modified = http_parse_date(v);
+        else if ((v = header_value(line, "Age")) != NULL)
+            info->age = atol(v);
+        else if ((v = header_value(line, "Content-Length")) != NULL)
+            info->content_length = atol(v);
+        else if ((v = header_value(line, "Vary")) != NULL && strchr(v, '*') != NULL)
+            info->vary_star = 1;
+        else if (header_value(line, "ETag") != NULL)
+            info->has_etag = 1;
+    }
+    return 0;
+}
+
+/* 명시적인 만료 정보가 없어도 캐시해도 되는 상태 코드 (RFC 7231 6.1)
+   206은 본문 일부라 통째로 캐시하면 안 된다 */
+static int heuristically_cacheable(int status) {
+    switch (status) {
+    case 200: case 203: case 204: case 300: case 301: case 308:
+    case 404: case 405: case 410: case 414: case 501:
+        return 1;
+    }
+    return 0;
+}
+
+/* 공유 캐시가 저장해도 되나: no-store, private, Vary: * 는 안 되고
+   Authorization을 보낸 요청의 응답은 public, s-maxage, must-revalidate 중 하나가 있어야 된다 (RFC 7234 3.2) */
+static int shared_storable(http_info* info, int authorization) {
+    if (info->no_store || info->is_private || info->vary_star)
+        return 0;
+    return !authorization || info->is_public || info->s_maxage >= 0 || info->must_revalidate;
+}
+
+/* 원 서버가 수명을 안 정한 404/410/5xx - 프록시가 negative_ttl 동안만 기억한다 (proxy.c put_negative) */
+int http_negative(http_info* info, int authorization) {
+    if (info->status != 404 && info->status != 410 && info->status < 500)
+        return 0;
+    if (!shared_storable(info, authorization))
+        return 0;
+    return info->s_maxage < 0 && info->max_age < 0 && info->expires < 0;
+}
+
+/* 캐시해도 되는 응답이면 meta를 채우고 1, 아니면 0
+   authorization은 요청에 Authorization이 있었나, req_time/resp_time은 요청을 보낸/응답을 받은 시각 (Age 보정에 쓴다) */
+int http_freshness(http_info* info, int authorization, time_t req_time, time_t resp_time, int default_ttl, cache_meta* meta) {
+    long lifetime, apparent_age, corrected_age;
+    time_t date = info->date >= 0 ? info->date : resp_time;
+    int validator = info->has_etag || info->last_modified >= 0;
+
+    if (!shared_storable(info, authorization) || info->status == 206)
+        return 0;
+
+    if (info->no_cache) // 저장은 해도 되지만 쓸 때마다 재검증
+        lifetime = 0;
+    else if (info->s_maxage >= 0)
+        lifetime = info->s_maxage;
+    else if (info->max_age >= 0)
+        lifetime = info->max_age;
+    else if (info->expires >= 0)
+        lifetime = info->expires > date ? info->expires - date : 0;
+    else if (!heuristically_cacheable(info->status))
+        return 0;
+    else if (info->last_modified >= 0 && info->last_modified < date) // 마지막 수정 후 지난 시간의 10%
+        lifetime = (date - info->last_modified) / 10 < HTTP_HEURISTIC_MAX ? (date - info->last_modified) / 10 : HTTP_HEURISTIC_MAX;
+    else
+        lifetime = default_ttl;
+
+    /* RFC 7234 4.2.3 - 받았을 때 이미 지난 나이 */
+    apparent_age = resp_time > date ? resp_time - date : 0;
+    corrected_age = (info->age > 0 ? info->age : 0) + (resp_time - req_time);
+
+    /* 받자마자 만료라도 검증자가 있으면 저장해둔다 - 다음엔 본문 없이 304로 재검증할 수 있으니까 */
+    if (lifetime <= (apparent_age > corrected_age ? apparent_age : corrected_age) && !validator)
+        return 0;
+
+    meta->resp_time = resp_time;
+    meta->date = date;
+    meta->age = apparent_age > corrected_age ? apparent_age : corrected_age;
+    meta->lifetime = lifetime;
+    meta->status = info->status;
+    meta->last_modified = info->last_modified;
+    meta->flags = info->has_etag ? CACHE_META_ETAG : 0;
+    return 1;
+}
+
+/* 헤더 블록에서 name 헤더의 값을 out에 (줄 끝 \r\n 빼고), 없으면 -1 */
+int http_get_header(const char* hdr, size_t len, const char* name, char* out, size_t outlen) {
+    char line[MAXLINE];
+    const char* p = hdr;
+    const char* end = hdr + len;
+    const char* v;
+    size_t n;
+
+    while (p < end) {
+        const char* eol = memchr(p, '\n', end - p);
+        n = (eol ? eol + 1 : end) - p;
+        if (n >= sizeof(line))
+            n = sizeof(line) - 1;
+        memcpy(line, p, n);
+        line[n] = '\0';
+        p = eol ? eol + 1 : end;
+
+        if ((v = header_value(line, name)) != NULL) {
+            n = strcspn(v, "\r\n");
+            if (n >= outlen)
+                n = outlen - 1;
+            memcpy(out, v, n);
+            out[n] = '\0';
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* 304에 새로 온 값이 있으면 저장해둔 헤더의 값을 덮어쓴다 (RFC 7234 4.3.4) */
+void http_merge_304(http_info* stored, http_info* fresh) {
+    if (fresh->date >= 0)
+        stored->date = fresh->date;
+    if (fresh->expires >= 0)
+        stored->expires = fresh->expires;
+    if (fresh->age >= 0)
+        stored->age = fresh->age;
+    else
+        stored->age = -1; // 저장된 Age는 예전 응답의 것
+    if (fresh->max_age >= 0 || fresh->s_maxage >= 0 || fresh->no_cache || fresh->no_store || fresh->is_private) {
+        stored->max_age = fresh->max_age;
+        stored->s_maxage = fresh->s_maxage;
+        stored->no_cache = fresh->no_cache;
+        stored->no_store = fresh->no_store;
+        stored->is_private = fresh->is_private;
+        stored->must_revalidate = fresh->must_revalidate;
+        stored->stale_while_revalidate = fresh->stale_while_revalidate;
+        stored->stale_if_error = fresh->stale_if_error;
+    }
+    if (fresh->last_modified >= 0)
+        stored->last_modified = fresh->last_modified;
+}
+
+/* If-None-Match 목록 중 하나라도 etag와 같으면 1 (weak 비교: W/는 무시) */
+static int etag_match(const char* list, const char* etag) {
+    const char* p = list;
+    size_t n;
+
+    if (!strncmp(etag, "W/", 2))
+        etag += 2;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++;
+        if (*p == '*')
+            return 1;
+        if (!strncmp(p, "W/", 2))
+            p += 2;
+        n = strcspn(p, ", \t");
+        if (n > 0 && n == strlen(etag) && !strncmp(p, etag, n))
+            return 1;
+        p += n;
+    }
+    return 0;
+}
+
+/* 클라이언트 조건부 요청에 캐시된 응답으로 304를 줄 수 있으면 1
+   If-None-Match가 있으면 그것만 본다 (RFC 7232 6) */
+int http_not_modified(http_request* req, const char* hdr, size_t len, cache_meta* meta) {
+    char etag[MAXLINE];
+    time_t lm;
+
+    if (meta->status != 200)
+        return 0;
+    if (req->if_none_match[0] != '\0') {
+        if (!(meta->flags & CACHE_META_ETAG) || http_get_header(hdr, len, "ETag", etag, sizeof(etag)) < 0)
+            return 0;
+        return etag_match(req->if_none_match, etag);
+    }
+    if (req->if_modified_since >= 0) {
+        lm = meta->last_modified >= 0 ? meta->last_modified : meta->date;
+        return lm <= req->if_modified_since;
+    }
+    return 0;
+}
+
+/* 캐시된 응답 헤더로 클라이언트에게 보낼 304를 만든다, 길이 리턴 */
+int http_build_304(const char* hdr, size_t len, long age, char* out, size_t outlen) {
+    static const char* keep[] = { "Date", "ETag", "Cache-Control", "Expires", "Vary", "Content-Location", "Last-Modified" };
+    char value[MAXLINE];
+    size_t i;
+    int n;
+
+    n = snprintf(out, outlen, "HTTP/1.0 304 Not Modified\r\n");
+    for (i = 0; i < sizeof(keep) / sizeof(keep[0]); i++) {
+        if (http_get_header(hdr, len, keep[i], value, sizeof(value)) == 0 && (size_t)n < outlen)
+            n += snprintf(out + n, outlen - n, "%s: %s\r\n", keep[i], value);
+    }
+    if ((size_t)n < outlen)
+        n += snprintf(out + n, outlen - n, "Age: %ld\r\n\r\n", age);
+    return (size_t)n < outlen ? n : (int)outlen - 1;
+}
+
+/* "bytes=0-99,200-,-50" 를 length바이트 본문 기준으로 푼다 (RFC 7233 2.1)
+   만족하는 구간 수를 리턴, 하나도 없으면 0 (416), 문법이 틀렸거나 너무 많으면 -1 (Range 무시하고 200) */
+int http_parse_range(const char* spec, long length, http_range* out, int max) {
+    const char* p = spec;
+    char* end;
+    long first, last;
+    int n = 0;
+
+    while (*p == ' ')
+        p++;
+    if (strncasecmp(p, "bytes=", 6))
+        return -1;
+    p += 6;
+    while (*p) {
+        while (*p == ' ' || *p == ',')
+            p++;
+        if (*p == '\0' || *p == '\r' || *p == '\n')
+            break;
+        if (*p == '-') { // 끝에서 N바이트
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < 0)
+                return -1;
+            if (last == 0) {
+                p = end;
+                continue;
+            }
+            first = last >= length ? 0 : length - last;
+            last = length - 1;
+        } else {
+            first = strtol(p, &end, 10);
+            if (end == p || first < 0 || *end != '-')
+                return -1;
+            p = end + 1;
+            if (*p >= '0' && *p <= '9') {
+                last = strtol(p, &end, 10);
+                if (last < first)
+                    return -1;
+            } else {
+                end = (char*)p;
+                last = length - 1;
+            }
+            if (last >= length)
+                last = length - 1;
+        }
+        p = end;
+        if (first >= length) // 만족 못하는 구간은 빼고 나머지만
+            continue;
+        if (n == max)
+            return -1;
+        out[n].first = first;
+        out[n].last = last;
+        n++;
+    }
+    return n;
+}
+
+/* If-Range가 없거나 저장된 응답과 같으면 1 - 다르면 Range를 무시하고 통째로 준다
+   ETag는 strong 비교만, 날짜는 Last-Modified와 정확히 같아야 한다 (RFC 7233 3.2) */
+int http_if_range_ok(http_request* req, const char* hdr, size_t len, cache_meta* meta) {
+    char etag[MAXLINE];
+
+    if (req->if_range[0] == '\0')
+        return 1;
+    if (req->if_range[0] == '"' || !strncmp(req->if_range, "W/", 2)) {
+        if (req->if_range[0] != '"' || !(meta->flags & CACHE_META_ETAG)
+            || http_get_header(hdr, len, "ETag", etag, sizeof(etag)) < 0 || etag[0] != '"')
+            return 0;
+        return !strcmp(req->if_range, etag);
+    }
+    return meta->last_modified >= 0 && http_parse_date(req->if_range) == meta->last_modified;
+}
+
+/* 저장된 200 응답 헤더로 206 헤더를 만든다, 길이 리턴
+   Content-Length/Content-Range는 extra로 새로 넣는다 (멀티파트면 Content-Type도) */
+int http_build_partial(const char* hdr, size_t len, const char* extra, long age, char* out, size_t outlen) {
+    const char* eol = memchr(hdr, '\n', len);
+    size_t n, body;
+
+    if (eol == NULL || len < 2)
+        return -1;
+    n = snprintf(out, outlen, "HTTP/1.0 206 Partial Content\r\n");
+    body = len - (eol + 1 - hdr) - 2; // 상태줄과 마지막 빈 줄 빼고
+    if (n + body >= outlen)
+        return -1;
+    memcpy(out + n, eol + 1, body);
+    n += body;
+    n = http_remove_header(out, n, "Content-Length");
+    n = http_remove_header(out, n, "Content-Range");
+    if (strstr(extra, "multipart/byteranges") != NULL)
+        n = http_remove_header(out, n, "Content-Type");
+    n += snprintf(out + n, outlen - n, "%sAge: %ld\r\n\r\n", extra, age);
+    return n < outlen ? (int)n : -1;
+}
+
+/* 응답의 Vary 헤더 이름들을 소문자, 쉼표로만 이어서 out에 (여러 줄이면 합친다), 없으면 0 */
+int http_vary_names(const char* hdr, size_t len, char* out, size_t outlen) {
+    char line[MAXLINE];
+    const char* p = hdr;
+    const char* end = hdr + len;
+    const char* v;
+    size_t n, o = 0;
+
+    while (p < end) {
+        const char* eol = memchr(p, '\n', end - p);
+        n = (eol ? eol + 1 : end) - p;
+        if (n >= sizeof(line))
+            n = sizeof(line) - 1;
+        memcpy(line, p, n);
+        line[n] = '\0';
+        p = eol ? eol + 1 : end;
+
+        if ((v = header_value(line, "Vary")) == NULL)
+            continue;
+        while (*v && *v != '\r' && *v != '\n') {
+            if (*v == ' ' || *v == '\t' || *v == ',') {
+                v++;
+                continue;
+            }
+            if (o > 0 && o + 1 < outlen)
+                out[o++] = ',';
+            while (*v && !strchr(" \t,\r\n", *v)) {
+                if (o + 1 < outlen)
+                    out[o++] = tolower((unsigned char)*v);
+                v++;
+            }
+        }
+    }
+    if (o < outlen)
+        out[o] = '\0';
+    return o > 0;
+}
+
+/* Vary에 적힌 요청 헤더들의 값으로 해시 - 공백 차이는 무시, 헤더가 없는 것과 빈 값은 다르다 */
+uint64_t http_vary_hash(http_request* req, const char* names) {
+    char name[MAXLINE], value[MAXLINE];
+    uint64_t h = CACHE_HASH_INIT;
+    const char* p = names;
+    size_t n;
+
+    while (*p) {
+        n = strcspn(p, ",");
+        if (n >= sizeof(name))
+            n = sizeof(name) - 1;
+        memcpy(name, p, n);
+        name[n] = '\0';
+        p += strcspn(p, ",");
+        if (*p == ',')
+            p++;
+
+        h = cache_hash_continue(h, name, n + 1);
+        if (http_get_header(req->headers, req->headers_len, name, value, sizeof(value)) == 0) {
+            char* q = value;
+            while (*q) { // 값 안의 공백은 빼고 본다 ("gzip, br" == "gzip,br")
+                if (*q != ' ' && *q != '\t')
+                    h = cache_hash_continue(h, q, 1);
+                q++;
+            }
+            h = cache_hash_continue(h, "", 1);
+        } else {
+            h = cache_hash_continue(h, "\001", 1);
+        }
+    }
+    return h;
+}
+
+/* 요청의 Accept-Encoding이 coding을 받는지 (q=0은 거절), 헤더가 없으면 identity만 받는 걸로 */
+int http_accepts(http_request* req, const char* coding) {
+    char value[MAXLINE], item[MAXLINE];
+    char* p = value;
+    char* q;
+    size_t n;
+    int star = 0, ok;
+
+    if (http_get_header(req->headers, req->headers_len, "Accept-Encoding", value, sizeof(value)) < 0)
+        return 0;
+    while (*p) {
+        n = strcspn(p, ",");
+        memcpy(item, p, n);
+        item[n] = '\0';
+        p += n;
+        if (*p == ',')
+            p++;
+
+        ok = (q = strstr(item, "q=")) == NULL || strtod(q + 2, NULL) > 0;
+        q = item + strspn(item, " \t");
+        q[strcspn(q, " \t;")] = '\0';
+        if (strcasecmp(q, coding) == 0)
+            return ok;
+        if (strcmp(q, "*") == 0)
+            star = ok;
+    }
+    return star;
+}
+
+long http_current_age(cache_meta* meta, time_t now) {
+    return meta->age + (now > meta->resp_time ? now - meta->resp_time : 0);
+}
+
+/* HTTP 메타데이터가 없는 객체 (hdr_len == 0)는 만료되지 않는다 */
+int http_is_fresh(cache_meta* meta, time_t now) {
+    return meta->hdr_len == 0 || http_current_age(meta, now) < (long)meta->lifetime;
+}
+
+/* 만료된 뒤에도 쓸 수 있는 기간 (RFC 5861), 원 서버가 안 정했으면 프록시 기본값
+   must-revalidate, no-cache면 만료된 걸 그냥 쓰면 안 된다 */
+void http_stale_windows(http_info* info, int default_swr, int default_sie, cache_meta* meta) {
+    if (info->must_revalidate || info->no_cache) {
+        meta->swr = meta->sie = 0;
+        return;
+    }
+    meta->swr = info->stale_while_revalidate >= 0 ? info->stale_while_revalidate : default_swr;
+    meta->sie = info->stale_if_error >= 0 ? info->stale_if_error : default_sie;
+}
+
+/* 만료된 지 window초 안이면 1 */
+int http_stale_ok(cache_meta* meta, time_t now, uint32_t window) {
+    return window > 0 && http_current_age(meta, now) < (long)meta->lifetime + window;
+}
@@ -0,0 +1,98 @@
+/* HTTP 응답 헤더 파싱과 캐시 freshness 계산 (RFC 7234)
+ * 응답 헤더는 캐시에 넣을 때 한 번만 파싱해서 cache_meta로 들고 다니고,
+ * hit 때는 저장해둔 메타데이터로 나이(Age)만 다시 계산한다
+ */
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include "cache.h"
+
+#define HTTP_DEFAULT_TTL 300        // 만료 정보가 아예 없는 응답에 주는 기본 수명 (초)
+#define HTTP_HEURISTIC_MAX (24 * 60 * 60) // Last-Modified로 추정한 수명 상한
+#define HTTP_DEFAULT_SIE 60         // 원 서버가 죽었을 때 만료된 걸로 대신 답해도 되는 기본 기간 (초)
+
+/* 응답 헤더에서 뽑아낸 것들, 없는 값은 -1 */
+typedef struct http_info {
+    int status;
+    int no_store;
+    int no_cache;
+    int is_private;
+    int is_public;
+    int vary_star;          // Vary: * 는 어떤 요청에도 재사용할 수 없다
+    int has_etag;
+    int must_revalidate;    // must-revalidate, proxy-revalidate: 만료되면 절대 그냥 쓰면 안 된다
+    long max_age;
+    long s_maxage;
+    long stale_while_revalidate;
+    long stale_if_error;
+    long age;
+    long content_length;
+    time_t date;
+    time_t expires;         // 파싱 못하는 Expires는 이미 만료된 걸로 (0)
+    time_t last_modified;
+} http_info;
+
+/* 클라이언트 요청 헤더, 캐시를 보기 전에 다 읽어둔다
+   조건부 헤더는 프록시가 캐시로 직접 답하고, 원 서버로는 프록시 자신의 것만 보낸다 */
+typedef struct http_request {
+    char headers[MAXBUF];        // 프록시가 새로 채우는 헤더와 조건부 헤더를 뺀 나머지, 그대로 원 서버로
+    size_t headers_len;
+    int too_large;               // headers에 다 못 담았다
+    char if_none_match[MAXLINE];
+    time_t if_modified_since;    // 없으면 -1
+    char range[MAXLINE];         // Range, 캐시에 있으면 프록시가 206으로 직접 답한다
+    char if_range[MAXLINE];
+    int hop;                     // 클러스터의 다른 노드가 주인인 이 노드에게 넘긴 요청 (다시 넘기지 않는다)
+    int only_if_cached;          // Cache-Control: only-if-cached, 캐시에 fresh한 게 없으면 504 (형제 프록시가 보낸다)
+    int authorization;           // Authorization을 보냈다 - 응답이 허락해야만 저장한다 (RFC 7234 3.2)
+} http_request;
+
+#define HTTP_MAX_RANGES 16  // 이보다 많이 쪼갠 Range는 무시하고 통째로 준다
+
+/* 본문 안의 바이트 구간 [first, last] */
+typedef struct http_range {
+    long first;
+    long last;
+} http_range;
+
+time_t http_parse_date(const char* s);
+
+int http_format_date(time_t t, char* out, size_t len);
+
+int http_parse_response(const char* hdr, size_t len, http_info* info);
+
+size_t http_remove_header(char* hdr, size_t len, const char* name);
+
+int http_get_header(const char* hdr, size_t len, const char* name, char* out, size_t outlen);
+
+void http_merge_304(http_info* stored, http_info* fresh);
+
+int http_not_modified(http_request* req, const char* hdr, size_t len, cache_meta* meta);
+
+int http_build_304(const char* hdr, size_t len, long age, char* out, size_t outlen);
+
+int http_parse_range(const char* spec, long length, http_range* out, int max);
+
+int http_if_range_ok(http_request* req, const char* hdr, size_t len, cache_meta* meta);
+
+int http_vary_names(const char* hdr, size_t len, char* out, size_t outlen);
+
+uint64_t http_vary_hash(http_request* req, const char* names);
+
+int http_accepts(http_request* req, const char* coding);
+
+int http_build_partial(const char* hdr, size_t len, const char* extra, long age, char* out, size_t outlen);
+
+int http_negative(http_info* info, int authorization);
+
+int http_freshness(http_info* info, int authorization, time_t req_time, time_t resp_time, int default_ttl, cache_meta* meta);
+
+long http_current_age(cache_meta* meta, time_t now);
+
+int http_is_fresh(cache_meta* meta, time_t now);
+
+void http_stale_windows(http_info* info, int default_swr, int default_sie, cache_meta* meta);
+
+int http_stale_ok(cache_meta* meta, time_t now, uint32_t window);
+
+#endif /* __HTTP_H__ */
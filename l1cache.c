@@ -0,0 +1,144 @@
+/* 쓰레드별 L1 캐시, l1cache.h 참고 */
+#include "l1cache.h"
+
+static l1_table* tables = NULL; // /stats에서 합치려고 전부 이어둔다
+static sem_t tables_lock;
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void tables_init(void) {
+    Sem_init(&tables_lock, 0, 1);
+}
+
+l1_table* l1_create(int nslots, int nthreads) {
+    l1_table* l1 = Calloc(1, sizeof(l1_table));
+    int n = 1;
+
+    while (n < nslots)
+        n <<= 1;
+    l1->slots = Calloc(n, sizeof(l1_entry));
+    l1->nslots = n;
+    l1->nthreads = nthreads > 0 ? nthreads : 1;
+
+    pthread_once(&tables_once, tables_init);
+    P(&tables_lock);
+    l1->next = tables;
+    tables = l1;
+    V(&tables_lock);
+    return l1;
+}
+
+/* L1이 쥐고 있는 동안 slab에서 못 돌아가는 크기 - 공유 본문도 같이 붙잡는다 */
+static size_t pinned(cache_object* obj) {
+    return obj->charge + (obj->body != NULL ? obj->body->charge : 0);
+}
+
+/* 쓰레드 하나의 L1이 지금 쥘 수 있는 최대, cache_resize로 limit이 바뀌면 따라간다 */
+size_t l1_budget(cache_list* cache, int nthreads) {
+    return cache->limit / L1_CACHE_SHARE / nthreads;
+}
+
+static void drop(l1_table* l1, cache_list* cache, l1_entry* e) {
+    l1->bytes -= pinned(e->obj);
+    l1->drops++;
+    cache_release(cache, e->obj);
+    e->obj = NULL;
+}
+
+/* 있으면 L1이 쥐고 있는 객체를 그대로 빌려준다 (refcnt를 안 올린다 - 이 쓰레드만 L1에서 뺄 수 있으니 안전)
+   다 쓰고 cache_release 하면 안 된다 */
+cache_object* l1_lookup(l1_table* l1, cache_list* cache, cache_key* key) {
+    l1_entry* e = &l1->slots[key->hash & (l1->nslots - 1)];
+    cache_object* obj = e->obj;
+
+    if (obj == NULL || e->hash != key->hash || strcmp(obj->id, key->id)) {
+        l1->misses++;
+        return NULL;
+    }
+    if (obj->dead) {
+        drop(l1, cache, e);
+        l1->misses++;
+        return NULL;
+    }
+    l1->hits++;
+    if (e->freq < L1_MAX_FREQ)
+        e->freq++;
+    if (++e->touches >= L1_TOUCH_EVERY) {
+        e->touches = 0;
+        cache_touch(cache, obj);
+    }
+    return obj;
+}
+
+/* 공유 캐시에서 hit한 객체를 L1에 넣어본다 - 큰 객체(청크)는 안 넣는다
+   자리에 다른 객체가 있으면 그 점수를 깎고, 0이 된 다음에야 밀어낸다 */
+void l1_admit(l1_table* l1, cache_list* cache, cache_object* obj) {
+    l1_entry* e = &l1->slots[obj->hash & (l1->nslots - 1)];
+
+    if (obj->data == NULL || obj->dead || e->obj == obj)
+        return;
+    if (e->obj != NULL) {
+        if (!e->obj->dead && e->freq > 0) {
+            e->freq--;
+            return;
+        }
+        drop(l1, cache, e);
+    }
+    if (l1->bytes + pinned(obj) > l1_budget(cache, l1->nthreads))
+        return;
+
+    __sync_fetch_and_add(&obj->refcnt, 1);
+    e->obj = obj;
+    e->hash = obj->hash;
+    e->freq = 1;
+    e->touches = 0;
+    l1->bytes += pinned(obj);
+    l1->admits++;
+}
+
+/* 공유 캐시에서 빠진 객체들을 놓아준다, 워커가 요청을 받을 때마다
+   캐시가 줄어서 budget을 넘게 쥐고 있으면 점수 낮은 것부터 더 놓는다 */
+void l1_sweep(l1_table* l1, cache_list* cache) {
+    size_t budget = l1_budget(cache, l1->nthreads);
+    uint32_t freq;
+    int i;
+
+    for (i = 0; i < l1->nslots; i++)
+        if (l1->slots[i].obj != NULL && l1->slots[i].obj->dead)
+            drop(l1, cache, &l1->slots[i]);
+    for (freq = 0; l1->bytes > budget && freq <= L1_MAX_FREQ; freq++)
+        for (i = 0; i < l1->nslots && l1->bytes > budget; i++)
+            if (l1->slots[i].obj != NULL && l1->slots[i].freq <= freq)
+                drop(l1, cache, &l1->slots[i]);
+}
+
+int l1_stats_text(char* buf, size_t len) {
+    unsigned long hits = 0, misses = 0, admits = 0, drops = 0;
+    size_t bytes = 0;
+    int threads = 0, n;
+    l1_table* l1;
+
+    if (tables == NULL)
+        return 0;
+    P(&tables_lock);
+    for (l1 = tables; l1 != NULL; l1 = l1->next) {
+        hits += l1->hits;
+        misses += l1->misses;
+        admits += l1->admits;
+        drops += l1->drops;
+        bytes += l1->bytes;
+        threads++;
+    }
+    V(&tables_lock);
+
+    n = snprintf(buf, len,
+        "l1_threads: %d\n"
+        "l1_hits: %lu\n"
+        "l1_misses: %lu\n"
+        "l1_hit_ratio: %.4f\n"
+        "l1_admits: %lu\n"
+        "l1_drops: %lu\n"
+        "l1_bytes: %zu\n",
+        threads, hits, misses, hits + misses ? (double)hits / (hits + misses) : 0.0,
+        admits, drops, bytes);
+    return n < (int)len ? n : (int)len - 1;
+}
@@ -0,0 +1,52 @@
+/* 쓰레드마다 따로 두는 L1 캐시 (hot object)
+ * 공유 cache_list에서 자주 hit하는 작은 객체를 워커 쓰레드가 참조를 쥔 채로 들고 있다가,
+ * 다음 요청부터는 락도, refcnt도, 정책 메타데이터도 안 건드리고 바로 보낸다
+ *
+ * - 자리는 키 해시로 정하는 direct-mapped, 다른 객체가 자리를 노릴 때마다 freq가 깎여서 0이 되면 내준다
+ * - 무효화: 공유 캐시에서 빠진 객체 (교체, 퇴거, PURGE)는 dead가 켜진다, L1은 그걸 보고 버린다
+ *   ban은 ban 번호(ban_checked)가 바뀌면 공유 캐시 쪽 경로로 넘겨서 확인받는다
+ * - L1 hit도 가끔 (L1_TOUCH_EVERY번마다) 공유 정책에 알려줘서 hot object가 공유 캐시에서 쫓겨나지 않게 한다
+ */
+#ifndef __L1CACHE_H__
+#define __L1CACHE_H__
+
+#include "cache.h"
+
+#define L1_DEFAULT_SLOTS 64
+#define L1_TOUCH_EVERY 64
+#define L1_MAX_FREQ 16
+#define L1_CACHE_SHARE 4 // L1들이 다 합쳐서 공유 캐시 limit의 1/이만큼까지만 쥔다
+
+typedef struct l1_entry {
+    cache_object* obj;   // 참조를 하나 잡고 있다
+    uint64_t hash;
+    uint32_t freq;       // 이 자리를 지킬 점수
+    uint32_t touches;    // 마지막으로 공유 정책에 hit를 알린 뒤 L1 hit 수
+} l1_entry;
+
+typedef struct l1_table {
+    l1_entry* slots;
+    int nslots;          // 2의 거듭제곱
+    size_t bytes;        // 쥐고 있는 객체들의 charge 합
+    int nthreads;        // 쓰레드 하나가 쥘 수 있는 최대는 limit / L1_CACHE_SHARE / nthreads
+                         // 공유 캐시에서 빠진 뒤에도 L1이 놓기 전까지는 메모리를 못 돌려준다 - limit이 줄면 같이 줄인다
+    unsigned long hits;  // 통계는 자기 쓰레드만 쓴다
+    unsigned long misses;
+    unsigned long admits;
+    unsigned long drops;
+    struct l1_table* next;
+} l1_table;
+
+l1_table* l1_create(int nslots, int nthreads);
+
+size_t l1_budget(cache_list* cache, int nthreads);
+
+cache_object* l1_lookup(l1_table* l1, cache_list* cache, cache_key* key);
+
+void l1_admit(l1_table* l1, cache_list* cache, cache_object* obj);
+
+void l1_sweep(l1_table* l1, cache_list* cache);
+
+int l1_stats_text(char* buf, size_t len);
+
+#endif /* __L1CACHE_H__ */
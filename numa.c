@@ -0,0 +1,139 @@
+/* NUMA 토폴로지, 쓰레드/메모리 묶기 - numa.h 참고 */
+#define _GNU_SOURCE    // cpu_set_t, pthread_setaffinity_np - csapp.h와는 같이 못 쓴다 (gai_error가 겹친다)
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include "numa.h"
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1  // numaif.h 없이 쓰려고 (libnuma 안 씀)
+#endif
+
+static int nnodes = 1;
+static int simulated = 0;
+static int node_id[NUMA_MAX_NODES];       // 커널의 노드 번호 (중간이 빌 수도 있다)
+static cpu_set_t node_set[NUMA_MAX_NODES];
+
+/* "0-3,8-11" 꼴의 CPU 목록 */
+static void parse_cpulist(const char* s, cpu_set_t* set) {
+    CPU_ZERO(set);
+    while (*s) {
+        char* end;
+        long lo = strtol(s, &end, 10), hi, c;
+        if (end == s)
+            break;
+        hi = lo;
+        if (*end == '-')
+            hi = strtol(end + 1, &end, 10);
+        for (c = lo; c <= hi && c < NUMA_MAX_CPUS; c++)
+            CPU_SET(c, set);
+        s = *end == ',' ? end + 1 : end;
+        if (*s == '\n')
+            break;
+    }
+}
+
+/* 실제 노드들을 /sys에서 읽는다, CPU가 없는 노드(메모리만 있는)는 뺀다 */
+static int read_sysfs(void) {
+    char path[128], line[4096];
+    int i, n = 0;
+    FILE* fp;
+
+    for (i = 0; i < 64 && n < NUMA_MAX_NODES; i++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", i);
+        if ((fp = fopen(path, "r")) == NULL)
+            continue;
+        if (fgets(line, sizeof(line), fp) != NULL) {
+            parse_cpulist(line, &node_set[n]);
+            if (CPU_COUNT(&node_set[n]) > 0)
+                node_id[n++] = i;
+        }
+        fclose(fp);
+    }
+    return n;
+}
+
+/* 토폴로지를 정한다, simulate > 0이면 이 프로세스가 쓸 수 있는 CPU를 그 수만큼 나눠서 노드로 친다
+   CPU가 노드 수보다 적으면 돌아가며 나눠 갖는다. 노드 수 리턴 */
+int numa_init(int simulate) {
+    cpu_set_t all;
+    int i, c, ncpu, k = 0;
+
+    if (simulate > NUMA_MAX_NODES)
+        simulate = NUMA_MAX_NODES;
+    if (simulate <= 0 && (nnodes = read_sysfs()) > 0)
+        return nnodes;
+
+    if (sched_getaffinity(0, sizeof(all), &all) < 0) {
+        CPU_ZERO(&all);
+        CPU_SET(0, &all);
+    }
+    nnodes = simulate > 0 ? simulate : 1;
+    simulated = simulate > 0;
+    for (i = 0; i < nnodes; i++) {
+        CPU_ZERO(&node_set[i]);
+        node_id[i] = simulated ? -1 : 0;
+    }
+    ncpu = CPU_COUNT(&all);
+    for (c = 0; c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, &all))
+            continue;
+        if (ncpu >= nnodes) // 앞에서부터 연속으로 잘라서
+            CPU_SET(c, &node_set[k * nnodes / ncpu]);
+        else
+            for (i = k; i < nnodes; i += ncpu)
+                CPU_SET(c, &node_set[i]);
+        k++;
+    }
+    return nnodes;
+}
+
+int numa_nodes(void) {
+    return nnodes;
+}
+
+int numa_simulated(void) {
+    return simulated;
+}
+
+/* 노드의 CPU 목록을 "0-3,8" 꼴로 */
+int numa_node_cpus(int node, char* buf, size_t len) {
+    int c, start = -1, n = 0;
+
+    buf[0] = '\0';
+    for (c = 0; c <= CPU_SETSIZE && (size_t)n < len; c++) {
+        int in = c < CPU_SETSIZE && CPU_ISSET(c, &node_set[node]);
+        if (in && start < 0)
+            start = c;
+        if (!in && start >= 0) {
+            n += snprintf(buf + n, len - n, n ? ",%d" : "%d", start);
+            if (c - 1 > start && (size_t)n < len)
+                n += snprintf(buf + n, len - n, "-%d", c - 1);
+            start = -1;
+        }
+    }
+    return n;
+}
+
+/* 부르는 쓰레드를 그 노드의 CPU들에만 돌게 한다, 실패하면 -1 (컨테이너가 CPU를 막아둔 경우 등 - 그냥 계속 간다) */
+int numa_bind_thread(int node) {
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &node_set[node % nnodes]) == 0 ? 0 : -1;
+}
+
+/* 아직 안 건드린 영역이 그 노드 메모리에서 채워지게 한다 (MPOL_PREFERRED - 모자라면 다른 노드에서라도)
+   흉내낸 노드거나 노드가 하나면 할 게 없다. 실패하면 -1 */
+int numa_bind_memory(void* addr, size_t len, int node) {
+    unsigned long mask;
+
+    if (simulated || nnodes == 1 || node < 0 || node_id[node % nnodes] >= (int)(sizeof(mask) * 8))
+        return 0;
+    mask = 1UL << node_id[node % nnodes];
+#ifdef SYS_mbind
+    if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0) == 0)
+        return 0;
+#endif
+    return -1;
+}
@@ -0,0 +1,29 @@
+/* NUMA 배치
+ * 소켓이 두 개인 박스에서 0번 노드 메모리에 올라간 객체를 1번 노드의 워커가 보내면 hit마다 원격 메모리를 읽는다
+ * - 워커는 노드별로 CPU를 묶어서 돌리고 (worker i -> 노드 i % N)
+ * - 캐시 slab 영역은 노드마다 따로 잡아서 그 노드 메모리에 붙인다 (mbind)
+ * - 객체는 넣는 워커의 노드 영역에서 먼저 자리를 받는다, 꽉 찼으면 다른 노드 영역으로
+ * 노드가 하나뿐인 기계에서도 시험할 수 있게 --numa=N으로 토폴로지를 흉내낼 수 있다
+ * (CPU를 N등분해서 노드로 치고, 메모리는 실제로 옮기지 않는다 - 배치와 통계만 같다)
+ */
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include <stddef.h>
+
+#define NUMA_MAX_NODES 8
+#define NUMA_MAX_CPUS 1024
+
+int numa_init(int simulate);
+
+int numa_nodes(void);
+
+int numa_simulated(void);
+
+int numa_node_cpus(int node, char* buf, size_t len);
+
+int numa_bind_thread(int node);
+
+int numa_bind_memory(void* addr, size_t len, int node);
+
+#endif /* __NUMA_H__ */
@@ -0,0 +1,227 @@
+/* 부모/형제 프록시, peer.h 참고 */
+#include <poll.h>
+#include <sys/time.h>
+#include "peer.h"
+
+static peer siblings[PEER_MAX];
+static int nsiblings = 0;
+static peer parent;
+static int has_parent = 0;
+static peer_stats stats;
+static unsigned int probe_seq = 0;
+static int (*has_key)(const char* key) = NULL;
+
+/* "host:port"를 나눠서 UDP 주소까지 찾아둔다 */
+static int peer_parse(const char* spec, peer* p) {
+    struct addrinfo hints, *list;
+    const char* colon = strrchr(spec, ':');
+    size_t n;
+
+    if (colon == NULL || colon == spec || colon[1] == '\0')
+        return -1;
+    n = colon - spec;
+    if (n >= sizeof(p->host) || strlen(colon + 1) >= sizeof(p->port))
+        return -1;
+    memset(p, 0, sizeof(*p));
+    memcpy(p->host, spec, n);
+    p->host[n] = '\0';
+    strcpy(p->port, colon + 1);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    if (getaddrinfo(p->host, p->port, &hints, &list) != 0)
+        return -1;
+    memcpy(&p->addr, list->ai_addr, list->ai_addrlen);
+    p->addrlen = list->ai_addrlen;
+    freeaddrinfo(list);
+    return 0;
+}
+
+/* 시작할 때만 부른다 (쓰레드들이 뜨기 전) */
+int peer_add_sibling(const char* spec) {
+    if (nsiblings >= PEER_MAX || peer_parse(spec, &siblings[nsiblings]) < 0)
+        return -1;
+    nsiblings++;
+    return 0;
+}
+
+int peer_set_parent(const char* spec) {
+    if (peer_parse(spec, &parent) < 0)
+        return -1;
+    has_parent = 1;
+    return 0;
+}
+
+peer* peer_parent(void) {
+    return has_parent ? &parent : NULL;
+}
+
+int peer_count(void) {
+    return nsiblings;
+}
+
+static long elapsed_usec(struct timeval* t0) {
+    struct timeval t1;
+    gettimeofday(&t1, NULL);
+    return (t1.tv_sec - t0->tv_sec) * 1000000L + (t1.tv_usec - t0->tv_usec);
+}
+
+/* 형제들에게 key가 있는지 한꺼번에 물어보고, 제일 먼저 있다고 한 형제를 돌려준다
+   다 없다고 하거나 timeout_ms가 지나면 NULL */
+peer* peer_probe(const char* key, int timeout_ms) {
+    char msg[PEER_MAX_PACKET + 32], reply[64];
+    struct pollfd pfd;
+    struct timeval t0;
+    struct sockaddr_storage from;
+    socklen_t fromlen;
+    unsigned int seq, rseq;
+    peer* found = NULL;
+    int fd, i, n, len, answered = 0;
+    long waited, usec;
+
+    if (nsiblings == 0 || strlen(key) > PEER_MAX_PACKET)
+        return NULL;
+    if ((fd = socket(siblings[0].addr.ss_family, SOCK_DGRAM, 0)) < 0)
+        return NULL;
+
+    seq = __sync_add_and_fetch(&probe_seq, 1);
+    len = snprintf(msg, sizeof(msg), "PXQ1 %u %s", seq, key);
+    gettimeofday(&t0, NULL);
+    for (i = 0; i < nsiblings; i++) {
+        sendto(fd, msg, len, 0, (SA*)&siblings[i].addr, siblings[i].addrlen);
+        __sync_fetch_and_add(&siblings[i].probes, 1);
+    }
+    __sync_fetch_and_add(&stats.probes, 1);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (found == NULL && answered < nsiblings) {
+        waited = elapsed_usec(&t0) / 1000;
+        if (waited >= timeout_ms || poll(&pfd, 1, timeout_ms - waited) <= 0) {
+            __sync_fetch_and_add(&stats.probe_timeouts, 1);
+            break;
+        }
+        fromlen = sizeof(from);
+        if ((n = recvfrom(fd, reply, sizeof(reply) - 1, 0, (SA*)&from, &fromlen)) <= 0)
+            continue;
+        reply[n] = '\0';
+        if (sscanf(reply + 4, " %u", &rseq) != 1 || rseq != seq) // 늦게 온 예전 질의의 답
+            continue;
+        answered++;
+        if (strncmp(reply, "PXH1", 4))
+            continue;
+        for (i = 0; i < nsiblings; i++) { // 보낸 주소로 누군지 찾는다
+            if (fromlen == siblings[i].addrlen && !memcmp(&from, &siblings[i].addr, fromlen)) {
+                found = &siblings[i];
+                break;
+            }
+        }
+    }
+    Close(fd);
+
+    usec = elapsed_usec(&t0);
+    __sync_fetch_and_add(&stats.probe_usec, usec);
+    if ((unsigned long)usec > stats.probe_max_usec)
+        stats.probe_max_usec = usec; // 통계용이라 경합은 신경 안 쓴다
+    if (found != NULL) {
+        __sync_fetch_and_add(&stats.probe_hits, 1);
+        __sync_fetch_and_add(&found->hits, 1);
+    }
+    return found;
+}
+
+/* 형제/부모에게서 받아온 결과 */
+void peer_note_fetch(peer* p, int ok) {
+    if (p == &parent)
+        __sync_fetch_and_add(ok ? &stats.parent_fetches : &stats.parent_failures, 1);
+    else
+        __sync_fetch_and_add(ok ? &p->fetches : &p->failures, 1);
+}
+
+/* 다른 프록시들의 질의에 답하는 쓰레드, 캐시는 has로만 본다 */
+static void* responder_thread(void* arg) {
+    int fd = *(int*)arg;
+    char msg[PEER_MAX_PACKET + 64], key[PEER_MAX_PACKET + 1], reply[64];
+    struct sockaddr_storage from;
+    socklen_t fromlen;
+    unsigned int seq;
+    int n, hit;
+
+    Free(arg);
+    Pthread_detach(Pthread_self());
+    while (1) {
+        fromlen = sizeof(from);
+        if ((n = recvfrom(fd, msg, sizeof(msg) - 1, 0, (SA*)&from, &fromlen)) <= 0)
+            continue;
+        msg[n] = '\0';
+        if (strncmp(msg, "PXQ1 ", 5) || sscanf(msg + 5, "%u %2048s", &seq, key) != 2)
+            continue;
+        hit = has_key(key);
+        __sync_fetch_and_add(&stats.queries, 1);
+        if (hit)
+            __sync_fetch_and_add(&stats.query_hits, 1);
+        n = snprintf(reply, sizeof(reply), "%s %u", hit ? "PXH1" : "PXM1", seq);
+        sendto(fd, reply, n, 0, (SA*)&from, fromlen);
+    }
+    return NULL;
+}
+
+/* port번 UDP로 질의를 받는다 (HTTP 포트와 같은 번호) */
+void peer_start_responder(char* port, int (*has)(const char* key)) {
+    struct addrinfo hints, *list, *p;
+    pthread_t tid;
+    int fd = -1, optval = 1;
+    int* arg;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV;
+    Getaddrinfo(NULL, port, &hints, &list);
+    for (p = list; p != NULL; p = p->ai_next) {
+        if ((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+            continue;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(int));
+        if (bind(fd, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+        Close(fd);
+        fd = -1;
+    }
+    Freeaddrinfo(list);
+    if (fd < 0) {
+        fprintf(stderr, "peer: cannot bind UDP port %s\n", port);
+        return;
+    }
+
+    has_key = has;
+    arg = Malloc(sizeof(int));
+    *arg = fd;
+    Pthread_create(&tid, NULL, responder_thread, arg);
+}
+
+int peer_stats_text(char* buf, size_t len) {
+    int n, i;
+
+    n = snprintf(buf, len,
+        "peer_probes: %lu\n"
+        "peer_probe_hits: %lu\n"
+        "peer_hit_ratio: %.4f\n"
+        "peer_probe_timeouts: %lu\n"
+        "peer_probe_avg_usec: %.1f\n"
+        "peer_probe_max_usec: %lu\n"
+        "peer_queries: %lu\n"
+        "peer_query_hits: %lu\n"
+        "peer_parent_fetches: %lu\n"
+        "peer_parent_failures: %lu\n",
+        stats.probes, stats.probe_hits,
+        stats.probes ? (double)stats.probe_hits / stats.probes : 0.0,
+        stats.probe_timeouts,
+        stats.probes ? (double)stats.probe_usec / stats.probes : 0.0,
+        stats.probe_max_usec, stats.queries, stats.query_hits,
+        stats.parent_fetches, stats.parent_failures);
+    for (i = 0; i < nsiblings && n < (int)len; i++)
+        n += snprintf(buf + n, len - n, "sibling %s:%s: probes=%lu hits=%lu fetches=%lu failures=%lu\n",
+                      siblings[i].host, siblings[i].port, siblings[i].probes, siblings[i].hits,
+                      siblings[i].fetches, siblings[i].failures);
+    return n < (int)len ? n : (int)len - 1; // 잘렸으면 실제로 쓴 만큼
+}
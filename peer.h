@@ -0,0 +1,58 @@
+/* 캐시 계층: 부모 프록시와 형제(sibling) 프록시
+ * 프록시 여러 대가 각자 원 서버로 miss를 보내지 않게
+ * - 형제: miss가 나면 먼저 UDP로 "키 X 있어?"를 한 번에 다 물어보고 (ICP 비슷하게) 짧게 기다린다
+ *         있다는 형제가 있으면 그 프록시에게 Cache-Control: only-if-cached로 받아온다 (없어졌으면 504, 그럼 다음 단계로)
+ * - 부모: 형제에게도 없으면 원 서버 대신 부모 프록시로 보낸다, 부모가 안 되면 원 서버로 직접
+ * UDP 질의는 각 프록시의 HTTP 포트와 같은 번호의 UDP 포트로 받는다
+ *
+ * 질의: "PXQ1 <seq> <key>"   답: "PXH1 <seq>" (fresh하게 있다) / "PXM1 <seq>" (없다)
+ */
+#ifndef __PEER_H__
+#define __PEER_H__
+
+#include "csapp.h"
+
+#define PEER_MAX 16
+#define PEER_PROBE_TIMEOUT 50   // 형제 답을 기다리는 최대 시간 (ms)
+#define PEER_MAX_PACKET 2048    // 키가 이보다 길면 묻지 않는다
+
+typedef struct peer {
+    char host[MAXLINE];
+    char port[16];
+    struct sockaddr_storage addr;  // UDP 질의 보낼 곳
+    socklen_t addrlen;
+    unsigned long probes;          // 이 형제에게 물어본 수
+    unsigned long hits;            // 있다고 답한 수
+    unsigned long fetches;         // 실제로 받아온 수
+    unsigned long failures;        // 받으러 갔는데 없었거나 연결이 안 됐다
+} peer;
+
+typedef struct peer_stats {
+    unsigned long probes;          // miss마다 한 번 (형제 전부에게)
+    unsigned long probe_hits;      // 형제 중 누가 있다고 했다
+    unsigned long probe_timeouts;  // 다 답하기 전에 시간이 다 됐다
+    unsigned long long probe_usec; // 질의부터 결정까지 걸린 시간 합
+    unsigned long probe_max_usec;
+    unsigned long queries;         // 다른 프록시에게서 받은 질의
+    unsigned long query_hits;
+    unsigned long parent_fetches;
+    unsigned long parent_failures;
+} peer_stats;
+
+int peer_add_sibling(const char* spec);
+
+int peer_set_parent(const char* spec);
+
+peer* peer_parent(void);
+
+int peer_count(void);
+
+peer* peer_probe(const char* key, int timeout_ms);
+
+void peer_note_fetch(peer* p, int ok);
+
+void peer_start_responder(char* port, int (*has)(const char* key));
+
+int peer_stats_text(char* buf, size_t len);
+
+#endif /* __PEER_H__ */
@@ -0,0 +1,413 @@
+/* 캐시 교체 정책 구현: LRU, S3-FIFO, ARC, GDSF
+ * 모든 정책은 바이트 단위로 동작한다 (객체 크기가 수 바이트 ~ 100KB로 제각각이라서)
+ */
+#include "cache.h"
+
+/* ---------- 공통: 정책 큐 ---------- */
+
+static void queue_push(policy_queue* q, cache_object* obj) {
+    obj->pnext = NULL;
+    obj->pprev = q->tail;
+    if (q->tail)
+        q->tail->pnext = obj;
+    else
+        q->head = obj;
+    q->tail = obj;
+    q->bytes += obj->length;
+    q->count++;
+}
+
+static void queue_unlink(policy_queue* q, cache_object* obj) {
+    if (obj->pprev)
+        obj->pprev->pnext = obj->pnext;
+    else
+        q->head = obj->pnext;
+    if (obj->pnext)
+        obj->pnext->pprev = obj->pprev;
+    else
+        q->tail = obj->pprev;
+    obj->pprev = obj->pnext = NULL;
+    q->bytes -= obj->length;
+    q->count--;
+}
+
+/* ---------- 공통: ghost 리스트 ----------
+   캐시에서 쫓겨난 객체의 (hash, size)만 기억하는 FIFO, S3-FIFO와 ARC가 쓴다
+   멤버십 검사를 리스트 순회 없이 하려고 해시 버킷을 같이 둔다 */
+#define GHOST_BUCKETS 1024
+
+typedef struct ghost_entry {
+    uint64_t hash;
+    unsigned int size;
+    struct ghost_entry* qprev;
+    struct ghost_entry* qnext;
+    struct ghost_entry* hnext;
+} ghost_entry;
+
+typedef struct ghost_list {
+    ghost_entry* head;
+    ghost_entry* tail;
+    ghost_entry* buckets[GHOST_BUCKETS];
+    unsigned long bytes;
+} ghost_list;
+
+static ghost_entry** ghost_slot(ghost_list* g, uint64_t hash) {
+    ghost_entry** pp = &g->buckets[hash % GHOST_BUCKETS];
+    while (*pp && (*pp)->hash != hash)
+        pp = &(*pp)->hnext;
+    return pp;
+}
+
+static void ghost_remove(ghost_list* g, ghost_entry* e) {
+    ghost_entry** pp = ghost_slot(g, e->hash);
+    *pp = e->hnext;
+    if (e->qprev)
+        e->qprev->qnext = e->qnext;
+    else
+        g->head = e->qnext;
+    if (e->qnext)
+        e->qnext->qprev = e->qprev;
+    else
+        g->tail = e->qprev;
+    g->bytes -= e->size;
+    Free(e);
+}
+
+/* ghost에 있었으면 꺼내면서 1을 리턴 */
+static int ghost_take(ghost_list* g, uint64_t hash) {
+    ghost_entry* e = *ghost_slot(g, hash);
+    if (e == NULL)
+        return 0;
+    ghost_remove(g, e);
+    return 1;
+}
+
+static void ghost_add(ghost_list* g, uint64_t hash, unsigned int size, unsigned long limit) {
+    ghost_entry* e;
+    if ((e = *ghost_slot(g, hash)) != NULL)
+        ghost_remove(g, e);
+
+    e = Malloc(sizeof(ghost_entry));
+    e->hash = hash;
+    e->size = size;
+    e->qnext = NULL;
+    e->qprev = g->tail;
+    if (g->tail)
+        g->tail->qnext = e;
+    else
+        g->head = e;
+    g->tail = e;
+    e->hnext = g->buckets[hash % GHOST_BUCKETS];
+    g->buckets[hash % GHOST_BUCKETS] = e;
+    g->bytes += size;
+
+    while (g->bytes > limit && g->head)
+        ghost_remove(g, g->head);
+}
+
+static void ghost_clear(ghost_list* g) {
+    while (g->head)
+        ghost_remove(g, g->head);
+}
+
+/* ---------- LRU ---------- */
+
+static void lru_on_hit(cache_policy* p, cache_object* obj) {
+    policy_queue* q = p->state;
+    queue_unlink(q, obj); // 최근에 쓰였으니 맨 끝으로
+    queue_push(q, obj);
+}
+
+static void lru_on_insert(cache_policy* p, cache_object* obj) {
+    queue_push(p->state, obj);
+}
+
+static cache_object* lru_choose_victim(cache_policy* p) {
+    return ((policy_queue*)p->state)->head;
+}
+
+static void lru_on_remove(cache_policy* p, cache_object* obj, int evicted) {
+    queue_unlink(p->state, obj);
+}
+
+static void lru_destroy(cache_policy* p) {
+    Free(p->state);
+}
+
+/* ---------- S3-FIFO ----------
+   small(S) FIFO에 처음 들어오고, S에서 나갈 때 두 번 이상 쓰였으면 main(M)으로 간다
+   S에서 그냥 쫓겨난 애는 ghost(G)에 기록되고, G에 있던 키가 다시 들어오면 바로 M으로 */
+#define S3_SMALL 0
+#define S3_MAIN  1
+#define S3_FREQ_MAX 3
+
+typedef struct s3fifo_state {
+    policy_queue small;
+    policy_queue main;
+    ghost_list ghost;
+} s3fifo_state;
+
+static void s3fifo_on_hit(cache_policy* p, cache_object* obj) {
+    if (obj->freq < S3_FREQ_MAX)
+        obj->freq++;
+}
+
+static void s3fifo_on_insert(cache_policy* p, cache_object* obj) {
+    s3fifo_state* s = p->state;
+    obj->freq = 0;
+    if (ghost_take(&s->ghost, obj->hash)) {
+        obj->queue = S3_MAIN;
+        queue_push(&s->main, obj);
+    } else {
+        obj->queue = S3_SMALL;
+        queue_push(&s->small, obj);
+    }
+}
+
+static cache_object* s3fifo_choose_victim(cache_policy* p) {
+    s3fifo_state* s = p->state;
+    cache_object* obj;
+
+    /* S가 전체의 10%를 넘었으면 S에서 먼저 */
+    while (s->small.head && (s->small.bytes >= p->capacity / 10 || s->main.head == NULL)) {
+        obj = s->small.head;
+        if (obj->freq <= 1)
+            return obj; // on_remove에서 ghost로 간다
+        queue_unlink(&s->small, obj);
+        obj->freq = 0;
+        obj->queue = S3_MAIN;
+        queue_push(&s->main, obj);
+    }
+
+    /* M은 freq를 하나씩 깎아가며 한 바퀴 더 돌려준다 (CLOCK과 비슷) */
+    while ((obj = s->main.head) != NULL) {
+        if (obj->freq == 0)
+            return obj;
+        obj->freq--;
+        queue_unlink(&s->main, obj);
+        queue_push(&s->main, obj);
+    }
+    return s->small.head;
+}
+
+static void s3fifo_on_remove(cache_policy* p, cache_object* obj, int evicted) {
+    s3fifo_state* s = p->state;
+    if (obj->queue == S3_SMALL) {
+        queue_unlink(&s->small, obj);
+        if (evicted)
+            ghost_add(&s->ghost, obj->hash, obj->length, p->capacity / 10 * 9);
+    } else {
+        queue_unlink(&s->main, obj);
+    }
+}
+
+static void s3fifo_destroy(cache_policy* p) {
+    s3fifo_state* s = p->state;
+    ghost_clear(&s->ghost);
+    Free(s);
+}
+
+/* ---------- ARC ----------
+   T1: 한 번 쓰인 애들, T2: 두 번 이상 쓰인 애들, B1/B2: 각각에서 쫓겨난 ghost
+   target은 T1이 차지할 목표 바이트 수로, ghost hit에 따라 움직인다 */
+#define ARC_T1 0
+#define ARC_T2 1
+
+typedef struct arc_state {
+    policy_queue t1;
+    policy_queue t2;
+    ghost_list b1;
+    ghost_list b2;
+    unsigned long target;
+} arc_state;
+
+static void arc_on_hit(cache_policy* p, cache_object* obj) {
+    arc_state* s = p->state;
+    queue_unlink(obj->queue == ARC_T1 ? &s->t1 : &s->t2, obj);
+    obj->queue = ARC_T2;
+    queue_push(&s->t2, obj);
+}
+
+static void arc_on_insert(cache_policy* p, cache_object* obj) {
+    arc_state* s = p->state;
+    uint64_t hash = obj->hash;
+    unsigned long delta;
+
+    if (ghost_take(&s->b1, hash)) { // 최근성 쪽이 모자랐다 -> T1 키우기
+        delta = s->b1.bytes && s->b2.bytes > s->b1.bytes ? obj->length * (s->b2.bytes / s->b1.bytes) : obj->length;
+        s->target = s->target + delta > p->capacity ? p->capacity : s->target + delta;
+        obj->queue = ARC_T2;
+        queue_push(&s->t2, obj);
+    } else if (ghost_take(&s->b2, hash)) { // 빈도 쪽이 모자랐다 -> T1 줄이기
+        delta = s->b2.bytes && s->b1.bytes > s->b2.bytes ? obj->length * (s->b1.bytes / s->b2.bytes) : obj->length;
+        s->target = s->target > delta ? s->target - delta : 0;
+        obj->queue = ARC_T2;
+        queue_push(&s->t2, obj);
+    } else {
+        obj->queue = ARC_T1;
+        queue_push(&s->t1, obj);
+    }
+}
+
+static cache_object* arc_choose_victim(cache_policy* p) {
+    arc_state* s = p->state;
+    if (s->t1.head && (s->t1.bytes > s->target || s->t2.head == NULL))
+        return s->t1.head;
+    return s->t2.head;
+}
+
+static void arc_on_remove(cache_policy* p, cache_object* obj, int evicted) {
+    arc_state* s = p->state;
+    if (obj->queue == ARC_T1) {
+        queue_unlink(&s->t1, obj);
+        if (evicted)
+            ghost_add(&s->b1, obj->hash, obj->length, p->capacity);
+    } else {
+        queue_unlink(&s->t2, obj);
+        if (evicted)
+            ghost_add(&s->b2, obj->hash, obj->length, p->capacity);
+    }
+}
+
+static void arc_destroy(cache_policy* p) {
+    arc_state* s = p->state;
+    ghost_clear(&s->b1);
+    ghost_clear(&s->b2);
+    Free(s);
+}
+
+/* ---------- GDSF (GreedyDual-Size-Frequency) ----------
+   H = L + freq * cost / size, 가장 H가 작은 객체를 내보내고 L을 그 H로 올린다
+   cost는 1로 두므로 작은 객체, 자주 쓰이는 객체가 오래 남는다. H 최소값은 min-heap으로 찾는다 */
+typedef struct gdsf_state {
+    cache_object** heap;
+    int size;
+    int cap;
+    double inflation; // L
+} gdsf_state;
+
+static double gdsf_priority(gdsf_state* s, cache_object* obj) {
+    return s->inflation + (double)obj->freq / (double)(obj->length + 1);
+}
+
+static void heap_swap(gdsf_state* s, int i, int j) {
+    cache_object* tmp = s->heap[i];
+    s->heap[i] = s->heap[j];
+    s->heap[j] = tmp;
+    s->heap[i]->heap_idx = i;
+    s->heap[j]->heap_idx = j;
+}
+
+static void heap_fix(gdsf_state* s, int i) {
+    while (i > 0 && s->heap[(i - 1) / 2]->priority > s->heap[i]->priority) {
+        heap_swap(s, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while (1) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < s->size && s->heap[l]->priority < s->heap[m]->priority)
+            m = l;
+        if (r < s->size && s->heap[r]->priority < s->heap[m]->priority)
+            m = r;
+        if (m == i)
+            break;
+        heap_swap(s, i, m);
+        i = m;
+    }
+}
+
+static void gdsf_on_hit(cache_policy* p, cache_object* obj) {
+    gdsf_state* s = p->state;
+    obj->freq++;
+    obj->priority = gdsf_priority(s, obj);
+    heap_fix(s, obj->heap_idx);
+}
+
+static void gdsf_on_insert(cache_policy* p, cache_object* obj) {
+    gdsf_state* s = p->state;
+    if (s->size == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 64;
+        s->heap = Realloc(s->heap, s->cap * sizeof(cache_object*));
+    }
+    obj->freq = 1;
+    obj->priority = gdsf_priority(s, obj);
+    obj->heap_idx = s->size;
+    s->heap[s->size++] = obj;
+    heap_fix(s, obj->heap_idx);
+}
+
+static cache_object* gdsf_choose_victim(cache_policy* p) {
+    gdsf_state* s = p->state;
+    return s->size ? s->heap[0] : NULL;
+}
+
+static void gdsf_on_remove(cache_policy* p, cache_object* obj, int evicted) {
+    gdsf_state* s = p->state;
+    int i = obj->heap_idx;
+    if (evicted)
+        s->inflation = obj->priority;
+    s->size--;
+    if (i != s->size) {
+        s->heap[i] = s->heap[s->size];
+        s->heap[i]->heap_idx = i;
+        heap_fix(s, i);
+    }
+    obj->heap_idx = -1;
+}
+
+static void gdsf_destroy(cache_policy* p) {
+    gdsf_state* s = p->state;
+    Free(s->heap);
+    Free(s);
+}
+
+/* 이름으로 정책을 만든다, 모르는 이름이면 NULL */
+cache_policy* policy_create(const char* name, unsigned long capacity) {
+    cache_policy* p = Calloc(1, sizeof(cache_policy));
+    p->capacity = capacity;
+
+    if (!strcasecmp(name, "lru")) {
+        p->name = "lru";
+        p->state = Calloc(1, sizeof(policy_queue));
+        p->on_hit = lru_on_hit;
+        p->on_insert = lru_on_insert;
+        p->choose_victim = lru_choose_victim;
+        p->on_remove = lru_on_remove;
+        p->destroy = lru_destroy;
+    } else if (!strcasecmp(name, "s3fifo") || !strcasecmp(name, "s3-fifo")) {
+        p->name = "s3fifo";
+        p->state = Calloc(1, sizeof(s3fifo_state));
+        p->on_hit = s3fifo_on_hit;
+        p->on_insert = s3fifo_on_insert;
+        p->choose_victim = s3fifo_choose_victim;
+        p->on_remove = s3fifo_on_remove;
+        p->destroy = s3fifo_destroy;
+    } else if (!strcasecmp(name, "arc")) {
+        p->name = "arc";
+        p->state = Calloc(1, sizeof(arc_state));
+        p->on_hit = arc_on_hit;
+        p->on_insert = arc_on_insert;
+        p->choose_victim = arc_choose_victim;
+        p->on_remove = arc_on_remove;
+        p->destroy = arc_destroy;
+    } else if (!strcasecmp(name, "gdsf")) {
+        p->name = "gdsf";
+        p->state = Calloc(1, sizeof(gdsf_state));
+        p->on_hit = gdsf_on_hit;
+        p->on_insert = gdsf_on_insert;
+        p->choose_victim = gdsf_choose_victim;
+        p->on_remove = gdsf_on_remove;
+        p->destroy = gdsf_destroy;
+    } else {
+        Free(p);
+        return NULL;
+    }
+    return p;
+}
+
+void policy_destroy(cache_policy* p) {
+    if (p == NULL)
+        return;
+    p->destroy(p);
+    Free(p);
+}
@@ -0,0 +1,41 @@
+/* 캐시 교체(eviction) 정책 인터페이스
+ * cache.c는 어떤 객체를 내보낼지 직접 정하지 않고, 여기 정의된 hook들을 통해 정책에게 물어본다
+ */
+#ifndef __POLICY_H__
+#define __POLICY_H__
+
+#include <stdint.h>
+
+struct cache_object;
+
+/* 정책이 객체를 줄 세우는 데 쓰는 intrusive 이중 연결리스트 (obj->pprev, obj->pnext 사용) */
+typedef struct policy_queue {
+    struct cache_object* head; // 가장 오래된 쪽 (eviction 후보)
+    struct cache_object* tail; // 가장 최근 쪽
+    unsigned long bytes;
+    unsigned int count;
+} policy_queue;
+
+typedef struct cache_policy {
+    const char* name;
+    unsigned long capacity; // 정책이 관리하는 전체 바이트 수 (S3-FIFO/ARC의 큐 비율 계산용)
+    void* state;            // 정책별 내부 상태
+
+    /* 캐시 hit: 읽기 락 + plock을 잡은 상태로 호출된다 */
+    void (*on_hit)(struct cache_policy* p, struct cache_object* obj);
+    /* 새 객체가 인덱스에 들어간 직후: write 락 */
+    void (*on_insert)(struct cache_policy* p, struct cache_object* obj);
+    /* 다음에 쫓아낼 객체를 고른다, 없으면 NULL: write 락 */
+    struct cache_object* (*choose_victim)(struct cache_policy* p);
+    /* 객체가 캐시에서 빠짐. evicted가 1이면 choose_victim으로 쫓겨난 것 (ghost 기록용): write 락 */
+    void (*on_remove)(struct cache_policy* p, struct cache_object* obj, int evicted);
+    void (*destroy)(struct cache_policy* p);
+} cache_policy;
+
+#define POLICY_NAMES "lru, s3fifo, arc, gdsf"
+
+cache_policy* policy_create(const char* name, unsigned long capacity);
+
+void policy_destroy(cache_policy* p);
+
+#endif /* __POLICY_H__ */
@@ -0,0 +1,86 @@
+/* 메모리 압박 읽기, pressure.h 참고 */
+#include "pressure.h"
+
+static int readable(const char* path) {
+    return access(path, R_OK) == 0;
+}
+
+/* /proc/self/cgroup에서 v2 경로 ("0::/a/b")와 v1 memory 컨트롤러 경로 ("4:memory:/a/b") */
+static void cgroup_paths(char* v2, char* v1, size_t len) {
+    char line[MAXLINE];
+    FILE* fp;
+
+    v2[0] = v1[0] = '\0';
+    if ((fp = fopen("/proc/self/cgroup", "r")) == NULL)
+        return;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char* ctl = strchr(line, ':');
+        char* path = ctl != NULL ? strchr(ctl + 1, ':') : NULL;
+        if (path == NULL)
+            continue;
+        path[strcspn(path, "\n")] = '\0';
+        if (!strncmp(ctl, "::", 2))
+            snprintf(v2, len, "%s", path + 1);
+        else if (strstr(ctl, "memory") != NULL && strstr(ctl, "memory") < path)
+            snprintf(v1, len, "%s", path + 1);
+    }
+    fclose(fp);
+}
+
+/* dir/name이 있으면 out에 경로를 쓰고 1 */
+static int find_file(char* out, size_t len, const char* dir, const char* cg, const char* name) {
+    snprintf(out, len, "%s%s/%s", dir, !strcmp(cg, "/") ? "" : cg, name);
+    if (readable(out))
+        return 1;
+    snprintf(out, len, "%s/%s", dir, name); // 컨테이너 안에서는 자기 cgroup이 루트로 보이기도 한다
+    if (readable(out))
+        return 1;
+    out[0] = '\0';
+    return 0;
+}
+
+int pressure_open(pressure_src* src) {
+    char v2[MAXLINE / 2], v1[MAXLINE / 2];
+
+    cgroup_paths(v2, v1, sizeof(v2));
+    if (!find_file(src->psi, sizeof(src->psi), "/sys/fs/cgroup", v2, "memory.pressure")
+        && !find_file(src->psi, sizeof(src->psi), "/sys/fs/cgroup/unified", v2, "memory.pressure")) {
+        snprintf(src->psi, sizeof(src->psi), "/proc/pressure/memory"); // 시스템 전체
+        if (!readable(src->psi))
+            src->psi[0] = '\0';
+    }
+    if (!(find_file(src->usage, sizeof(src->usage), "/sys/fs/cgroup", v2, "memory.current")
+          && find_file(src->limit, sizeof(src->limit), "/sys/fs/cgroup", v2, "memory.max"))
+        && !(find_file(src->usage, sizeof(src->usage), "/sys/fs/cgroup/memory", v1, "memory.usage_in_bytes")
+             && find_file(src->limit, sizeof(src->limit), "/sys/fs/cgroup/memory", v1, "memory.limit_in_bytes")))
+        src->usage[0] = src->limit[0] = '\0';
+    return src->psi[0] || src->usage[0] ? 0 : -1;
+}
+
+/* 숫자 하나짜리 파일, "max"나 터무니없이 큰 값 (v1의 무제한)은 0 */
+static size_t read_bytes(const char* path) {
+    unsigned long long v = 0;
+    FILE* fp;
+
+    if (path[0] == '\0' || (fp = fopen(path, "r")) == NULL)
+        return 0;
+    if (fscanf(fp, "%llu", &v) != 1 || v >= (1ULL << 62))
+        v = 0;
+    fclose(fp);
+    return (size_t)v;
+}
+
+void pressure_read(pressure_src* src, pressure_sample* out) {
+    char line[MAXLINE];
+    FILE* fp;
+
+    out->avg10 = -1;
+    if (src->psi[0] && (fp = fopen(src->psi, "r")) != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL)
+            if (sscanf(line, "some avg10=%lf", &out->avg10) == 1)
+                break;
+        fclose(fp);
+    }
+    out->usage = read_bytes(src->usage);
+    out->limit = read_bytes(src->limit);
+}
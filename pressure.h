@@ -0,0 +1,29 @@
+/* 메모리 압박 읽기 (--psi)
+ * 컨테이너 안에서는 캐시가 cgroup 한도까지 자라다가 OOM killer에게 프로세스째 죽는다
+ * 그 전에 알아채서 캐시를 줄일 수 있게 이 프로세스가 속한 cgroup의 메모리 상태를 읽는다
+ * - PSI: memory.pressure (cgroup v2) 또는 /proc/pressure/memory의 "some avg10" - 최근 10초 중 메모리를 기다린 시간 %
+ * - 사용량/한도: memory.current/memory.max (v2) 또는 memory.usage_in_bytes/memory.limit_in_bytes (v1)
+ * 읽을 수 있는 것만 쓴다, 하나도 없으면 pressure_open이 -1
+ */
+#ifndef __PRESSURE_H__
+#define __PRESSURE_H__
+
+#include "csapp.h"
+
+typedef struct pressure_src {
+    char psi[MAXLINE];       // 없으면 ""
+    char usage[MAXLINE];
+    char limit[MAXLINE];
+} pressure_src;
+
+typedef struct pressure_sample {
+    double avg10;            // PSI를 못 읽으면 -1
+    size_t usage;            // 못 읽으면 0
+    size_t limit;            // 한도가 없거나 못 읽으면 0
+} pressure_sample;
+
+int pressure_open(pressure_src* src);
+
+void pressure_read(pressure_src* src, pressure_sample* out);
+
+#endif /* __PRESSURE_H__ */
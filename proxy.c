@@ -1,10 +1,39 @@
 #include <stdio.h>
+#include <getopt.h>
 #include "csapp.h"
 #include "cache.h"
+#include "disk.h"
+#include "snapshot.h"
+#include "shmcache.h"
+#include "http.h"
+#include "ban.h"
+#include "sbuf.h"
+#include "l1cache.h"
+#include "compress.h"
+#include "peer.h"
+#include "cluster.h"
+#include "numa.h"
+#include "admit.h"
+#include "pressure.h"
 
-/* Recommended max cache and object sizes */
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+#define FETCH_DONE 0
+#define FETCH_REVALIDATED 1
+#define FETCH_FAILED -1
+#define FETCH_NO_HOST -2      // 호스트 이름을 못 찾았다 (open_clientfd가 -2)
+
+#define ORIGIN_TIMEOUT 10     // stale로 대신 답할 수 있을 때 원 서버를 기다리는 최대 시간 (초)
+#define REFRESH_THREADS 2
+#define REFRESH_QUEUE_MAX 64  // 백그라운드 refresh 대기열 상한
+#define WORKERS 32            // 미리 띄워두는 워커 쓰레드 수, 0이면 예전처럼 연결마다 쓰레드
+#define CLIENT_TIMEOUT 10     // 워커 풀일 때 클라이언트가 요청을 이 시간 (초) 안에 안 보내면 끊는다 - 쉬는 연결이 워커를 잡고 있지 않게
+#define HOP_PIN_SHARE 4       // 클러스터 노드의 keep-alive 연결은 워커 풀의 1/이만큼까지만 워커를 쥐고 기다린다
+#define NEGATIVE_TTL 5        // 에러 응답/연결 실패를 기억해두는 기본 시간 (초)
+#define VARY_MAX_VARIANTS 8   // URL 하나에 둘 수 있는 Vary 변형 수
+#define RANGE_BOUNDARY "proxy-byteranges" // multipart/byteranges 구분자
+#define STATS_BUF (4 * MAXBUF) // /stats 본문 - 클러스터 노드 64개 + sibling 16개까지 다 들어가게
+#define PRESSURE_INTERVAL 1   // --psi: 메모리 압박을 보는 간격 (초)
+#define PRESSURE_HIGH 90      // cgroup 한도의 이 %를 넘게 쓰고 있으면 PSI와 상관없이 줄인다
+#define PRESSURE_CALM 30      // 이만큼 (초) 조용하면 정해둔 크기 쪽으로 조금씩 되돌린다
 
 /* You won't lose style points for including this long line in your code */
 static const char *user_agent_hdr =
@@ -16,13 +45,79 @@ static const char *prox_conn_hdr = "Proxy-Connection: close\r\n";
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
 
 void do_proxy(int fd, cache_list* cache);
+int proxy_request(int connfd, rio_t* client_rio, cache_list* cache);
+int forward_owner(int connfd, cluster_node* node, char* hostname, cache_key* key, http_request* req);
 void check_validHeader(int fd, rio_t *rp, char* hostname);
 void parse_uri(char* uri, char* hostname, char* path, int* port);
-void make_header(char* http_header, char* hostname, char* path, rio_t* client_rio);
+void make_cache_key(char* key, size_t size, char* hostname, int port, char* path);
+void read_request_headers(rio_t* client_rio, http_request* req);
+void make_header(char* final_header, size_t size, char* hostname, char* path, http_request* req, char* validators);
+int make_validators(cache_object* obj, char* stored_hdr, char* out, size_t size);
+void refresh_meta(cache_list* cache, cache_object* obj, char* stored_hdr, http_info* fresh, time_t req_time);
 int connect_server(char* hostname, int port);
 void* start_thread(void *arg);
+void serve_local(int fd, char* uri, cache_list* cache);
+void serve_cached(int fd, cache_object* obj, http_request* req);
+int serve_range(int fd, cache_object* obj, http_request* req, char* hdr);
+static void serve_compressed(int fd, cache_object* obj, http_request* req, char* hdr);
+static ssize_t write_body(int fd, cache_object* obj, size_t off, size_t len);
+static int serve_encoded(int fd, cache_object* obj, cache_key* key, http_request* req);
+static cache_object* put_encoded(const char* id, cache_meta* meta, const char* hdr, int coding, uint64_t fp, const char* body, size_t len);
+int find_cached(cache_key* key, cache_object** out);
+int drop_banned(cache_object** obj);
+int variant_slot(cache_key* primary, uint64_t vary_hash, char* buf, size_t size, cache_key* out, cache_object** found);
+void make_variant_key(char* buf, size_t size, cache_key* primary, unsigned slot, cache_key* out);
+int fetch_origin(int connfd, char* hostname, int port, char* path, http_request* req, cache_key* key, cache_object* stale, peer* via);
+int fetch_upstream(int connfd, char* hostname, int port, char* path, http_request* req, cache_key* key, cache_object* stale);
+static int peer_has(const char* id);
+cache_object* put_negative(cache_key* key, int status, const char* reason, const char* msg);
+void schedule_refresh(cache_object* stale, char* hostname, int port, char* path, cache_key* key, http_request* req);
+void start_refreshers(int n);
+static void usage(char* prog);
+static size_t parse_size(char* arg);
+static int parse_partition(char* arg, cache_config* config);
+static void* signal_thread(void* arg);
+static void* admin_thread(void* arg);
+static void* worker_thread(void* arg);
+static void* pressure_thread(void* arg);
+static int read_size_file(const char* path, size_t* out);
+void do_admin(int fd);
 
 cache_list* cache = NULL; 
+disk_store* disk = NULL; /* --disk-dir를 주면 메모리 캐시 뒤에 붙는 디스크 L2 */
+snapshot_state* snapshot = NULL; /* --snapshot을 주면 종료할 때 캐시를 떠두고 다음에 뜰 때 다시 올린다 */
+shm_cache* shm = NULL; /* --shm을 주면 같은 이름을 쓰는 프록시 프로세스들끼리 캐시를 나눠 쓴다 */
+int default_ttl = HTTP_DEFAULT_TTL; /* 만료 정보가 없는 응답의 수명 */
+unsigned long http_uncacheable = 0, http_expired = 0; /* /stats 용 */
+unsigned long http_revalidated = 0, http_304_sent = 0;
+int default_swr = 0, default_sie = HTTP_DEFAULT_SIE; /* 원 서버가 안 정했을 때 stale을 써도 되는 기간 */
+int origin_timeout = ORIGIN_TIMEOUT; /* stale이 있을 때 원 서버 응답을 기다리는 시간 */
+unsigned long http_stale_served = 0, http_stale_if_error = 0, http_refreshes = 0, http_refresh_drops = 0;
+int range_fill = 1; /* Range 요청이 캐시에 없으면 뒤에서 통째로 받아둔다 */
+unsigned long http_range_hits = 0, http_range_fills = 0;
+unsigned long http_vary_hits = 0, http_vary_misses = 0;
+int negative_ttl = NEGATIVE_TTL; /* 에러 응답, 연결 실패를 기억해두는 시간 (0이면 안 함) */
+unsigned long http_negative_stored = 0, http_negative_hits = 0;
+ban_list* bans = NULL; /* --admin-port를 주면 PURGE/BAN을 받는다 */
+sbuf_t sbuf; /* main이 accept한 connfd를 워커들에게 */
+int l1_slots = L1_DEFAULT_SLOTS; /* 워커마다 두는 L1 자리 수, 0이면 안 씀 */
+int pool_workers = 0; /* 워커 풀 크기 (L1 예산도 이만큼 나눠 갖는다), 0이면 연결마다 쓰레드 */
+int hop_pinned = 0; /* 다음 hop 요청을 기다리며 클러스터 노드 연결에 묶여 있는 워커 수 */
+static __thread l1_table* my_l1 = NULL; /* 이 워커 쓰레드의 L1 (연결마다 쓰레드면 NULL) */
+int compress_level = 0; /* 캐시에 넣을 때 본문 gzip 레벨, 0이면 안 함 */
+unsigned long http_gzip_served = 0, http_inflated = 0;
+int encode_level = 0; /* 클라이언트에게 압축해서 보낼 때의 레벨 (br은 quality), 0이면 안 함 */
+unsigned long http_encoded_relays = 0, http_encoded_built = 0, http_encoded_hits = 0;
+int probe_timeout = PEER_PROBE_TIMEOUT; /* --sibling을 주면 miss 때 형제들 답을 기다리는 시간 (ms) */
+int peer_listen = 0; /* --peer-listen, 다른 프록시들의 UDP 질의에 답한다 (캐시에 뭐가 있는지 알려주는 거라 기본은 끔) */
+unsigned long http_only_if_cached_misses = 0;
+static __thread int resp_framed = 0; /* 방금 보낸 응답의 끝을 Content-Length로 알 수 있다 - 클러스터 노드 연결을 계속 쓸 수 있다 */
+unsigned long http_cluster_hops = 0;
+admit_filter* admission = NULL; /* --admit-window를 주면 처음 보는 키는 캐시에 안 넣는다 */
+size_t cache_target = 0; /* 관리자가 정한 캐시 크기 (RESIZE, SIGHUP) - 메모리 압박으로 줄였으면 풀린 뒤 여기로 돌아간다 */
+char* size_file = NULL; /* --cache-size-file, SIGHUP을 받으면 다시 읽는다 */
+double psi_threshold = 0; /* --psi, 메모리 PSI some avg10이 이 %를 넘으면 캐시를 줄인다 */
+unsigned long pressure_shrinks = 0, pressure_grows = 0;
 /* 
   Pt1. Sequential
   - GET처리
@@ -38,15 +133,249 @@ int main(int argc, char **argv) {
   socklen_t clientlen;
   struct sockaddr_storage clientaddr;
   // size_t tid_p = 0;
+  cache_config config = {
+    .policy = "lru",
+    .capacity = MAX_CACHE_SIZE,
+    .max_object = MAX_OBJECT_SIZE,
+    .max_large_object = MAX_LARGE_OBJECT_SIZE,
+    .large_share = LARGE_SHARE_PERCENT,
+    .dedup = 1,
+  };
+  char *disk_dir = NULL;
+  size_t disk_size = (size_t)1024 * 1024 * 1024;
+  char *snapshot_path = NULL;
+  int snapshot_interval = 0, snapshot_max_age = SNAPSHOT_MAX_AGE;
+  char *shm_name = NULL;
+  char *admin_port = NULL;
+  int workers = WORKERS;
+  size_t shm_size = SHM_DEFAULT_SIZE;
+  char *cluster_self_name = NULL;
+  int cluster_nodes = 0;
+  int numa_simulate = 0; /* 0이면 실제 토폴로지, N이면 노드 N개를 흉내낸다 */
+  int admit_window = 0;
+  unsigned long admit_keys = ADMIT_DEFAULT_KEYS;
+  char *admit_bypass[ADMIT_MAX_BYPASS];
+  int admit_nbypass = 0;
+  pressure_src psi_src;
+  int opt;
 
-  if (argc != 2) {
-    fprintf(stderr, "Usage: %s <port>\n", argv[0]);
-    exit(1);
+  static struct option long_opts[] = {
+    {"policy", required_argument, NULL, 'e'},
+    {"cache-size", required_argument, NULL, 'c'},
+    {"max-object", required_argument, NULL, 'o'},
+    {"max-large-object", required_argument, NULL, 'l'},
+    {"large-share", required_argument, NULL, 's'},
+    {"disk-dir", required_argument, NULL, 'd'},
+    {"disk-size", required_argument, NULL, 'D'},
+    {"snapshot", required_argument, NULL, 'S'},
+    {"snapshot-interval", required_argument, NULL, 'i'},
+    {"snapshot-max-age", required_argument, NULL, 'a'},
+    {"shm", required_argument, NULL, 'm'},
+    {"shm-size", required_argument, NULL, 'M'},
+    {"default-ttl", required_argument, NULL, 't'},
+    {"stale-while-revalidate", required_argument, NULL, 'w'},
+    {"stale-if-error", required_argument, NULL, 'E'},
+    {"origin-timeout", required_argument, NULL, 'T'},
+    {"range-fill", required_argument, NULL, 'R'},
+    {"negative-ttl", required_argument, NULL, 'n'},
+    {"admin-port", required_argument, NULL, 'A'},
+    {"workers", required_argument, NULL, 'W'},
+    {"l1-slots", required_argument, NULL, 'L'},
+    {"compress", required_argument, NULL, 'z'},
+    {"dedup", required_argument, NULL, 'u'},
+    {"encode", required_argument, NULL, 'x'},
+    {"partition", required_argument, NULL, 'P'},
+    {"parent", required_argument, NULL, 'p'},
+    {"sibling", required_argument, NULL, 'b'},
+    {"peer-listen", no_argument, NULL, 'I'},
+    {"probe-timeout", required_argument, NULL, 'y'},
+    {"cluster", required_argument, NULL, 'k'},
+    {"cluster-self", required_argument, NULL, 'K'},
+    {"huge-pages", required_argument, NULL, 'H'},
+    {"numa", required_argument, NULL, 'N'},
+    {"numa-replicate", required_argument, NULL, 'r'},
+    {"admit-window", required_argument, NULL, 'g'},
+    {"admit-keys", required_argument, NULL, 'G'},
+    {"admit-bypass", required_argument, NULL, 'B'},
+    {"cache-max", required_argument, NULL, 'C'},
+    {"cache-size-file", required_argument, NULL, 'F'},
+    {"psi", required_argument, NULL, 'Q'},
+    {NULL, 0, NULL, 0}
+  };
+
+  while ((opt = getopt_long(argc, argv, "e:c:o:l:s:d:D:S:i:a:m:M:t:w:E:T:R:n:A:W:L:z:u:x:P:p:b:y:k:K:H:N:r:g:G:B:C:F:Q:I", long_opts, NULL)) != -1) {
+    switch (opt) {
+    case 'e':
+      config.policy = optarg;
+      break;
+    case 'c':
+      config.capacity = parse_size(optarg);
+      break;
+    case 'o':
+      config.max_object = parse_size(optarg);
+      break;
+    case 'l':
+      config.max_large_object = parse_size(optarg);
+      break;
+    case 's':
+      config.large_share = atoi(optarg);
+      if (config.large_share < 0 || config.large_share > 100)
+        usage(argv[0]);
+      break;
+    case 'd':
+      disk_dir = optarg;
+      break;
+    case 'D':
+      disk_size = parse_size(optarg);
+      break;
+    case 'S':
+      snapshot_path = optarg;
+      break;
+    case 'i':
+      snapshot_interval = atoi(optarg);
+      break;
+    case 'a':
+      snapshot_max_age = atoi(optarg);
+      break;
+    case 'm':
+      shm_name = optarg;
+      break;
+    case 'M':
+      shm_size = parse_size(optarg);
+      break;
+    case 't':
+      default_ttl = atoi(optarg);
+      break;
+    case 'w':
+      default_swr = atoi(optarg);
+      break;
+    case 'E':
+      default_sie = atoi(optarg);
+      break;
+    case 'T':
+      origin_timeout = atoi(optarg);
+      if (origin_timeout <= 0)
+        usage(argv[0]);
+      break;
+    case 'R':
+      range_fill = atoi(optarg);
+      break;
+    case 'n':
+      negative_ttl = atoi(optarg);
+      break;
+    case 'A':
+      admin_port = optarg;
+      break;
+    case 'W':
+      workers = atoi(optarg);
+      if (workers < 0)
+        usage(argv[0]);
+      break;
+    case 'L':
+      l1_slots = atoi(optarg);
+      break;
+    case 'P':
+      if (parse_partition(optarg, &config) < 0)
+        usage(argv[0]);
+      break;
+    case 'p':
+      if (peer_set_parent(optarg) < 0)
+        usage(argv[0]);
+      break;
+    case 'b':
+      if (peer_add_sibling(optarg) < 0)
+        usage(argv[0]);
+      break;
+    case 'I':
+      peer_listen = 1;
+      break;
+    case 'y':
+      probe_timeout = atoi(optarg);
+      if (probe_timeout <= 0)
+        usage(argv[0]);
+      break;
+    case 'k':
+      if (cluster_add(optarg) < 0)
+        usage(argv[0]);
+      cluster_nodes++;
+      break;
+    case 'K':
+      cluster_self_name = optarg;
+      break;
+    case 'H':
+      config.huge_pages = atoi(optarg);
+      break;
+    case 'N':
+      if (strcmp(optarg, "auto") && (numa_simulate = atoi(optarg)) <= 0)
+        usage(argv[0]);
+      break;
+    case 'r':
+      config.numa_replicate = atoi(optarg);
+      break;
+    case 'g':
+      admit_window = atoi(optarg);
+      if (admit_window < 0)
+        usage(argv[0]);
+      break;
+    case 'G':
+      admit_keys = parse_size(optarg);
+      break;
+    case 'B':
+      if (admit_nbypass >= ADMIT_MAX_BYPASS)
+        usage(argv[0]);
+      admit_bypass[admit_nbypass++] = optarg;
+      break;
+    case 'C':
+      config.max_capacity = parse_size(optarg);
+      break;
+    case 'F':
+      size_file = optarg;
+      break;
+    case 'Q':
+      psi_threshold = atof(optarg);
+      if (psi_threshold <= 0 || psi_threshold > 100)
+        usage(argv[0]);
+      break;
+    case 'x':
+      encode_level = atoi(optarg);
+      if (encode_level < 0 || encode_level > 9)
+        usage(argv[0]);
+      break;
+    case 'u':
+      config.dedup = atoi(optarg);
+      break;
+    case 'z':
+      compress_level = atoi(optarg);
+      if (compress_level < 0 || compress_level > 9)
+        usage(argv[0]);
+      break;
+    default:
+      usage(argv[0]);
+    }
   }
 
+  if (optind != argc - 1)
+    usage(argv[0]);
+  if (size_file != NULL && read_size_file(size_file, &config.capacity) < 0) // 파일이 있으면 --cache-size보다 먼저
+    fprintf(stderr, "Cannot read cache size from %s, using %zu\n", size_file, config.capacity);
+
   Signal(SIGPIPE, SIG_IGN); // 프로세스가 닫히거나, 끊긴 파이프에 쓰기 요청을 할 경우 발생하는 오류인 SIGPIPE를 무시하고 서버를 계속 동작
 
-  listenfd = Open_listenfd(argv[1]);
+  if (snapshot_path != NULL || size_file != NULL) {
+    sigset_t mask;
+    pthread_t sig_tid;
+
+    /* SIGTERM/SIGINT/SIGHUP은 전용 쓰레드가 sigwait으로 받는다 - 핸들러 안에서는 스냅샷을 쓰거나 캐시 락을 잡을 수 없으니까
+       쓰레드를 하나라도 만들기 전에 막아둬야 이후 쓰레드들이 전부 이 마스크를 물려받는다 */
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGTERM);
+    Sigaddset(&mask, SIGINT);
+    Sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    Pthread_create(&sig_tid, NULL, signal_thread, NULL);
+  }
+
+  listenfd = Open_listenfd(argv[optind]);
 
   /* Pt2. Dealing with concurrent request 
     - 여러 요청을 동시에 처리할 수 있어야 함
@@ -73,7 +402,136 @@ int main(int argc, char **argv) {
     - 한 쓰레드만이 캐시에 write 할 수 있다
     => partitioning, readers-writers-lock, semaphore 등을 고려해라
  */
-  cache = init_cache(); /* 캐시: connection에서 쓸 캐시를 만듬 */
+  config.numa_nodes = numa_init(numa_simulate); /* 노드마다 캐시 영역 하나 */
+  cache = init_cache(&config); /* 캐시: connection에서 쓸 캐시를 만듬 */
+  if (cache == NULL) {
+    fprintf(stderr, "Unknown cache policy: %s (choose one of %s)\n", config.policy, POLICY_NAMES);
+    exit(1);
+  }
+  cache_target = cache->limit;
+  printf("Cache policy: %s, %zu bytes (objects up to %zu inline, up to %zu in chunks)\n",
+         cache->parts[0].policy->name, cache->limit, config.max_object, config.max_large_object);
+  if (cache->capacity > cache->limit)
+    printf("Cache can grow to %zu bytes (RESIZE on the admin port%s)\n", cache->capacity,
+           size_file != NULL ? ", SIGHUP rereads the size file" : "");
+  if (config.huge_pages) { /* 영역은 이미 다 건드려놨다 - 지금 붙어있는 게 실제로 받은 것 */
+    size_t huge = 0, mapped = 0;
+    int i;
+    for (i = 0; i < cache->narenas; i++) {
+      huge += slab_huge_bytes(cache->arenas[i]);
+      mapped += cache->arenas[i]->map_size;
+    }
+    if (cache->arenas[0]->huge == SLAB_HUGE_TLB)
+      printf("Huge pages: %zu x 2MB (MAP_HUGETLB)\n", huge / SLAB_HUGE_PAGE_SIZE);
+    else if (cache->arenas[0]->huge == SLAB_HUGE_THP)
+      printf("Huge pages: transparent, %zu of %zu bytes backed\n", huge, mapped);
+    else
+      printf("Huge pages: not available, using normal pages\n");
+  }
+  if (cache->narenas > 1) {
+    char cpus[MAXLINE];
+    int i;
+    printf("NUMA: %d nodes%s, replicate after %u remote hits%s\n", cache->narenas,
+           numa_simulated() ? " (simulated)" : "", config.numa_replicate, config.numa_replicate ? "" : " (off)");
+    for (i = 0; i < cache->narenas; i++) {
+      numa_node_cpus(i, cpus, sizeof(cpus));
+      printf("  node %d: cpus %s, %zu bytes%s\n", i, cpus, cache->arenas[i]->size,
+             cache->arenas[i]->node < 0 ? " (memory not bound)" : "");
+    }
+  }
+
+  if (admit_window > 0) { /* 한 번만 오고 마는 URL이 쓸모 있는 객체를 쫓아내지 않게 */
+    int i;
+    admission = admit_create(admit_keys, admit_window);
+    for (i = 0; i < admit_nbypass; i++)
+      admit_add_bypass(admission, admit_bypass[i]);
+    printf("Admission: second request within %d s (%lu keys, %zu bits per filter), %d bypass prefixes\n",
+           admit_window, admission->keys, admission->nbits, admission->nbypass);
+  }
+
+  if (disk_dir != NULL) {
+    if ((disk = disk_open(disk_dir, disk_size, cache)) == NULL)
+      exit(1);
+    printf("Disk cache: %s, %d segments of %zu bytes\n", disk_dir, disk->nsegs, disk->seg_size);
+  }
+
+  if (shm_name != NULL) {
+    if ((shm = shm_attach(shm_name, shm_size, cache)) == NULL)
+      exit(1);
+    printf("Shared cache: %s, %llu bytes\n", shm_name, (unsigned long long)shm->hdr->data_size);
+  }
+
+  if (snapshot_path != NULL) {
+    struct timeval t0, t1;
+    int loaded;
+
+    gettimeofday(&t0, NULL);
+    snapshot = snapshot_init(snapshot_path, snapshot_interval, snapshot_max_age, cache);
+    loaded = snapshot_load(snapshot);
+    gettimeofday(&t1, NULL);
+    if (loaded >= 0)
+      printf("Snapshot: loaded %d objects from %s in %.2f ms\n", loaded, snapshot_path,
+             (t1.tv_sec - t0.tv_sec) * 1000.0 + (t1.tv_usec - t0.tv_usec) / 1000.0);
+  }
+
+  start_refreshers(REFRESH_THREADS); /* stale-while-revalidate 재검증은 뒤에서 */
+
+  if (psi_threshold > 0) { /* OOM killer보다 먼저 캐시를 줄인다 */
+    pthread_t psi_tid;
+    if (pressure_open(&psi_src) < 0) {
+      fprintf(stderr, "No memory pressure information (PSI or cgroup memory), --psi ignored\n");
+    } else {
+      Pthread_create(&psi_tid, NULL, pressure_thread, &psi_src);
+      printf("Memory pressure: shrink above %g%% (%s), usage %s\n", psi_threshold,
+             psi_src.psi[0] ? psi_src.psi : "no PSI", psi_src.usage[0] ? psi_src.usage : "unknown");
+    }
+  }
+
+  /* 다른 프록시들의 "이거 있어?" UDP 질의는 HTTP 포트와 같은 번호로 받는다
+     아무나 캐시 내용을 물어볼 수 있게 되니 --peer-listen을 줬을 때만 (다른 프록시의 형제로 쓰일 노드) */
+  if (peer_listen) {
+    peer_start_responder(argv[optind], peer_has);
+    printf("Peer queries: answering on UDP port %s\n", argv[optind]);
+  }
+  /* 클러스터: 이 노드의 이름은 다른 노드들이 --cluster에 적은 것과 같아야 링이 같게 나온다 */
+  if (cluster_nodes > 0) {
+    char self_name[MAXLINE];
+    if (cluster_self_name == NULL) {
+      snprintf(self_name, sizeof(self_name), "127.0.0.1:%s", argv[optind]);
+      cluster_self_name = self_name;
+    }
+    cluster_set_self(cluster_self_name);
+    if (!cluster_enabled())
+      usage(argv[0]);
+    printf("Cluster: %s, %d nodes\n", cluster_self(), cluster_nodes);
+  }
+  if (peer_count() > 0 || peer_parent() != NULL)
+    printf("Peers: %d siblings (probe timeout %d ms), parent %s%s%s\n", peer_count(), probe_timeout,
+           peer_parent() != NULL ? peer_parent()->host : "none", peer_parent() != NULL ? ":" : "",
+           peer_parent() != NULL ? peer_parent()->port : "");
+
+  /* 워커 쓰레드 풀 (CS:APP 12.5.5) - 쓰레드가 계속 살아있어야 쓰레드별 L1이 의미가 있다
+     L1들이 다 합쳐서 캐시의 1/L1_CACHE_SHARE 넘게는 못 쥐게 (캐시 크기를 바꾸면 따라간다) */
+  if (workers > 0) {
+    int i;
+    pthread_t worker_tid;
+    sbuf_init(&sbuf, SBUF_SIZE);
+    pool_workers = workers;
+    for (i = 0; i < workers; i++) /* NUMA 노드에 돌아가며 - 워커 i는 노드 i % N */
+      Pthread_create(&worker_tid, NULL, worker_thread, (void*)(long)i);
+    printf("Workers: %d (L1 %d slots, %zu bytes each)\n", workers, l1_slots, l1_budget(cache, workers));
+  }
+
+  if (admin_port != NULL) { /* 관리용 포트는 따로 - 프록시 포트로는 PURGE/BAN을 못 보낸다 */
+    pthread_t admin_tid;
+    int* admin_fd = Malloc(sizeof(int));
+    *admin_fd = Open_listenfd(admin_port);
+    bans = ban_init();
+    if (snapshot != NULL)
+      snapshot->bans = bans;
+    Pthread_create(&admin_tid, NULL, admin_thread, admin_fd);
+    printf("Admin port: %s\n", admin_port);
+  }
 
   while (1) {
     pthread_t tid;
@@ -88,6 +546,12 @@ int main(int argc, char **argv) {
 
     printf("Accepted connection from (%s, %s)\n", hostname, port);
 
+    if (workers > 0) { // 워커들에게 넘긴다
+      sbuf_insert(&sbuf, *connfd);
+      Free(connfd);
+      continue;
+    }
+
    /* Pthread_create의 세번째 인자인 루틴함수는, void* 만을 인자로 받는다
       근데, 내가 start_thread를 
       Pthread_create(&tid, NULL, start_thread, connfd);
@@ -113,6 +577,28 @@ int main(int argc, char **argv) {
   }
 }
 
+/* 워커: 연결을 하나씩 꺼내서 처리, L1은 쓰레드가 사는 동안 계속 간다
+   노드가 여럿이면 자기 노드 CPU에서만 돌고, 캐시에 넣는 객체도 자기 노드 영역에 먼저 (L1도 이 노드 메모리에서) */
+static void* worker_thread(void* arg) {
+  int node = (long)arg % numa_nodes();
+
+  Pthread_detach(Pthread_self());
+  if (numa_nodes() > 1) {
+    numa_bind_thread(node);
+    cache_set_node(node);
+  }
+  if (l1_slots > 0)
+    my_l1 = l1_create(l1_slots, pool_workers);
+  while (1) {
+    int connfd = sbuf_remove(&sbuf);
+    struct timeval tv = { CLIENT_TIMEOUT, 0 };
+    setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)); // 요청을 안 보내는 연결 (preconnect 등)이 워커를 붙잡지 않게
+    do_proxy(connfd, cache);
+    Close(connfd);
+  }
+  return NULL;
+}
+
 // void* start_thread(void *arg, cache_list* cache) => 캐시 매번 초기화되는 선언 !
 void* start_thread(void *arg) {
   thread_args *args = (thread_args*)arg;
@@ -127,18 +613,40 @@ void* start_thread(void *arg) {
   return NULL;
 }
 
+/* 연결 하나: 보통은 요청 하나로 끝
+   클러스터의 다른 노드가 넘긴 요청이고 응답 끝을 Content-Length로 알려줬으면 그 노드가 연결을 다시 쓸 수 있게 다음 요청을 기다린다
+   워커 풀이면 기다리는 동안 워커가 묶이니 그런 연결은 풀의 1/HOP_PIN_SHARE까지만 - 넘으면 끊고, 보낸 쪽은 새 연결을 연다 */
 void do_proxy(int connfd, cache_list* cache) { // fd는 클라이언트와 수립된 descriptor
-  int serverFd; // 엔드서버로의 descriptor
+  rio_t client_rio;
+  int pinned = 0;
+
+  /* 2. Client로부터 request받기 */
+  Rio_readinitb(&client_rio, connfd); // rio 초기화
+  while (proxy_request(connfd, &client_rio, cache) && resp_framed) {
+    if (pool_workers > 0 && !pinned) {
+      if (__sync_add_and_fetch(&hop_pinned, 1) > pool_workers / HOP_PIN_SHARE) {
+        __sync_fetch_and_sub(&hop_pinned, 1);
+        break;
+      }
+      pinned = 1;
+    }
+  }
+  if (pinned)
+    __sync_fetch_and_sub(&hop_pinned, 1);
+}
+
+/* 요청 하나를 읽어서 답한다, 클러스터 노드가 넘긴 요청이면 1 */
+int proxy_request(int connfd, rio_t* client_rio, cache_list* cache) {
   char buf[MAXLINE] , method[MAXLINE], uri[MAXLINE], version[MAXLINE];
   char hostname[MAXLINE], path[MAXLINE];
+  char key_buf[MAXLINE * 2]; // uri가 MAXLINE 안이니 "http://"를 붙여도 안 잘린다
+  cache_key key;
   int port;
-  char server_header[MAXLINE]; // 서버에 전송할 헤더
-
-  rio_t client_rio, server_rio;
+  http_request req; // 클라이언트가 보낸 나머지 헤더들
 
-  /* 2. Client로부터 request받기 */
-  Rio_readinitb(&client_rio, connfd); // rio 초기화
-  Rio_readlineb(&client_rio, buf, MAXLINE); // buf에 rio의 값을 씀(클라이언트의 request)
+  resp_framed = 0;
+  if (rio_readlineb(client_rio, buf, MAXLINE) <= 0) // buf에 rio의 값을 씀(클라이언트의 request), keep-alive 연결이면 끊겼거나 쉬다 시간이 다 됐다
+    return 0;
 
   /* 요청 헤더에서 method, uri, version을 가져옴 */
   sscanf(buf, "%s %s %s", method, uri, version); 
@@ -146,85 +654,777 @@ void do_proxy(int connfd, cache_list* cache) { // fd는 클라이언트와 수
   /* GET 아닌 메소드에 대한 에러메시지 */
   if (strcasecmp(method, "GET")) { // 대소문자 구분X 스트링 비교
     clienterror(connfd, method, "501", "Not Implemented", "Proxy only supports GET method");
-    return;
+    return 0;
+  }
+
+  /* 프록시 자기 자신한테 온 요청 (origin-form, "GET /stats") - 프록시 요청은 항상 http://host/... 꼴이다 */
+  if (uri[0] == '/') {
+    serve_local(connfd, uri, cache);
+    return 0;
   }
 
   /* 프록시에서 서버로 보낼 정보 파싱 - uri에서 hostname, path, port를 꺼내서 채운다 */
   parse_uri(uri, hostname, path, &port);
-  printf("호스트 : %s\n", hostname);
-  printf("패스 : %s\n", path);
-  printf("포트 : %d\n", port);
 
-  /* 캐시: 캐시에 값이 있으면 그거를 그대로 돌려주면 된다 */
-  if (cache->start != NULL) {
-    printf("캐시 %c\n", cache->start->id);
+  /* 나머지 요청 헤더는 캐시를 보기 전에 다 읽는다 - 조건부 요청이면 캐시로 바로 304를 줄 수 있으니까 */
+  read_request_headers(client_rio, &req);
+
+  /* 캐시 키는 path만이 아니라 절대 URL - 해시는 여기서 한 번 구해서 끝까지 들고 간다 */
+  make_cache_key(key_buf, sizeof(key_buf), hostname, port, path);
+  cache_key_init(&key, key_buf);
+
+  /* 클러스터: 키의 주인이 다른 노드면 그 노드에게 넘기고 이 노드는 캐시하지 않는다
+     넘겨받은 요청은 (멤버 목록이 잠깐 서로 달라도) 다시 넘기지 않고 내가 주인인 걸로 처리한다
+     주인이 죽었으면 이번 것만 직접 처리 */
+  if (req.hop) {
+    struct timeval tv = { CLUSTER_IDLE_TIMEOUT, 0 };
+    setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)); // 다음 요청을 마냥 기다리며 워커를 잡고 있지 않게
+    __sync_fetch_and_add(&http_cluster_hops, 1);
+  } else if (cluster_enabled()) {
+    cluster_node* owner = cluster_owner(key.hash);
+    if (owner != NULL && forward_owner(connfd, owner, hostname, &key, &req) == FETCH_DONE)
+      return 0;
+  }
+
+  /* 캐시: 캐시에 값이 있으면 그거를 그대로 돌려주면 된다
+     객체는 참조를 잡은 채로 받아오니까 락 없이 (큰 객체는 청크 단위로) 바로 써도 된다 */
+  /* 이 워커의 L1에 있으면 공유 캐시는 아예 안 본다 (락, refcnt, 정책 모두 안 건드림)
+     만료됐거나 새 ban이 생겼으면 아래 공유 캐시 경로로 */
+  if (my_l1 != NULL) {
+    cache_object* hot;
+    l1_sweep(my_l1, cache);
+    hot = l1_lookup(my_l1, cache, &key);
+    if (hot != NULL && !(hot->meta.flags & CACHE_META_VARY) && http_is_fresh(&hot->meta, time(NULL))
+        && (bans == NULL || hot->ban_checked == bans->seq)) {
+      hot = cache_local(cache, hot); // 다른 노드 메모리에 있으면 이 노드의 복제본으로
+      if (!serve_encoded(connfd, hot, &key, &req))
+        serve_cached(connfd, hot, &req); // L1이 참조를 쥐고 있다 - release 안 함
+      return req.hop;
+    }
+  }
+
+  cache_object* obj;
+  cache_key* lkey = &key; // 실제로 찾은 키 - Vary면 변형 키
+  int claimed = find_cached(&key, &obj);
+
+  /* Vary가 붙는 URL이면 URL 자리에는 어떤 요청 헤더로 나뉘는지만 적힌 표시 객체가 있다
+     그 헤더 값들로 변형 키를 만들어서 해시 인덱스를 한 번 더 찾는다 (리스트를 훑지 않는다) */
+  char vkey_buf[MAXLINE * 2 + 32];
+  cache_key vkey;
+  if (obj != NULL && (obj->meta.flags & CACHE_META_VARY)) {
+    char names[MAXLINE];
+    size_t n = cache_object_read(obj, 0, names, obj->length < MAXLINE ? obj->length : MAXLINE - 1);
+    uint64_t vary_hash;
+
+    names[n] = '\0';
+    cache_release(cache, obj);
+    vary_hash = http_vary_hash(&req, names);
+    lkey = &vkey;
+    if (variant_slot(&key, vary_hash, vkey_buf, sizeof(vkey_buf), &vkey, &obj) < 0) {
+      /* 메모리에 없으면 고른 자리로 디스크/공유 캐시를 본다 */
+      claimed = find_cached(lkey, &obj);
+      if (obj != NULL && obj->meta.vary_hash != vary_hash) { // 같은 자리를 쓰는 다른 변형
+        cache_release(cache, obj);
+        obj = NULL;
+      }
+    }
+    __sync_fetch_and_add(obj != NULL ? &http_vary_hits : &http_vary_misses, 1);
+  }
+
+  if (obj != NULL && http_is_fresh(&obj->meta, time(NULL))) {
+    cache_object* local;
+    if (obj->meta.flags & CACHE_META_NEGATIVE)
+      __sync_fetch_and_add(&http_negative_hits, 1);
+    if (my_l1 != NULL && lkey == &key)
+      l1_admit(my_l1, cache, obj);
+    local = cache_local(cache, obj); // 복제본이면 원본 참조를 쥔 동안만 - release는 원본으로
+    if (!serve_encoded(connfd, local, lkey, &req))
+      serve_cached(connfd, local, &req);
+    cache_release(cache, obj);
+    if (claimed)
+      shm_unclaim(shm, lkey);
+
+    return req.hop; // 밑의 과정 안해도 된다
+  }
+
+  /* only-if-cached (형제 프록시가 보낸다): fresh한 게 없으면 원 서버로 가지 않고 504 */
+  if (req.only_if_cached) {
+    __sync_fetch_and_add(&http_only_if_cached_misses, 1);
+    clienterror(connfd, uri, "504", "Gateway Timeout", "Proxy has no fresh copy in cache");
+    if (obj != NULL)
+      cache_release(cache, obj);
+    if (claimed)
+      shm_unclaim(shm, lkey);
+    return req.hop;
+  }
+
+  /* 만료된 객체도 바로 버리지 않는다
+     - stale-while-revalidate 기간이면 일단 그걸로 바로 답하고 재검증은 백그라운드 refresher에게
+     - 아니면 원 서버에 (검증자가 있으면 조건부로) 물어보고, 304면 본문은 다시 안 받고 메타데이터만 고친다
+     - 원 서버가 죽었거나 느리거나 5xx면 stale-if-error 기간 안에서는 갖고 있던 걸로 답한다 */
+  cache_object* stale = obj;
+  if (stale != NULL) {
+    time_t now = time(NULL);
+    __sync_fetch_and_add(&http_expired, 1);
+    if (http_stale_ok(&stale->meta, now, stale->meta.swr)) {
+      __sync_fetch_and_add(&http_stale_served, 1);
+      serve_cached(connfd, stale, &req);
+      schedule_refresh(stale, hostname, port, path, &key, &req);
+      cache_release(cache, stale);
+      if (claimed)
+        shm_unclaim(shm, lkey);
+      return req.hop;
+    }
+  }
+
+  /* 영상 탐색 같은 Range 요청이 캐시에 없으면 이번 것만 원 서버로 넘기고, 통째로는 뒤에서 한 번 받아둔다
+     그 다음 탐색부터는 원 서버까지 안 간다 */
+  if (stale == NULL && req.range[0] != '\0' && range_fill)
+    schedule_refresh(NULL, hostname, port, path, &key, &req);
+
+  int ret = fetch_upstream(connfd, hostname, port, path, &req, &key, stale);
+  if (ret == FETCH_REVALIDATED) {
+    serve_cached(connfd, stale, &req); // 안 바뀌었다 - 갖고 있던 본문으로 답한다
+  } else if (ret < 0) {
+    if (stale != NULL && http_stale_ok(&stale->meta, time(NULL), stale->meta.sie)) {
+      __sync_fetch_and_add(&http_stale_if_error, 1);
+      serve_cached(connfd, stale, &req);
+    } else {
+      /* 원 서버에 못 닿았다 - 바로 다시 와도 또 연결부터 기다리지 않게 짧게 기억해둔다 */
+      cache_object* neg = put_negative(&key, 502, "Bad Gateway", ret == FETCH_NO_HOST ? "Proxy could not resolve the host"
+                                                                                   : "Proxy could not get a response from the server");
+      if (neg != NULL) {
+        serve_cached(connfd, neg, &req);
+        cache_release(cache, neg);
+      } else {
+        clienterror(connfd, hostname, "502", "Bad Gateway", "Proxy could not get a response from the server");
+      }
+    }
+  }
+  if (stale != NULL)
+    cache_release(cache, stale);
+  if (claimed)
+    shm_unclaim(shm, lkey);
+  return req.hop;
+}
+
+/* 형제 프록시의 UDP 질의: 메모리에 fresh한 (에러 응답이 아닌) 게 있나
+   디스크/공유 캐시까지는 안 본다, 새 ban을 아직 확인 안 한 객체도 없다고 한다 (L1과 같은 기준) */
+static int peer_has(const char* id)
+{
+  cache_key key;
+  cache_object* obj;
+  int has;
+
+  cache_key_init(&key, id);
+  if ((obj = cache_peek(cache, &key)) == NULL)
+    return 0;
+  has = !(obj->meta.flags & CACHE_META_NEGATIVE) && http_is_fresh(&obj->meta, time(NULL))
+        && (bans == NULL || obj->ban_checked == bans->seq);
+  cache_release(cache, obj);
+  return has;
+}
+
+/* 메모리 -> 디스크 -> 공유 캐시 순으로 찾는다, 찾으면 참조를 잡아서 *out에
+   공유 캐시에도 없으면 다른 프로세스가 이미 원 서버에서 받는 중인지 보고, 그러면 같이 받으러 가지 않고 들어올 때까지 기다린다
+   이 프로세스가 받으러 가게 됐으면 (claim) 1 - 끝나면 shm_unclaim */
+int find_cached(cache_key* key, cache_object** out)
+{
+  int claimed = 0;
+
+  *out = cache_lookup(cache, key);
+  drop_banned(out);
+  if (*out == NULL && disk != NULL) { // 메모리에 없으면 디스크에서 올려본다
+    disk_promote(disk, key, out);
+    drop_banned(out);
+  }
+  if (*out == NULL && shm != NULL && (shm_promote(shm, key, out) < 0 || drop_banned(out))) {
+    claimed = shm_claim(shm, key);
+    if (!claimed && (shm_wait(shm, key, out) < 0 || drop_banned(out)))
+      claimed = shm_claim(shm, key);
+  }
+  return claimed;
+}
+
+/* 찾은 객체가 그 뒤에 걸린 ban (PURGE, prefix, regex)에 걸리면 캐시에서 빼고 *obj를 NULL로, 그러면 1
+   새 ban이 없으면 번호 비교 한 번으로 끝난다 */
+int drop_banned(cache_object** obj)
+{
+  if (bans == NULL || *obj == NULL || !ban_check(bans, (*obj)->id, (*obj)->meta.resp_time, &(*obj)->ban_checked))
+    return 0;
+  cache_remove(cache, *obj);
+  cache_release(cache, *obj);
+  *obj = NULL;
+  return 1;
+}
+
+/* URL 키 뒤에 변형 자리 번호를 붙인다 - 한 URL에 변형은 VARY_MAX_VARIANTS개까지 */
+void make_variant_key(char* buf, size_t size, cache_key* primary, unsigned slot, cache_key* out)
+{
+  snprintf(buf, size, "%s#vary=%u", primary->id, slot);
+  cache_key_init(out, buf);
+}
+
+/* vary_hash의 변형 자리를 고른다 - vary_hash % VARY_MAX_VARIANTS부터 열린 주소법으로
+   자리마다 해시 인덱스를 한 번씩 볼 뿐이고, 보통은 첫 자리에서 끝난다
+   메모리에 같은 변형이 있으면 참조를 잡아 *found에 넣고 0, 아니면 넣을 자리 (빈 자리, 다 찼으면 첫 자리)를 out에 두고 -1 */
+int variant_slot(cache_key* primary, uint64_t vary_hash, char* buf, size_t size, cache_key* out, cache_object** found)
+{
+  unsigned home = vary_hash % VARY_MAX_VARIANTS, i;
+  cache_object* obj;
+
+  *found = NULL;
+  for (i = 0; i < VARY_MAX_VARIANTS; i++) {
+    make_variant_key(buf, size, primary, (home + i) % VARY_MAX_VARIANTS, out);
+    obj = cache_lookup(cache, out);
+    if (drop_banned(&obj) || obj == NULL)
+      return -1;
+    if (obj->meta.vary_hash == vary_hash) {
+      *found = obj;
+      return 0;
+    }
+    cache_release(cache, obj);
+  }
+  make_variant_key(buf, size, primary, home, out); // 다 찼다 - 첫 자리의 변형을 밀어낸다
+  return -1;
+}
+
+/* URL 자리에 Vary 표시 객체를 넣는다 (본문은 헤더 이름 목록), 이미 같은 게 있으면 그대로 */
+static void put_vary_marker(cache_key* key, char* names)
+{
+  cache_object* obj = cache_lookup(cache, key);
+  cache_fill fill;
+  size_t len = strlen(names);
+
+  if (obj != NULL) {
+    char old[MAXLINE];
+    int same = (obj->meta.flags & CACHE_META_VARY) && obj->length == len
+               && cache_object_read(obj, 0, old, len) == len && !memcmp(old, names, len);
+    cache_release(cache, obj);
+    if (same)
+      return;
   }
-  else {
-    printf("없음\n");
+  obj = NULL;
+  cache_fill_begin(&fill, cache, key);
+  fill.ban_checked = bans != NULL ? bans->seq : 0;
+  fill.meta.resp_time = fill.meta.date = time(NULL);
+  fill.meta.flags = CACHE_META_VARY;
+  fill.meta.last_modified = -1;
+  cache_fill_append(&fill, names, len);
+  cache_fill_commit(&fill, shm != NULL ? &obj : NULL);
+  if (obj != NULL) {
+    shm_put(shm, obj);
+    cache_release(cache, obj);
   }
+}
+
+/* 에러 응답을 짧은 합성 응답으로 캐시에 넣는다 (negative caching), 넣은 객체의 참조를 돌려준다
+   원 서버의 에러 페이지를 통째로 들고 있을 필요는 없다 - 상태 코드만 맞으면 된다
+   URL 자리에 Vary 표시가 있으면 안 넣는다 - 덮어쓰면 멀쩡한 변형들까지 다 못 찾게 된다 */
+cache_object* put_negative(cache_key* key, int status, const char* reason, const char* msg)
+{
+  char resp[MAXLINE];
+  cache_object* obj = NULL;
+  cache_fill fill;
+  time_t now = time(NULL);
+  int hdr_len, body_len, vary;
+
+  if (negative_ttl <= 0)
+    return NULL;
+  if ((obj = cache_lookup(cache, key)) != NULL) {
+    vary = obj->meta.flags & CACHE_META_VARY;
+    cache_release(cache, obj);
+    obj = NULL;
+    if (vary)
+      return NULL;
+  }
+  body_len = strlen(msg) + 1;
+  hdr_len = snprintf(resp, sizeof(resp), "HTTP/1.0 %d %s\r\n"
+                                         "Content-Type: text/plain\r\n"
+                                         "Content-Length: %d\r\n"
+                                         "Cache-Control: max-age=%d\r\n\r\n", status, reason, body_len, negative_ttl);
+  if (hdr_len + body_len >= (int)sizeof(resp))
+    return NULL;
+  sprintf(resp + hdr_len, "%s\n", msg);
+
+  cache_fill_begin(&fill, cache, key);
+  fill.ban_checked = bans != NULL ? bans->seq : 0;
+  fill.meta.resp_time = fill.meta.date = now;
+  fill.meta.lifetime = negative_ttl;
+  fill.meta.hdr_len = hdr_len;
+  fill.meta.status = status;
+  fill.meta.last_modified = -1;
+  fill.meta.flags = CACHE_META_NEGATIVE;
+  cache_fill_append(&fill, resp, hdr_len + body_len);
+  if (cache_fill_commit(&fill, &obj) < 0)
+    return NULL;
+  __sync_fetch_and_add(&http_negative_stored, 1);
+  if (shm != NULL)
+    shm_put(shm, obj);
+  return obj;
+}
 
-  char obj_data[100000];
-  unsigned int size;
-  if (search_cache(cache, path, (void*)obj_data, &size) == 0) {
-    Rio_writen(connfd, (void*)obj_data, size);
+/* 클러스터에서 키의 주인 노드에게 넘기고 답을 그대로 흘려보낸다 (이 노드는 캐시하지 않는다)
+   조건부 헤더와 Range도 같이 넘긴다 - 주인의 캐시가 직접 304/206으로 답한다
+   응답 끝을 Content-Length로 알 수 있었으면 연결은 풀로 돌려준다
+   풀에서 꺼낸 연결이 그 사이 끊겨 있었으면 다음 것으로 (마지막엔 새로 붙어서) 다시
+   주인에게서 아무것도 못 받았으면 FETCH_FAILED - 클라이언트에게는 아직 아무것도 안 보냈다 */
+int forward_owner(int connfd, cluster_node* node, char* hostname, cache_key* key, http_request* req)
+{
+  char request[MAXBUF * 2], cond[MAXBUF], date[64], buf[MAXLINE], hdr[MAXBUF];
+  size_t hdr_len, len;
+  ssize_t n;
+  long left;
+  int fd, reused, done, client_ok;
+  http_info info;
+  rio_t rio;
 
-    return; // 밑의 과정 안해도 된다
-  } 
+  len = 0;
+  cond[0] = '\0';
+  if (req->if_none_match[0] != '\0')
+    len += snprintf(cond + len, sizeof(cond) - len, "If-None-Match: %s\r\n", req->if_none_match);
+  if (req->if_modified_since >= 0 && http_format_date(req->if_modified_since, date, sizeof(date)) > 0)
+    len += snprintf(cond + len, sizeof(cond) - len, "If-Modified-Since: %s\r\n", date);
+  if (req->range[0] != '\0')
+    len += snprintf(cond + len, sizeof(cond) - len, "Range: %s\r\n", req->range);
+  if (req->if_range[0] != '\0')
+    len += snprintf(cond + len, sizeof(cond) - len, "If-Range: %s\r\n", req->if_range);
+  len = snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\nHost: %s\r\n%sConnection: keep-alive\r\nX-Cluster-Hop: %s\r\n%s%s\r\n",
+                 key->id, hostname, user_agent_hdr, cluster_self(), req->headers, cond);
+  if (len >= sizeof(request))
+    return FETCH_FAILED;
+
+  while (1) {
+    if ((fd = cluster_connect(node, &reused)) < 0)
+      return FETCH_FAILED;
+    hdr_len = 0;
+    done = 0;
+    if (rio_writen(fd, request, len) == (ssize_t)len) {
+      Rio_readinitb(&rio, fd);
+      while ((n = rio_readlineb(&rio, buf, MAXLINE)) > 0 && hdr_len + n <= sizeof(hdr)) {
+        memcpy(hdr + hdr_len, buf, n);
+        hdr_len += n;
+        if (!strcmp(buf, "\r\n") || !strcmp(buf, "\n")) {
+          done = 1;
+          break;
+        }
+      }
+    }
+    if (done && http_parse_response(hdr, hdr_len, &info) == 0)
+      break;
+    cluster_release(node, fd, 0);
+    if (!reused || hdr_len > 0) { // 새 연결로도 안 되거나 답이 이상하다
+      __sync_fetch_and_add(&node->failures, 1);
+      return FETCH_FAILED;
+    }
+  }
+
+  /* 본문 길이: 304, 204, 1xx는 없고, 아니면 Content-Length, 그것도 없으면 주인이 끊을 때까지 (그럼 연결은 못 쓴다) */
+  if (info.status == 304 || info.status == 204 || info.status < 200)
+    left = 0;
+  else
+    left = info.content_length;
+  client_ok = rio_writen(connfd, hdr, hdr_len) == (ssize_t)hdr_len;
+  while (left != 0 && (n = rio_readnb(&rio, buf, left < 0 || left > MAXLINE ? MAXLINE : left)) > 0) {
+    if (client_ok && rio_writen(connfd, buf, n) != n)
+      client_ok = 0; // 클라이언트가 끊겨도 연결을 다시 쓸 수 있게 끝까지 읽는다
+    if (left > 0)
+      left -= n;
+  }
+  cluster_release(node, fd, left == 0);
+  return FETCH_DONE;
+}
+
+/* miss를 어디서 받아올지: 형제 -> 부모 -> 원 서버
+   형제에게는 stale도 Range도 없는 그냥 miss일 때만 UDP로 물어보고, 있다고 한 형제에게서 only-if-cached로 받는다
+   그 사이 형제 캐시에서 빠졌거나 (504) 연결이 안 되면 부모로, 부모도 안 되면 원 서버로 직접 */
+int fetch_upstream(int connfd, char* hostname, int port, char* path, http_request* req, cache_key* key, cache_object* stale)
+{
+  peer* p;
+  int ret;
+
+  if (stale == NULL && req->range[0] == '\0' && peer_count() > 0
+      && (p = peer_probe(key->id, probe_timeout)) != NULL) {
+    ret = fetch_origin(connfd, hostname, port, path, req, key, NULL, p);
+    peer_note_fetch(p, ret == FETCH_DONE);
+    if (ret == FETCH_DONE)
+      return ret;
+  }
+  if ((p = peer_parent()) != NULL) {
+    ret = fetch_origin(connfd, hostname, port, path, req, key, stale, p);
+    peer_note_fetch(p, ret >= 0);
+    if (ret >= 0)
+      return ret;
+  }
+  return fetch_origin(connfd, hostname, port, path, req, key, stale, NULL);
+}
+
+/* 원 서버에서 받아온다, connfd >= 0이면 클라이언트에게 흘려보내면서 캐시에 채운다 (백그라운드 refresh면 -1)
+   stale이 있으면 검증자로 조건부 요청을 보내고, 304면 stale의 메타데이터만 새로 고친다
+   via가 있으면 원 서버 대신 그 프록시에게 절대 URL로 요청한다 (부모, 또는 only-if-cached로 형제)
+   - FETCH_DONE: 응답을 다 넘겼다 (캐시할 수 있었으면 캐시도 했다)
+   - FETCH_REVALIDATED: 304, stale이 다시 fresh해졌다 - 클라이언트에게는 아직 아무것도 안 보냈다
+   - FETCH_FAILED: 연결 실패/타임아웃/(stale이 있을 때) 5xx - 클라이언트에게는 아직 아무것도 안 보냈다
+   - FETCH_NO_HOST: 호스트 이름을 못 찾았다 - 역시 아무것도 안 보냈다 */
+int fetch_origin(int connfd, char* hostname, int port, char* path, http_request* req, cache_key* key, cache_object* stale, peer* via)
+{
+  int serverFd; // 엔드서버로의 디스크립터
+  char buf[MAXLINE];
+  char server_header[MAXBUF * 2]; // 서버에 전송할 헤더
+  char stored_hdr[MAXBUF];
+  char validators[MAXBUF];
+  rio_t server_rio;
+
+  /* 요청을 보내기 전에 있던 ban들은 이 응답에 해당 없다 - 같은 초에 받았어도 다시 걸리지 않게 */
+  uint32_t ban_seq = bans != NULL ? bans->seq : 0;
+
+  int sibling = via != NULL && via != peer_parent();
+
+  validators[0] = '\0';
+  if (sibling)
+    strcpy(validators, "Cache-Control: only-if-cached\r\n"); // 형제는 자기 캐시로만 답한다, 없으면 504
+  else if (stale != NULL)
+    make_validators(stale, stored_hdr, validators, sizeof(validators));
+  else if (connfd >= 0 && req->range[0] != '\0') {
+    /* 캐시에 없으면 Range는 원 서버로 그대로 - 206은 캐시 못하니 릴레이만 (통째로는 do_proxy가 뒤에서 채운다) */
+    int n = snprintf(validators, sizeof(validators), "Range: %s\r\n", req->range);
+    if (req->if_range[0] != '\0')
+      snprintf(validators + n, sizeof(validators) - n, "If-Range: %s\r\n", req->if_range);
+  }
 
   /* 서버로 보낼 요청 헤더 생성 - hostname, path, port를 가지고 만든다 */
-  make_header(server_header, hostname, path,  &client_rio);
+  make_header(server_header, sizeof(server_header), hostname, via != NULL ? (char*)key->id : path, req, validators);
 
   /* 3. 웹서버와 Connection 설립 */
-  serverFd = connect_server(hostname, port);
-  
+  serverFd = via != NULL ? connect_server(via->host, atoi(via->port)) : connect_server(hostname, port);
+  if (serverFd < 0)
+    return serverFd == -2 ? FETCH_NO_HOST : FETCH_FAILED;
+
+  /* stale이 있으면 원 서버가 느릴 때 마냥 기다리지 않고 stale로 답할 수 있게 */
+  if (stale != NULL) {
+    struct timeval tv = { origin_timeout, 0 };
+    setsockopt(serverFd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+
   // 서버에 요청 헤더 전송
   Rio_readinitb(&server_rio, serverFd);
-  printf("server헤더 : %s\n", server_header);
 
-  Rio_writen(serverFd, server_header, strlen(server_header));
+  time_t req_time = time(NULL); // Age 보정용
+  if (rio_writen(serverFd, server_header, strlen(server_header)) < 0) {
+    Close(serverFd);
+    return FETCH_FAILED;
+  }
 
   // 서버로부터 응답을 받아 클라이언트에 전송
-  size_t n;
-  size_t all_size = 0;
-  char cache_buf[100000] = {0,}; /* 문제 해결 : malloc(size(100000)) 으로 했더니 이상한 값이(이전 메모리영역의 값) cache_buf에 들어가는 문제가..*/
-  
-  /* malloc을 사용하고자 했다면 이렇게 memset으로 메모리를 초기화했어야...
-      char *cache_buf = malloc(sizeof(char) * 100000);
-      if (cache_buf == NULL) {
-        // 메모리 할당에 실패한 경우의 처리
-      }
-      memset(cache_buf, 0, sizeof(char) * 100000);
-  */
+  /* 예전에는 cache_buf[100000]에 sprintf로 이어붙였는데, 바이너리(\0 포함)가 깨지고 100KB 넘는 건 캐시를 못 했다
+     이제는 받은 그대로 cache_fill에 넘기면 크기에 따라 슬롯 하나 또는 청크들로 채워진다 */
+  ssize_t n;
+  int client_ok = connfd >= 0;
+  cache_fill fill;
+  cache_fill_begin(&fill, cache, key);
+  fill.ban_checked = ban_seq;
+
+  /* 응답 헤더는 줄 단위로 모아서 한 번만 파싱한다 - 캐시해도 되는지, 언제까지 fresh한지
+     Age는 hit 때마다 새로 계산해서 넣으니 저장할 때는 뺀다
+     304나 5xx면 클라이언트에게 그대로 넘기면 안 되니 헤더는 다 모은 뒤에 보낸다
+     너무 커서 못 모으면 캐시는 포기하고 모아둔 것부터 흘려보낸다 */
+  char resp_hdr[MAXBUF];
+  size_t hdr_len = 0;
+  int hdr_done = 0;
+  long body_len = 0;
+  http_info info;
+  info.content_length = -1;
+
+  while ((n = rio_readlineb(&server_rio, buf, MAXLINE)) > 0) {
+    if (hdr_len + n <= sizeof(resp_hdr)) {
+      memcpy(resp_hdr + hdr_len, buf, n);
+    } else {
+      if (hdr_len <= sizeof(resp_hdr) && client_ok && rio_writen(connfd, resp_hdr, hdr_len) != (ssize_t)hdr_len)
+        client_ok = 0;
+      if (client_ok && rio_writen(connfd, buf, n) != n)
+        client_ok = 0;
+    }
+    hdr_len += n;
+    if (!strcmp(buf, "\r\n") || !strcmp(buf, "\n")) {
+      hdr_done = 1;
+      break;
+    }
+  }
+  int parsed = hdr_done && hdr_len <= sizeof(resp_hdr) && http_parse_response(resp_hdr, hdr_len, &info) == 0;
+
+  /* 헤더도 다 못 받았거나 (끊김, 타임아웃) stale로 답할 수 있는데 5xx가 왔다
+     must-revalidate 같은 걸로 stale을 못 쓰면 5xx라도 그대로 넘긴다
+     형제가 504면 그 사이 형제 캐시에서 빠진 것 - 다음 단계(부모, 원 서버)로 */
+  if ((!hdr_done && hdr_len <= sizeof(resp_hdr)) || (sibling && hdr_len <= sizeof(resp_hdr) && (!parsed || info.status == 504)) ||
+      (stale != NULL && parsed && info.status >= 500 && (connfd < 0 || http_stale_ok(&stale->meta, time(NULL), stale->meta.sie)))) {
+    cache_fill_abort(&fill);
+    Close(serverFd);
+    return FETCH_FAILED;
+  }
+
+  if (stale != NULL && parsed && info.status == 304) {
+    __sync_fetch_and_add(&http_revalidated, 1);
+    refresh_meta(cache, stale, stored_hdr, &info, req_time);
+    cache_fill_abort(&fill);
+    Close(serverFd);
+    return FETCH_REVALIDATED;
+  }
+
+  /* 원 서버가 압축 안 한 텍스트면 클라이언트가 받는 인코딩으로 줄여서 흘려보낸다
+     압축한 결과는 모아뒀다가 캐시에 넣을 때 변형으로도 넣는다 - 다음 hit부터는 다시 압축 안 한다 */
+  compress_stream zs;
+  int coding = COMPRESS_NONE;
+  if (client_ok && encode_level > 0 && parsed && info.status == 200 && req->range[0] == '\0'
+      && (info.content_length < 0 || info.content_length >= COMPRESS_MIN_SIZE)
+      && compress_eligible(resp_hdr, hdr_len) && (coding = compress_pick(req)) != COMPRESS_NONE) {
+    char enc_hdr[MAXBUF];
+    int n = compress_header(resp_hdr, hdr_len, coding, -1, enc_hdr, sizeof(enc_hdr));
+    if (n < 0 || compress_stream_begin(&zs, coding, encode_level, connfd, cache->max_object) < 0) {
+      coding = COMPRESS_NONE;
+    } else {
+      __sync_fetch_and_add(&http_encoded_relays, 1);
+      if (rio_writen(connfd, enc_hdr, n) != n)
+        zs.client_ok = 0;
+    }
+  }
+
+  if (coding == COMPRESS_NONE && hdr_len <= sizeof(resp_hdr) && client_ok && rio_writen(connfd, resp_hdr, hdr_len) != (ssize_t)hdr_len)
+    client_ok = 0;
+
+  /* Vary가 붙은 응답은 URL 자리가 아니라 요청 헤더 값으로 고른 변형 자리에 넣는다 */
+  char vary_names[MAXLINE];
+  char vkey_buf[MAXLINE * 2 + 32];
+  cache_key vkey;
+  uint64_t vary_hash = 0;
+  int vary = parsed && http_vary_names(resp_hdr, hdr_len, vary_names, sizeof(vary_names));
+  if (vary) {
+    cache_object* same;
+    vary_hash = http_vary_hash(req, vary_names);
+    if (variant_slot(key, vary_hash, vkey_buf, sizeof(vkey_buf), &vkey, &same) == 0)
+      cache_release(cache, same); // 같은 변형이 있던 자리면 덮어쓴다
+    cache_fill_begin(&fill, cache, &vkey);
+    fill.ban_checked = ban_seq;
+  }
+
+  /* 404나 5xx는 원 서버가 수명을 안 정했으면 본문 대신 짧은 합성 응답으로 negative_ttl 동안만 기억한다 */
+  int negative = parsed && negative_ttl > 0 && http_negative(&info, req->authorization);
+  char reason[MAXLINE];
+  if (negative) {
+    cache_fill_abort(&fill);
+    if (sscanf(resp_hdr, "HTTP/%*s %*d %[^\r\n]", reason) != 1)
+      strcpy(reason, "Error");
+  }
+
+  /* 입장 필터: 캐시할 수 있는 응답이라도 처음 보는 키면 릴레이만 한다
+     stale을 재검증한 건 이미 캐시에 있던 것 - 필터를 안 본다 */
+  int cacheable = !negative && parsed && http_freshness(&info, req->authorization, req_time, time(NULL), default_ttl, &fill.meta);
+  int admitted = !cacheable || admission == NULL || stale != NULL || admit_check(admission, key->id, key->hash);
+
+  if (cacheable && admitted) {
+    http_stale_windows(&info, default_swr, default_sie, &fill.meta);
+    fill.meta.vary_hash = vary_hash;
+    hdr_len = http_remove_header(resp_hdr, hdr_len, "Age");
+    fill.meta.hdr_len = hdr_len;
+    cache_fill_append(&fill, resp_hdr, hdr_len);
+  } else {
+    if (!negative && !cacheable)
+      __sync_fetch_and_add(&http_uncacheable, 1);
+    cache_fill_abort(&fill); // no-store, private, 헤더가 너무 큼, 처음 보는 키 등 - 릴레이만 한다
+  }
 
-  while((n= Rio_readlineb(&server_rio, buf, MAXLINE)) != 0)
+  while(hdr_done && (n = rio_readnb(&server_rio, buf, MAXLINE)) > 0)
   {
-    printf("proxy received %d bytes, then send them to client\n", n);
     // 서버의 응답을 클라이언트에게 forward
-    Rio_writen(connfd, buf, n); // client와의 연결 소켓인 connfd에 쓴다 
-    all_size += n;
-    // printf("버프 : %s \n", buf);
-    sprintf(cache_buf, "%s%s", cache_buf, buf); // cache_buf에 전체 응답(헤더+본문)을 이어붙인다
+    if (coding != COMPRESS_NONE)
+      compress_stream_write(&zs, buf, n);
+    else if (client_ok && rio_writen(connfd, buf, n) != n) // client와의 연결 소켓인 connfd에 쓴다
+      client_ok = 0; // 클라이언트가 끊겨도 캐시는 마저 채운다
+    cache_fill_append(&fill, buf, n);
+    body_len += n;
+  }
+
+  /* 캐시: 캐시에 해당 값을 쓴다 - 위에서 캐시에서 해당값을 찾지 못했음
+     중간에 끊겼거나 Content-Length만큼 못 받았으면 버린다 */
+  if (coding != COMPRESS_NONE)
+    compress_stream_end(&zs);
+  if (n == 0 && (info.content_length < 0 || body_len == info.content_length)) {
+    cache_object* filled = NULL;
+    cache_meta meta = fill.meta;
+    int committed;
+    if (compress_level > 0) // 클라이언트에겐 이미 원래대로 보냈다, 캐시에만 줄여서 넣는다
+      compress_fill(&fill, compress_level);
+    committed = cache_fill_commit(&fill, shm != NULL ? &filled : NULL) == 0;
+    if (committed && coding != COMPRESS_NONE && zs.capture != NULL) {
+      cache_object* enc = put_encoded(fill.id, &meta, resp_hdr, coding, cache_hash(resp_hdr, hdr_len), zs.capture, zs.capture_len);
+      if (enc != NULL)
+        cache_release(cache, enc);
+    }
+    if (filled != NULL) { // 다른 프로세스들도 쓰게 공유 캐시에도 넣는다
+      shm_put(shm, filled);
+      cache_release(cache, filled);
+    }
+    if (committed && vary)
+      put_vary_marker(key, vary_names);
+    /* 넘겨받은 요청이면 Content-Length대로 다 보냈을 때만 연결을 계속 쓴다 (압축해서 보낸 건 길이를 뺐다) */
+    resp_framed = client_ok && coding == COMPRESS_NONE && info.content_length >= 0;
+  }
+  if (coding != COMPRESS_NONE && zs.capture != NULL)
+    Free(zs.capture);
+  if (negative) {
+    cache_object* neg = put_negative(key, info.status, reason, "The server returned an error");
+    if (neg != NULL)
+      cache_release(cache, neg);
   }
+  else
+    cache_fill_abort(&fill);
+
+  Close(serverFd);
+  return FETCH_DONE;
+}
+
+/* ---------- 백그라운드 refresher ----------
+   stale-while-revalidate로 stale을 먼저 내준 객체를 뒤에서 재검증한다
+   stale이 NULL이면 Range 요청으로 일부만 나간 객체를 통째로 받아서 캐시에 채운다
+   대기열은 REFRESH_QUEUE_MAX개까지, 넘치면 그냥 버린다 (다음 요청 때 다시 시도) */
+
+typedef struct refresh_job {
+  struct refresh_job* next;
+  cache_object* stale;       // 참조를 잡고 있다, 채우기 작업이면 NULL
+  char hostname[MAXLINE];
+  int port;
+  char path[MAXLINE];
+  char key_buf[MAXLINE * 2];
+  cache_key key;
+  http_request req;
+  int slot;                  // fill_inflight 자리, refresh면 -1
+} refresh_job;
+
+static refresh_job* refresh_head = NULL;
+static refresh_job* refresh_tail = NULL;
+static int refresh_len = 0;
+static sem_t refresh_lock, refresh_items;
+static uint64_t fill_inflight[REFRESH_QUEUE_MAX + REFRESH_THREADS]; // 채우기 작업 중인 키 해시, 0은 빈 칸
+
+/* 같은 키를 두 번 채우러 가지 않게 - refresh_lock을 잡고 부른다, 이미 있거나 자리가 없으면 -1 */
+static int fill_begin(uint64_t hash)
+{
+  int i, empty = -1;
 
-  /* 캐시: 캐시에 해당 값을 쓴다 - 위에서 캐시에서 해당값을 찾지 못했음 */
-  if (all_size <= MAX_OBJECT_SIZE) {
-    add_to_cache(cache, path, (cache_buf), all_size);
+  for (i = 0; i < REFRESH_QUEUE_MAX + REFRESH_THREADS; i++) {
+    if (fill_inflight[i] == hash)
+      return -1;
+    if (fill_inflight[i] == 0 && empty < 0)
+      empty = i;
   }
+  if (empty >= 0)
+    fill_inflight[empty] = hash;
+  return empty;
+}
+
+void schedule_refresh(cache_object* stale, char* hostname, int port, char* path, cache_key* key, http_request* req)
+{
+  refresh_job* job;
+  int slot = -1;
+
+  /* 객체마다 refresh는 한 번에 하나만 */
+  if (stale != NULL && !__sync_bool_compare_and_swap(&stale->refreshing, 0, 1))
+    return;
 
-  if (cache->start != NULL) {
-    printf("저장 이후 캐시 %c\n", cache->start->id);
+  P(&refresh_lock);
+  if (refresh_len >= REFRESH_QUEUE_MAX) {
+    V(&refresh_lock);
+    if (stale != NULL)
+      stale->refreshing = 0;
+    __sync_fetch_and_add(&http_refresh_drops, 1);
+    return;
   }
-  else {
-    printf("저장 이후도 없음\n");
+  if (stale == NULL && (slot = fill_begin(key->hash | 1)) < 0) {
+    V(&refresh_lock);
+    return;
   }
+  refresh_len++;
+  V(&refresh_lock);
 
-  Close(serverFd);
+  job = Malloc(sizeof(refresh_job));
+  job->next = NULL;
+  if (stale != NULL)
+    __sync_fetch_and_add(&stale->refcnt, 1);
+  job->stale = stale;
+  job->slot = slot;
+  strcpy(job->hostname, hostname);
+  job->port = port;
+  strcpy(job->path, path);
+  strcpy(job->key_buf, key->id);
+  job->key = *key;
+  job->key.id = job->key_buf;
+  job->req = *req;
+  job->req.if_none_match[0] = '\0'; // 클라이언트 조건부 헤더는 원 서버로 안 간다 (어차피 read_request_headers가 빼둠)
+  job->req.if_modified_since = -1;
+  job->req.range[0] = '\0'; // 뒤에서는 항상 통째로
+  job->req.if_range[0] = '\0';
+
+  P(&refresh_lock);
+  if (refresh_tail)
+    refresh_tail->next = job;
+  else
+    refresh_head = job;
+  refresh_tail = job;
+  V(&refresh_lock);
+  V(&refresh_items);
+}
+
+static void* refresh_thread(void* arg)
+{
+  refresh_job* job;
+
+  Pthread_detach(Pthread_self());
+  while (1) {
+    P(&refresh_items);
+    P(&refresh_lock);
+    job = refresh_head;
+    refresh_head = job->next;
+    if (refresh_head == NULL)
+      refresh_tail = NULL;
+    refresh_len--;
+    V(&refresh_lock);
+
+    if (job->stale == NULL) {
+      /* 그 사이 다른 요청이 채웠으면 안 받아도 된다 */
+      cache_object* obj = cache_lookup(cache, &job->key);
+      if (obj == NULL) {
+        if (fetch_upstream(-1, job->hostname, job->port, job->path, &job->req, &job->key, NULL) >= 0)
+          __sync_fetch_and_add(&http_range_fills, 1);
+      } else {
+        cache_release(cache, obj);
+      }
+      P(&refresh_lock);
+      fill_inflight[job->slot] = 0;
+      V(&refresh_lock);
+    } else {
+      if (fetch_upstream(-1, job->hostname, job->port, job->path, &job->req, &job->key, job->stale) >= 0)
+        __sync_fetch_and_add(&http_refreshes, 1);
+      job->stale->refreshing = 0;
+      cache_release(cache, job->stale);
+    }
+    Free(job);
+  }
+  return NULL;
+}
+
+void start_refreshers(int n)
+{
+  pthread_t tid;
+
+  Sem_init(&refresh_lock, 0, 1);
+  Sem_init(&refresh_items, 0, 0);
+  while (n-- > 0)
+    Pthread_create(&tid, NULL, refresh_thread, NULL);
 }
 
 /* uri에서 hostname, path, port 뽑아내기 */
 void parse_uri(char* uri, char* hostname, char* path, int* port) {
   *port = 80; // 별 언급 없을시 default
-  *path = '/'; // 기본 path
+  strcpy(path, "/"); // 기본 path (예전엔 *path = '/'만 해서 뒤가 쓰레기값이었다)
   char* hPos;
   char* pPos;
   
@@ -265,6 +1465,22 @@ void parse_uri(char* uri, char* hostname, char* path, int* port) {
   return; 
 }
 
+/* 캐시 키: http://host[:port]/path?query
+   호스트는 대소문자 구분이 없으니 소문자로, 기본 포트(80)는 빼서 같은 URL이 한 키로 모이게 한다 */
+void make_cache_key(char* key, size_t size, char* hostname, int port, char* path) {
+  char host[MAXLINE];
+  int i;
+
+  for (i = 0; hostname[i] && i < MAXLINE - 1; i++)
+    host[i] = tolower((unsigned char)hostname[i]);
+  host[i] = '\0';
+
+  if (port == 80)
+    snprintf(key, size, "http://%s%s", host, path);
+  else
+    snprintf(key, size, "http://%s:%d%s", host, port, path);
+}
+
 /*
   request     : GET /path HTTP/1.0\r\n
   host        : Host: localhost:80
@@ -272,39 +1488,144 @@ void parse_uri(char* uri, char* hostname, char* path, int* port) {
   Prox-con    : Proxy-Connection:
   user-agent  : User-Agent:
 */
-void make_header(char* final_header, char* hostname, char* path, rio_t* client_rio)
+/* 클라이언트의 나머지 요청 헤더를 빈 줄까지 읽어둔다
+   조건부 헤더는 따로 빼두고 (캐시로 직접 답하니까), 프록시가 정해진 형식대로 채울 헤더도 뺀다 */
+void read_request_headers(rio_t* client_rio, http_request* req)
 {
-  char request_header[MAXLINE], buf[MAXLINE], host_header[MAXLINE], other[MAXLINE];
+  char buf[MAXLINE];
+  ssize_t n;
 
-  sprintf(request_header, "GET %s HTTP/1.0\r\n", path);
-  sprintf(host_header, "Host: %s\r\n", hostname); // 호스트헤더는 기 요청받은 호스트네임으로
+  req->headers_len = 0;
+  req->too_large = 0;
+  req->if_none_match[0] = '\0';
+  req->if_modified_since = -1;
+  req->range[0] = '\0';
+  req->if_range[0] = '\0';
+  req->only_if_cached = 0;
+  req->authorization = 0;
+  req->hop = 0;
 
-  /* 클라이언트의 나머지 요청 받아서 저장 */
-  while (Rio_readlineb(client_rio, buf, MAXLINE)) {
-    if (!(strcmp("\r\n", buf))) {
-      break; // '\r\n' 이면 끝 
+  while ((n = rio_readlineb(client_rio, buf, MAXLINE)) > 0) {
+    if (!strcmp("\r\n", buf) || !strcmp("\n", buf)) {
+      break; // '\r\n' 이면 끝
+    }
+
+    if (!strncasecmp(buf, "If-None-Match:", strlen("If-None-Match:"))) {
+      sscanf(buf + strlen("If-None-Match:"), " %[^\r\n]", req->if_none_match);
+      continue;
+    }
+    if (!strncasecmp(buf, "If-Modified-Since:", strlen("If-Modified-Since:"))) {
+      req->if_modified_since = http_parse_date(buf + strlen("If-Modified-Since:"));
+      continue;
+    }
+    /* Range도 캐시가 직접 처리한다, 캐시에 없을 때만 fetch_origin이 원 서버로 넘긴다 */
+    if (!strncasecmp(buf, "Range:", strlen("Range:"))) {
+      sscanf(buf + strlen("Range:"), " %[^\r\n]", req->range);
+      continue;
+    }
+    if (!strncasecmp(buf, "If-Range:", strlen("If-Range:"))) {
+      sscanf(buf + strlen("If-Range:"), " %[^\r\n]", req->if_range);
+      continue;
+    }
+
+    /* 클러스터의 다른 노드가 넘긴 요청 - 표시만 하고 원 서버로는 안 보낸다 */
+    if (!strncasecmp(buf, "X-Cluster-Hop:", strlen("X-Cluster-Hop:"))) {
+      req->hop = 1;
+      continue;
+    }
+
+    /* Authorization은 그대로 원 서버로 보내고, 응답을 저장해도 되는지 볼 때만 쓴다 */
+    if (!strncasecmp(buf, "Authorization:", strlen("Authorization:")))
+      req->authorization = 1;
+
+    /* only-if-cached는 표시만 해두고 헤더는 그대로 둔다 - 어차피 원 서버로는 안 나간다 */
+    if (!strncasecmp(buf, "Cache-Control:", strlen("Cache-Control:"))) {
+      char value[MAXLINE];
+      int i;
+      for (i = 0; buf[i] && i < MAXLINE - 1; i++)
+        value[i] = tolower((unsigned char)buf[i]);
+      value[i] = '\0';
+      if (strstr(value, "only-if-cached"))
+        req->only_if_cached = 1;
     }
 
     /* 얘네는 정해진 형식대로 채워줄거임 */
-    if(strncasecmp(buf, "User-Agent", strlen("User-Agent")) 
-      && strncasecmp(buf, "Connection", strlen("Connection"))
-      && strncasecmp(buf, "Proxy-Connection", strlen("Proxy-Connection"))) {
-        strcat(other, buf); // 따라서 정해진 형식없는 애들만 other에 넣어줌(이어붙이기)
-      }
+    if (!strncasecmp(buf, "User-Agent", strlen("User-Agent"))
+      || !strncasecmp(buf, "Connection", strlen("Connection"))
+      || !strncasecmp(buf, "Proxy-Connection", strlen("Proxy-Connection"))) {
+      continue;
+    }
+
+    /* 따라서 정해진 형식없는 애들만 headers에 넣어줌(이어붙이기) */
+    if (req->headers_len + n < sizeof(req->headers)) {
+      memcpy(req->headers + req->headers_len, buf, n);
+      req->headers_len += n;
+    } else {
+      req->too_large = 1;
+    }
   }
+  req->headers[req->headers_len] = '\0';
+}
 
+/*
+  request     : GET /path HTTP/1.0\r\n
+  host        : Host: localhost:80
+  Con         : Connection:
+  Prox-con    : Proxy-Connection:
+  user-agent  : User-Agent:
+  validators  : 만료된 캐시를 재검증할 때만 If-None-Match, If-Modified-Since
+*/
+void make_header(char* final_header, size_t size, char* hostname, char* path, http_request* req, char* validators)
+{
   /* 최종 요청 헤더의 모습 */
-  sprintf(final_header, "%s%s%s%s%s%s%s",
-    request_header,
-    host_header,
+  snprintf(final_header, size, "GET %s HTTP/1.0\r\nHost: %s\r\n%s%s%s%s%s\r\n",
+    path,
+    hostname, // 호스트헤더는 기 요청받은 호스트네임으로
     user_agent_hdr,
     conn_hdr,
     prox_conn_hdr,
-    other,
-    "\r\n"
+    req->headers,
+    validators
   );
 }
 
+/* 만료된 객체의 저장된 헤더에서 재검증용 조건부 헤더를 만든다, 검증자가 하나도 없으면 0
+   stored_hdr에는 저장된 헤더를 읽어둔다 (304를 받으면 합쳐서 freshness를 다시 계산) */
+int make_validators(cache_object* obj, char* stored_hdr, char* out, size_t size)
+{
+  char value[MAXLINE];
+  size_t hdr_len = obj->meta.hdr_len;
+  int n = 0;
+
+  out[0] = '\0';
+  if (hdr_len == 0 || hdr_len > MAXBUF)
+    return 0;
+  cache_object_read(obj, 0, stored_hdr, hdr_len);
+
+  if ((obj->meta.flags & CACHE_META_ETAG) && http_get_header(stored_hdr, hdr_len, "ETag", value, sizeof(value)) == 0)
+    n += snprintf(out + n, size - n, "If-None-Match: %s\r\n", value);
+  /* Last-Modified는 받은 문자열 그대로 돌려준다 (RFC 7232 권장) */
+  if (obj->meta.last_modified >= 0 && http_get_header(stored_hdr, hdr_len, "Last-Modified", value, sizeof(value)) == 0)
+    n += snprintf(out + n, size - n, "If-Modified-Since: %s\r\n", value);
+  return n > 0;
+}
+
+/* 304를 받았으면 저장된 헤더에 304의 헤더를 덮어써서 freshness를 다시 계산, 메타데이터만 바꾼다
+   이미 저장해둔 응답을 갱신하는 거라 이번 요청의 Authorization은 안 따진다 */
+void refresh_meta(cache_list* cache, cache_object* obj, char* stored_hdr, http_info* fresh, time_t req_time)
+{
+  http_info stored;
+  cache_meta meta = obj->meta;
+
+  if (http_parse_response(stored_hdr, obj->meta.hdr_len, &stored) < 0)
+    return;
+  http_merge_304(&stored, fresh);
+  if (http_freshness(&stored, 0, req_time, time(NULL), default_ttl, &meta)) {
+    http_stale_windows(&stored, default_swr, default_sie, &meta);
+    cache_update_meta(cache, obj, &meta);
+  }
+}
+
 
 /* 유저가 요청한 hostname, port에 적합한 서버에 접속한다 */
 int connect_server(char* hostname, int port) {
@@ -318,6 +1639,620 @@ int connect_server(char* hostname, int port) {
 }
 
 
+/* *_stats_text가 버퍼보다 긴 길이를 돌려줘도 끝을 넘겨서 세지 않게 자른다 */
+static int stats_add(int len, int n, size_t size) {
+  if (n <= 0)
+    return len;
+  return (size_t)(len + n) < size ? len + n : (int)size - 1;
+}
+
+/* 프록시 자체가 응답하는 경로들 */
+void serve_local(int fd, char* uri, cache_list* cache) {
+  char buf[MAXLINE], body[STATS_BUF];
+  int len;
+
+  if (strcmp(uri, "/stats")) {
+    clienterror(fd, uri, "404", "Not Found", "Proxy has no such page");
+    return;
+  }
+
+  len = stats_add(0, cache_stats_text(cache, body, sizeof(body)), sizeof(body));
+  if (disk != NULL)
+    len = stats_add(len, disk_stats_text(disk, body + len, sizeof(body) - len), sizeof(body));
+  if (snapshot != NULL)
+    len = stats_add(len, snapshot_stats_text(snapshot, body + len, sizeof(body) - len), sizeof(body));
+  if (shm != NULL)
+    len = stats_add(len, shm_stats_text(shm, body + len, sizeof(body) - len), sizeof(body));
+  if (bans != NULL)
+    len = stats_add(len, ban_stats_text(bans, body + len, sizeof(body) - len), sizeof(body));
+  len = stats_add(len, l1_stats_text(body + len, sizeof(body) - len), sizeof(body));
+  if (compress_level > 0 || encode_level > 0)
+    len = stats_add(len, compress_stats_text(body + len, sizeof(body) - len), sizeof(body));
+  len = stats_add(len, peer_stats_text(body + len, sizeof(body) - len), sizeof(body));
+  len = stats_add(len, cluster_stats_text(body + len, sizeof(body) - len), sizeof(body));
+  if (admission != NULL)
+    len = stats_add(len, admit_stats_text(admission, body + len, sizeof(body) - len), sizeof(body));
+  if (psi_threshold > 0)
+    len = stats_add(len, snprintf(body + len, sizeof(body) - len,
+                    "cache_target: %zu\n"
+                    "pressure_shrinks: %lu\n"
+                    "pressure_grows: %lu\n",
+                    cache_target, pressure_shrinks, pressure_grows), sizeof(body));
+  len = stats_add(len, snprintf(body + len, sizeof(body) - len,
+                  "http_default_ttl: %d\n"
+                  "http_uncacheable: %lu\n"
+                  "http_expired: %lu\n"
+                  "http_revalidated: %lu\n"
+                  "http_not_modified: %lu\n"
+                  "http_stale_served: %lu\n"
+                  "http_stale_if_error: %lu\n"
+                  "http_refreshes: %lu\n"
+                  "http_refresh_drops: %lu\n"
+                  "http_range_hits: %lu\n"
+                  "http_range_fills: %lu\n"
+                  "http_vary_hits: %lu\n"
+                  "http_vary_misses: %lu\n"
+                  "http_negative_stored: %lu\n"
+                  "http_negative_hits: %lu\n"
+                  "http_gzip_served: %lu\n"
+                  "http_inflated: %lu\n"
+                  "http_encoded_relays: %lu\n"
+                  "http_encoded_built: %lu\n"
+                  "http_encoded_hits: %lu\n"
+                  "http_only_if_cached_misses: %lu\n"
+                  "http_cluster_hops: %lu\n", default_ttl, http_uncacheable, http_expired,
+                  http_revalidated, http_304_sent, http_stale_served, http_stale_if_error,
+                  http_refreshes, http_refresh_drops, http_range_hits, http_range_fills,
+                  http_vary_hits, http_vary_misses, http_negative_stored, http_negative_hits,
+                  http_gzip_served, http_inflated, http_encoded_relays, http_encoded_built, http_encoded_hits,
+                  http_only_if_cached_misses, http_cluster_hops), sizeof(body));
+  sprintf(buf, "HTTP/1.0 200 OK\r\n"
+               "Content-type: text/plain\r\n"
+               "Content-length: %d\r\n\r\n", len);
+  if (rio_writen(fd, buf, strlen(buf)) < 0) // 클라이언트가 먼저 끊었으면 그냥 끝 (Rio_writen은 프로세스를 죽인다)
+    return;
+  rio_writen(fd, body, len);
+}
+
+/* 캐시된 응답을 보낸다, 저장할 때 뺀 Age는 지금 나이로 계산해서 헤더 끝에 넣는다
+   클라이언트 조건부 요청에 맞으면 본문 없이 304만, Range면 필요한 구간만 206으로 */
+void serve_cached(int fd, cache_object* obj, http_request* req) {
+  char age[64], hdr[MAXBUF], resp[MAXBUF];
+  size_t hdr_len = obj->meta.hdr_len;
+
+  if (hdr_len > 0 && hdr_len <= sizeof(hdr) && (req->if_none_match[0] || req->if_modified_since >= 0 || req->range[0])) {
+    cache_object_read(obj, 0, hdr, hdr_len);
+    if ((req->if_none_match[0] || req->if_modified_since >= 0) && http_not_modified(req, hdr, hdr_len, &obj->meta)) {
+      int n = http_build_304(hdr, hdr_len, http_current_age(&obj->meta, time(NULL)), resp, sizeof(resp));
+      __sync_fetch_and_add(&http_304_sent, 1);
+      resp_framed = rio_writen(fd, resp, n) == n;
+      return;
+    }
+    if (req->range[0] && obj->meta.status == 200 && http_if_range_ok(req, hdr, hdr_len, &obj->meta)
+        && serve_range(fd, obj, req, hdr) == 0) {
+      resp_framed = 1; // 206, 416 모두 Content-Length를 붙인다
+      return;
+    }
+  }
+
+  if (hdr_len < 2) { // HTTP 메타데이터가 없는 객체는 그대로
+    cache_object_write(fd, obj, 0, obj->length);
+    return;
+  }
+  if ((obj->meta.flags & CACHE_META_GZIP) && hdr_len <= sizeof(hdr)) {
+    serve_compressed(fd, obj, req, hdr);
+    return;
+  }
+  sprintf(age, "Age: %ld\r\n\r\n", http_current_age(&obj->meta, time(NULL)));
+  if (cache_object_write(fd, obj, 0, hdr_len - 2) < 0 || rio_writen(fd, age, strlen(age)) < 0)
+    return;
+  if (cache_object_write(fd, obj, hdr_len, obj->length - hdr_len) < 0 || !req->hop || hdr_len > sizeof(hdr))
+    return;
+  cache_object_read(obj, 0, hdr, hdr_len); // 넘겨받은 요청이면 연결을 계속 쓸 수 있는지
+  resp_framed = http_get_header(hdr, hdr_len, "Content-Length", age, sizeof(age)) == 0;
+}
+
+/* 압축해서 저장한 객체: gzip을 받는 클라이언트에겐 저장된 그대로 Content-Encoding: gzip으로,
+   아니면 원래 헤더 그대로 두고 본문을 풀면서 보낸다 */
+static void serve_compressed(int fd, cache_object* obj, http_request* req, char* hdr) {
+  char resp[MAXBUF];
+  size_t hdr_len = obj->meta.hdr_len, stored = obj->length - hdr_len;
+  long age = http_current_age(&obj->meta, time(NULL));
+  int gzip = http_accepts(req, "gzip"), len;
+
+  cache_object_read(obj, 0, hdr, hdr_len);
+  if (gzip) { // 표현이 다르니 ETag도 인코딩 이름을 붙인 것으로 (압축 변형과 같은 규칙)
+    len = compress_header(hdr, hdr_len, COMPRESS_GZIP, stored, resp, sizeof(resp));
+  } else {
+    memcpy(resp, hdr, hdr_len);
+    len = compress_vary(resp, hdr_len, sizeof(resp));
+  }
+  if (len < 2)
+    return;
+  len += snprintf(resp + len - 2, sizeof(resp) - len + 2, "Age: %ld\r\n\r\n", age) - 2;
+  if (len >= (int)sizeof(resp) || rio_writen(fd, resp, len) < 0)
+    return;
+  if (gzip) {
+    __sync_fetch_and_add(&http_gzip_served, 1);
+    resp_framed = cache_object_write(fd, obj, hdr_len, stored) >= 0;
+  } else {
+    __sync_fetch_and_add(&http_inflated, 1);
+    resp_framed = compress_inflate_write(fd, obj, 0, obj->meta.raw_len) >= 0
+                  && http_get_header(hdr, hdr_len, "Content-Length", resp, sizeof(resp)) == 0;
+  }
+}
+
+/* 압축한 변형을 id#enc=<인코딩> 자리에 넣는다, 넣은 객체의 참조를 돌려준다
+   메타데이터는 원본 것 그대로 (수명이 같다), vary_hash 자리에는 원본 헤더의 해시 - 원본이 바뀌면 버린다 */
+static cache_object* put_encoded(const char* id, cache_meta* meta, const char* hdr, int coding, uint64_t fp, const char* body, size_t len)
+{
+  char vbuf[MAXLINE * 2 + 48], enc_hdr[MAXBUF];
+  cache_object* obj = NULL;
+  cache_key vkey;
+  cache_fill fill;
+  int n;
+
+  if ((n = compress_header(hdr, meta->hdr_len, coding, len, enc_hdr, sizeof(enc_hdr))) < 0)
+    return NULL;
+  snprintf(vbuf, sizeof(vbuf), "%s#enc=%s", id, compress_name(coding));
+  cache_key_init(&vkey, vbuf);
+  cache_fill_begin(&fill, cache, &vkey);
+  fill.ban_checked = bans != NULL ? bans->seq : 0;
+  fill.meta = *meta;
+  fill.meta.hdr_len = n;
+  fill.meta.flags &= CACHE_META_ETAG;
+  fill.meta.raw_len = 0;
+  fill.meta.vary_hash = fp;
+  cache_fill_append(&fill, enc_hdr, n);
+  cache_fill_append(&fill, body, len);
+  if (cache_fill_commit(&fill, &obj) < 0)
+    return NULL;
+  __sync_fetch_and_add(&http_encoded_built, 1);
+  return obj;
+}
+
+/* 응답 압축 단계 (hit): 클라이언트가 받는 인코딩으로 압축한 변형이 있으면 그걸로, 없으면 지금 한 번 만들어 넣고 답한다
+   압축할 게 아니면 (Range, 작거나 이미 인코딩된 본문, 이미지 등) 아무것도 안 보내고 0 - 그럼 serve_cached */
+static int serve_encoded(int fd, cache_object* obj, cache_key* key, http_request* req)
+{
+  char vbuf[MAXLINE * 2 + 48], hdr[MAXBUF];
+  size_t hdr_len = obj->meta.hdr_len, raw_len;
+  cache_object* var;
+  cache_key vkey;
+  uint64_t fp;
+  int coding;
+
+  if (encode_level <= 0 || req->range[0] != '\0' || obj->meta.status != 200 || hdr_len == 0 || hdr_len > sizeof(hdr)
+      || (obj->meta.flags & (CACHE_META_VARY | CACHE_META_NEGATIVE)))
+    return 0;
+  raw_len = (obj->meta.flags & CACHE_META_GZIP) ? obj->meta.raw_len : obj->length - hdr_len;
+  if (raw_len < COMPRESS_MIN_SIZE || (coding = compress_pick(req)) == COMPRESS_NONE)
+    return 0;
+  if (coding == COMPRESS_GZIP && (obj->meta.flags & CACHE_META_GZIP))
+    return 0; // 저장된 본문이 이미 gzip - serve_cached가 그대로 보낸다
+  cache_object_read(obj, 0, hdr, hdr_len);
+  if (!compress_eligible(hdr, hdr_len))
+    return 0;
+
+  fp = cache_hash(hdr, hdr_len);
+  snprintf(vbuf, sizeof(vbuf), "%s#enc=%s", key->id, compress_name(coding));
+  cache_key_init(&vkey, vbuf);
+  var = cache_lookup(cache, &vkey);
+  drop_banned(&var);
+  if (var != NULL && var->meta.vary_hash != fp) { // 원본이 바뀌었다
+    cache_release(cache, var);
+    var = NULL;
+  }
+
+  if (var != NULL) {
+    __sync_fetch_and_add(&http_encoded_hits, 1);
+    if (var->meta.resp_time != obj->meta.resp_time) { // 원본이 304로 재검증됐다 - 수명을 따라간다
+      cache_meta meta = obj->meta;
+      meta.hdr_len = var->meta.hdr_len;
+      meta.flags = var->meta.flags;
+      meta.raw_len = 0;
+      meta.vary_hash = fp;
+      cache_update_meta(cache, var, &meta);
+    }
+  } else {
+    char* raw = compress_raw_body(obj, &raw_len);
+    char* out;
+    size_t n;
+
+    if (raw == NULL)
+      return 0;
+    out = Malloc(raw_len + 64);
+    n = compress_buffer(coding, encode_level, raw, raw_len, out, raw_len); // 안 줄어들면 0
+    Free(raw);
+    if (n > 0)
+      var = put_encoded(key->id, &obj->meta, hdr, coding, fp, out, n);
+    Free(out);
+    if (var == NULL)
+      return 0;
+  }
+  serve_cached(fd, var, req);
+  cache_release(cache, var);
+  return 1;
+}
+
+/* 본문의 [off, off+len) 구간을 보낸다, 압축된 객체면 풀면서 */
+static ssize_t write_body(int fd, cache_object* obj, size_t off, size_t len) {
+  if (obj->meta.flags & CACHE_META_GZIP)
+    return compress_inflate_write(fd, obj, off, len);
+  return cache_object_write(fd, obj, obj->meta.hdr_len + off, len);
+}
+
+/* Range를 캐시된 본문에서 잘라서 보낸다 (구간 하나면 206, 여러 개면 multipart/byteranges)
+   Range가 이상하면 -1 - 그럼 그냥 200으로 통째로 */
+int serve_range(int fd, cache_object* obj, http_request* req, char* hdr) {
+  http_range ranges[HTTP_MAX_RANGES];
+  char extra[MAXLINE], part[MAXLINE], type[MAXLINE], resp[MAXBUF];
+  size_t hdr_len = obj->meta.hdr_len;
+  long length = (obj->meta.flags & CACHE_META_GZIP) ? obj->meta.raw_len : obj->length - hdr_len;
+  long age = http_current_age(&obj->meta, time(NULL));
+  long total;
+  int i, n, nranges;
+
+  nranges = http_parse_range(req->range, length, ranges, HTTP_MAX_RANGES);
+  if (nranges < 0)
+    return -1;
+  __sync_fetch_and_add(&http_range_hits, 1);
+
+  if (nranges == 0) { // 만족하는 구간이 없다
+    n = snprintf(resp, sizeof(resp), "HTTP/1.0 416 Range Not Satisfiable\r\n"
+                                     "Content-Range: bytes */%ld\r\n"
+                                     "Content-Length: 0\r\n\r\n", length);
+    rio_writen(fd, resp, n);
+    return 0;
+  }
+
+  if (nranges == 1) {
+    snprintf(extra, sizeof(extra), "Content-Range: bytes %ld-%ld/%ld\r\nContent-Length: %ld\r\n",
+             ranges[0].first, ranges[0].last, length, ranges[0].last - ranges[0].first + 1);
+    if ((n = http_build_partial(hdr, hdr_len, extra, age, resp, sizeof(resp))) < 0)
+      return -1;
+    if (rio_writen(fd, resp, n) < 0)
+      return 0;
+    write_body(fd, obj, ranges[0].first, ranges[0].last - ranges[0].first + 1);
+    return 0;
+  }
+
+  /* 멀티파트: 각 파트 헤더 길이까지 미리 계산해서 Content-Length를 맞춘다 */
+  if (http_get_header(hdr, hdr_len, "Content-Type", type, sizeof(type)) < 0)
+    strcpy(type, "application/octet-stream");
+  total = 0;
+  for (i = 0; i < nranges; i++)
+    total += snprintf(part, sizeof(part), "--" RANGE_BOUNDARY "\r\nContent-Type: %s\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n",
+                      type, ranges[i].first, ranges[i].last, length)
+             + ranges[i].last - ranges[i].first + 1 + 2;
+  total += strlen("--" RANGE_BOUNDARY "--\r\n");
+  snprintf(extra, sizeof(extra), "Content-Type: multipart/byteranges; boundary=" RANGE_BOUNDARY "\r\nContent-Length: %ld\r\n", total);
+  if ((n = http_build_partial(hdr, hdr_len, extra, age, resp, sizeof(resp))) < 0)
+    return -1;
+  if (rio_writen(fd, resp, n) < 0)
+    return 0;
+  for (i = 0; i < nranges; i++) {
+    n = snprintf(part, sizeof(part), "--" RANGE_BOUNDARY "\r\nContent-Type: %s\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n",
+                 type, ranges[i].first, ranges[i].last, length);
+    if (rio_writen(fd, part, n) < 0
+        || write_body(fd, obj, ranges[i].first, ranges[i].last - ranges[i].first + 1) < 0
+        || rio_writen(fd, "\r\n", 2) < 0)
+      return 0;
+  }
+  rio_writen(fd, "--" RANGE_BOUNDARY "--\r\n", strlen("--" RANGE_BOUNDARY "--\r\n"));
+  return 0;
+}
+
+static void usage(char* prog) {
+  fprintf(stderr, "Usage: %s [--policy=%s] [--cache-size=N] [--max-object=N]\n"
+                  "          [--max-large-object=N] [--large-share=PERCENT]\n"
+                  "          [--disk-dir=DIR] [--disk-size=N]\n"
+                  "          [--snapshot=FILE] [--snapshot-interval=SECS] [--snapshot-max-age=SECS]\n"
+                  "          [--shm=/NAME] [--shm-size=N] [--default-ttl=SECS]\n"
+                  "          [--stale-while-revalidate=SECS] [--stale-if-error=SECS] [--origin-timeout=SECS]\n"
+                  "          [--range-fill=0|1] [--negative-ttl=SECS] [--admin-port=PORT]\n"
+                  "          [--workers=N] [--l1-slots=N] [--compress=LEVEL] [--dedup=0|1] [--encode=LEVEL]\n"
+                  "          [--partition=NAME:HOST[,HOST...]:MIN%%:MAX%%]...\n"
+                  "          [--parent=HOST:PORT] [--sibling=HOST:PORT]... [--probe-timeout=MS] [--peer-listen]\n"
+                  "          [--cluster=HOST:PORT]... [--cluster-self=HOST:PORT] [--huge-pages=0|1]\n"
+                  "          [--numa=auto|N] [--numa-replicate=HITS]\n"
+                  "          [--admit-window=SECS] [--admit-keys=N] [--admit-bypass=PREFIX]...\n"
+                  "          [--cache-max=N] [--cache-size-file=FILE] [--psi=PERCENT] <port>\n"
+                  "  sizes accept K/M/G suffixes\n"
+                  "  partition hosts starting with '.' match the whole domain, NAME=default sets the share of other hosts\n"
+                  "  siblings are probed over UDP on their proxy port before a miss goes to the parent or the origin,\n"
+                  "  a proxy answers those probes only with --peer-listen\n"
+                  "  cluster nodes split keys on a hash ring (self defaults to 127.0.0.1:<port>), JOIN/LEAVE on the admin port\n"
+                  "  --numa=N simulates N nodes by splitting the CPUs (memory is not moved), for testing on one-node machines\n"
+                  "  --admit-window caches a URL only when it is requested again within SECS, bypass prefixes are cached at once\n"
+                  "  the cache size can change up to --cache-max: RESIZE <size> on the admin port, or SIGHUP rereads the size file\n"
+                  "  --psi shrinks the cache while memory PSI (some avg10) or cgroup usage is high\n", prog, POLICY_NAMES);
+  exit(1);
+}
+
+/* 관리용 포트, 요청이 드무니 한 번에 하나씩 */
+static void* admin_thread(void* arg) {
+  int listenfd = *(int*)arg;
+  struct sockaddr_storage clientaddr;
+  socklen_t clientlen;
+  int fd;
+
+  Free(arg);
+  Pthread_detach(Pthread_self());
+  while (1) {
+    clientlen = sizeof(clientaddr);
+    if ((fd = accept(listenfd, (SA*)&clientaddr, &clientlen)) < 0)
+      continue;
+    do_admin(fd);
+    Close(fd);
+  }
+  return NULL;
+}
+
+static void admin_reply(int fd, char* status, char* body) {
+  char buf[MAXLINE * 2];
+  int n = snprintf(buf, sizeof(buf), "HTTP/1.0 %s\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\n\r\n%s",
+                   status, strlen(body), body);
+  rio_writen(fd, buf, n);
+}
+
+/*
+  PURGE http://host/path HTTP/1.0   - 그 URL (과 Vary 변형들)
+  BAN http://host/static/v12/ HTTP/1.0  - 그 prefix로 시작하는 URL 전부
+  BAN ~<regex> HTTP/1.0             - 정규식에 맞는 URL 전부 (확장 정규식, 공백도 된다)
+  GET /stats HTTP/1.0
+  메모리에 있는 PURGE 대상은 바로 빼고, 나머지는 ban으로 기록만 해서 찾아질 때 걸러낸다 (디스크/공유 캐시에서 올라온 것 포함)
+  ban은 이 프로세스 안에만 있다 - 공유 캐시는 PURGE한 키의 레코드만 떼고, BAN은 다른 프로세스에 안 간다
+*/
+void do_admin(int fd) {
+  char buf[MAXLINE], line[MAXLINE], method[MAXLINE], target[MAXLINE], body[MAXLINE];
+  char hostname[MAXLINE], path[MAXLINE], key_buf[MAXLINE * 2];
+  char* p;
+  int port;
+  rio_t rio;
+
+  Rio_readinitb(&rio, fd);
+  if (rio_readlineb(&rio, line, MAXLINE) <= 0)
+    return;
+  while (rio_readlineb(&rio, buf, MAXLINE) > 0 && strcmp(buf, "\r\n") && strcmp(buf, "\n"))
+    ; // 헤더는 안 본다
+
+  /* target에는 공백이 있을 수 있어서 (regex) 마지막 " HTTP/" 앞까지 */
+  line[strcspn(line, "\r\n")] = '\0';
+  if (sscanf(line, "%s", method) != 1 || (p = strchr(line, ' ')) == NULL) {
+    admin_reply(fd, "400 Bad Request", "bad request line\n");
+    return;
+  }
+  strcpy(target, p + 1);
+  for (p = target + strlen(target); p > target && strncmp(p, " HTTP/", 6); p--)
+    ;
+  if (p > target)
+    *p = '\0';
+
+  if (!strcasecmp(method, "GET") && target[0] == '/') {
+    serve_local(fd, target, cache);
+    return;
+  }
+
+  if (!strcasecmp(method, "BAN") && target[0] == '~') {
+    if (ban_add_regex(bans, target + 1, buf, sizeof(buf)) < 0) {
+      snprintf(body, sizeof(body), "bad regex: %.4096s\n", buf);
+      admin_reply(fd, "400 Bad Request", body);
+      return;
+    }
+    snprintf(body, sizeof(body), "banned ~%.4096s (ban %u)\n", target + 1, bans->seq);
+    admin_reply(fd, "200 OK", body);
+    return;
+  }
+
+  /* 캐시 크기 바꾸기: 키우는 건 --cache-max까지, 줄이는 건 뒤에서 조금씩 쫓아낸다 */
+  if (!strcasecmp(method, "RESIZE")) {
+    size_t size = parse_size(target);
+    if (size == 0) {
+      admin_reply(fd, "400 Bad Request", "use RESIZE <size>, e.g. RESIZE 64M\n");
+      return;
+    }
+    cache_target = cache_resize(cache, size);
+    snprintf(body, sizeof(body), "cache size %zu bytes (max %zu)\n", cache_target, cache->capacity);
+    admin_reply(fd, "200 OK", body);
+    return;
+  }
+
+  /* 클러스터 멤버 바꾸기: 그 노드 몫의 키만 주인이 바뀐다 (다른 노드들에도 같은 걸 보내야 링이 같아진다) */
+  if (!strcasecmp(method, "JOIN") || !strcasecmp(method, "LEAVE")) {
+    int join = !strcasecmp(method, "JOIN");
+    if (!cluster_enabled()) {
+      admin_reply(fd, "409 Conflict", "not running with --cluster\n");
+      return;
+    }
+    if ((join ? cluster_add(target) : cluster_remove(target)) < 0) {
+      snprintf(body, sizeof(body), "cannot %s %.256s\n", join ? "join" : "remove", target);
+      admin_reply(fd, "400 Bad Request", body);
+      return;
+    }
+    snprintf(body, sizeof(body), "%s %.256s\n", join ? "joined" : "removed", target);
+    admin_reply(fd, "200 OK", body);
+    return;
+  }
+
+  if (strcasecmp(method, "PURGE") && strcasecmp(method, "BAN")) {
+    admin_reply(fd, "405 Method Not Allowed", "use PURGE <url>, BAN <url-prefix>, BAN ~<regex>, RESIZE <size> or JOIN/LEAVE <host:port>\n");
+    return;
+  }
+
+  /* 프록시 요청과 똑같이 정규화한 키로 (호스트 소문자, :80 생략) */
+  strcpy(buf, target);
+  parse_uri(buf, hostname, path, &port);
+  make_cache_key(key_buf, sizeof(key_buf), hostname, port, path);
+
+  if (!strcasecmp(method, "BAN")) {
+    ban_add_prefix(bans, key_buf, 0);
+    snprintf(body, sizeof(body), "banned %.4096s* (ban %u)\n", key_buf, bans->seq);
+    admin_reply(fd, "200 OK", body);
+    return;
+  }
+
+  /* PURGE: 메모리에 있는 것 (URL 자리와 Vary 변형 자리들)은 바로 빼고, 다른 계층 것은 ban으로
+     공유 캐시는 다른 프로세스도 보니 그 자리들의 레코드를 같이 뗀다 */
+  cache_key key, vkey;
+  char vkey_buf[MAXLINE * 2 + 32];
+  cache_object* obj;
+  int purged = 0, i;
+
+  cache_key_init(&key, key_buf);
+  if ((obj = cache_lookup(cache, &key)) != NULL) {
+    if (obj->meta.flags & CACHE_META_VARY) {
+      for (i = 0; i < VARY_MAX_VARIANTS; i++) {
+        cache_object* v;
+        make_variant_key(vkey_buf, sizeof(vkey_buf), &key, i, &vkey);
+        if ((v = cache_lookup(cache, &vkey)) != NULL) {
+          purged += cache_remove(cache, v) == 0;
+          cache_release(cache, v);
+        }
+      }
+    }
+    purged += cache_remove(cache, obj) == 0;
+    cache_release(cache, obj);
+  }
+  if (shm != NULL) { /* 변형 표시가 공유 캐시에만 있을 수도 있으니 변형 자리는 다 본다 */
+    shm_remove(shm, &key);
+    for (i = 0; i < VARY_MAX_VARIANTS; i++) {
+      make_variant_key(vkey_buf, sizeof(vkey_buf), &key, i, &vkey);
+      shm_remove(shm, &vkey);
+    }
+  }
+  ban_add_prefix(bans, key_buf, 1);
+  snprintf(body, sizeof(body), "purged %.4096s (%d objects in memory, ban %u)\n", key_buf, purged, bans->seq);
+  admin_reply(fd, purged > 0 ? "200 OK" : "404 Not Found", body);
+}
+
+/* 종료 시그널을 받으면 스냅샷을 떠두고 끝낸다 */
+static void* signal_thread(void* arg) {
+  sigset_t mask;
+  int sig;
+
+  Sigemptyset(&mask);
+  Sigaddset(&mask, SIGTERM);
+  Sigaddset(&mask, SIGINT);
+  Sigaddset(&mask, SIGHUP);
+  while (1) {
+    if (sigwait(&mask, &sig) != 0)
+      continue;
+    if (sig == SIGHUP) { /* 크기 파일을 다시 읽어서 캐시 크기를 바꾼다 */
+      size_t size;
+      if (size_file == NULL || read_size_file(size_file, &size) < 0) {
+        fprintf(stderr, "SIGHUP: cannot read cache size from %s\n", size_file != NULL ? size_file : "(no --cache-size-file)");
+        continue;
+      }
+      cache_target = cache_resize(cache, size);
+      printf("SIGHUP: cache resized to %zu bytes\n", cache_target);
+      fflush(stdout);
+      continue;
+    }
+    if (snapshot != NULL && snapshot_save(snapshot) == 0)
+      printf("Snapshot: saved %lu objects to %s\n", snapshot->last_count, snapshot->path);
+    fflush(stdout);
+    exit(0);
+  }
+  return NULL;
+}
+
+/* 크기 파일: "64M" 같은 크기 하나 */
+static int read_size_file(const char* path, size_t* out) {
+  char line[MAXLINE];
+  FILE* fp = fopen(path, "r");
+  size_t size;
+
+  if (fp == NULL)
+    return -1;
+  size = fgets(line, sizeof(line), fp) != NULL ? parse_size(line) : 0;
+  fclose(fp);
+  if (size == 0)
+    return -1;
+  *out = size;
+  return 0;
+}
+
+/* --psi: 메모리 압박이 보이면 캐시를 1/4씩 줄인다 (정해둔 크기의 1/8까지), 쫓아내는 건 cache.c의 shrinker가 뒤에서
+   PRESSURE_CALM초 동안 조용하면 정해둔 크기까지 1/8씩 되돌린다 */
+static void* pressure_thread(void* arg) {
+  pressure_src* src = arg;
+  pressure_sample smp;
+  int calm = 0;
+
+  Pthread_detach(Pthread_self());
+  while (1) {
+    size_t limit, target, next;
+    int high;
+
+    sleep(PRESSURE_INTERVAL);
+    pressure_read(src, &smp);
+    limit = cache->limit; // 자는 동안 RESIZE가 들어왔을 수 있으니 읽고 나서
+    target = cache_target;
+    high = smp.avg10 >= psi_threshold || (smp.limit > 0 && smp.usage > smp.limit / 100 * PRESSURE_HIGH);
+    if (high) {
+      calm = 0;
+      next = limit - limit / 4;
+      if (next < target / 8)
+        next = target / 8;
+      if (next < limit) {
+        next = cache_resize(cache, next);
+        __sync_fetch_and_add(&pressure_shrinks, 1);
+        printf("Memory pressure (some avg10 %.2f%%, usage %zu/%zu): cache %zu -> %zu bytes\n",
+               smp.avg10, smp.usage, smp.limit, limit, next);
+        fflush(stdout);
+      }
+    } else if (++calm >= PRESSURE_CALM && limit < target) {
+      next = limit + target / 8 < target ? limit + target / 8 : target;
+      cache_resize(cache, next);
+      __sync_fetch_and_add(&pressure_grows, 1);
+    }
+  }
+  return NULL;
+}
+
+/* "64K", "8M", "1G" 같은 크기 인자 */
+static size_t parse_size(char* arg) {
+  char* end;
+  double v = strtod(arg, &end);
+  switch (*end) {
+  case 'k': case 'K': v *= 1024; break;
+  case 'm': case 'M': v *= 1024 * 1024; break;
+  case 'g': case 'G': v *= 1024 * 1024 * 1024; break;
+  }
+  return (size_t)v;
+}
+
+/* --partition=NAME:HOST[,HOST...]:MIN%:MAX% (% 생략 가능), 잘못됐거나 최소 몫 합이 100을 넘으면 -1 */
+static int parse_partition(char* arg, cache_config* config) {
+  cache_partition_config* pc;
+  char *name, *hosts, *min, *max;
+  int i, total;
+
+  if (config->nparts >= CACHE_MAX_PARTITIONS - 1)
+    return -1;
+  name = strtok(arg, ":");
+  hosts = strtok(NULL, ":");
+  min = strtok(NULL, ":");
+  max = strtok(NULL, ":");
+  if (name == NULL || hosts == NULL || min == NULL || max == NULL)
+    return -1;
+
+  pc = &config->parts[config->nparts];
+  pc->name = name;
+  pc->hosts = hosts;
+  pc->min_share = atoi(min);
+  pc->max_share = atoi(max);
+  if (pc->min_share < 0 || pc->max_share <= 0 || pc->max_share > 100 || pc->min_share > pc->max_share)
+    return -1;
+  for (i = 0, total = 0; i <= config->nparts; i++)
+    total += config->parts[i].min_share;
+  if (total > 100)
+    return -1;
+  config->nparts++;
+  return 0;
+}
+
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg)
 {
   char buf[MAXLINE], body[MAXBUF];
@@ -329,12 +2264,16 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longms
   sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
   sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n", body);
 
-  /* print Http response */
+  /* print Http response
+     클라이언트가 이미 끊었을 수도 있다 - Rio_writen은 그러면 프로세스를 죽이니 rio_writen으로, 못 쓰면 그냥 끝 */
   sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
+  if (rio_writen(fd, buf, strlen(buf)) < 0)
+    return;
   sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
+  if (rio_writen(fd, buf, strlen(buf)) < 0)
+    return;
   sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));
-  Rio_writen(fd, body, strlen(body));
+  if (rio_writen(fd, buf, strlen(buf)) < 0)
+    return;
+  resp_framed = rio_writen(fd, body, strlen(body)) == (ssize_t)strlen(body);
 }
@@ -0,0 +1,26 @@
+/* 연결 디스크립터 대기열 (CS:APP 12.5.4 sbuf)
+ * main 쓰레드가 accept한 connfd를 넣고, 미리 띄워둔 워커 쓰레드들이 꺼내간다
+ */
+#ifndef __SBUF_H__
+#define __SBUF_H__
+
+#include "csapp.h"
+
+#define SBUF_SIZE 64
+
+typedef struct {
+    int *buf;      /* Buffer array */
+    int n;         /* Maximum number of slots */
+    int front;     /* buf[(front+1)%n] is first item */
+    int rear;      /* buf[rear%n] is last item */
+    sem_t mutex;   /* Protects accesses to buf */
+    sem_t slots;   /* Counts available slots */
+    sem_t items;   /* Counts available items */
+} sbuf_t;
+
+void sbuf_init(sbuf_t *sp, int n);
+void sbuf_deinit(sbuf_t *sp);
+void sbuf_insert(sbuf_t *sp, int item);
+int sbuf_remove(sbuf_t *sp);
+
+#endif /* __SBUF_H__ */
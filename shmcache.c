@@ -0,0 +1,483 @@
+/* 공유 메모리 캐시, shmcache.h 참고 */
+#include "shmcache.h"
+#include <sys/mman.h>
+#include <signal.h>
+
+#define SHM_ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t* buckets(shm_cache* shm) {
+    return (uint64_t*)(shm->base + shm->hdr->buckets_off);
+}
+
+static shm_record* rec_at(shm_cache* shm, uint64_t v) {
+    return (shm_record*)(shm->base + shm->hdr->data_off + v % shm->hdr->data_size);
+}
+
+/* 인덱스를 통째로 비운다. tail_v를 head_v로 당겨서 락 없이 복사 중이던 쪽도 전부 실패하게 만든다 */
+static void reset_index(shm_cache* shm) {
+    shm_header* hdr = shm->hdr;
+    uint64_t* b = buckets(shm);
+    uint32_t i;
+
+    for (i = 0; i < hdr->nbuckets; i++)
+        b[i] = SHM_NIL;
+    __atomic_store_n(&hdr->tail_v, hdr->head_v, __ATOMIC_RELEASE);
+    hdr->objects = 0;
+    memset(hdr->inflight, 0, sizeof(hdr->inflight));
+}
+
+static void shm_lock(shm_cache* shm) {
+    int rc = pthread_mutex_lock(&shm->hdr->lock);
+
+    if (rc == EOWNERDEAD) {
+        /* 락을 쥔 채로 다른 프로세스가 죽었다. 인덱스를 고치던 중이었으면 믿을 수 없으니 비운다 */
+        if (shm->hdr->dirty)
+            reset_index(shm);
+        shm->hdr->dirty = 0;
+        shm->hdr->recoveries++;
+        pthread_mutex_consistent(&shm->hdr->lock);
+        fprintf(stderr, "shm cache: recovered lock from dead process\n");
+    } else if (rc != 0) {
+        posix_error(rc, "shm cache: pthread_mutex_lock error");
+    }
+}
+
+static void shm_unlock(shm_cache* shm) {
+    pthread_mutex_unlock(&shm->hdr->lock);
+}
+
+static int rec_matches(shm_record* rec, uint64_t hash, const char* key, size_t key_len) {
+    return rec->hash == hash && rec->key_len == key_len
+        && memcmp((char*)(rec + 1), key, key_len) == 0;
+}
+
+/* 같은 버킷 체인에서 v를 가리키는 링크 */
+static uint64_t* link_to(shm_cache* shm, uint64_t hash, uint64_t v) {
+    uint64_t* pp = &buckets(shm)[hash % shm->hdr->nbuckets];
+    while (*pp != SHM_NIL && *pp != v)
+        pp = &rec_at(shm, *pp)->next_v;
+    return *pp == v ? pp : NULL;
+}
+
+static void unlink_record(shm_cache* shm, uint64_t v) {
+    shm_record* rec = rec_at(shm, v);
+    uint64_t* pp = link_to(shm, rec->hash, v);
+
+    if (pp != NULL)
+        *pp = rec->next_v;
+    rec->flags &= ~SHM_REC_LIVE;
+    shm->hdr->objects--;
+}
+
+/* 복사 중인 레코드를 쓰는 프로세스가 아직 살아있나 */
+static int writer_alive(shm_record* rec) {
+    return kill((pid_t)rec->writer, 0) == 0 || errno == EPERM;
+}
+
+/* 가장 오래된 레코드 하나를 링에서 밀어낸다 (락 잡고)
+   아직 복사 중인 레코드면 그 자리를 덮어쓰게 되니 못 밀어낸다 -1 */
+static int evict_tail(shm_cache* shm) {
+    shm_header* hdr = shm->hdr;
+    uint64_t pos = hdr->tail_v % hdr->data_size;
+    uint64_t step;
+    shm_record* rec;
+
+    if (hdr->data_size - pos < sizeof(shm_record)) {
+        step = hdr->data_size - pos; // 헤더도 못 들어가는 꼬리 자투리
+    } else {
+        rec = rec_at(shm, hdr->tail_v);
+        if ((rec->flags & SHM_REC_WRITING) && writer_alive(rec))
+            return -1;
+        if (rec->flags & SHM_REC_LIVE) {
+            unlink_record(shm, hdr->tail_v);
+            hdr->evictions++;
+        }
+        step = rec->size;
+    }
+    /* 덮어쓰기 전에 tail_v부터 옮겨야 락 없이 읽는 쪽이 알아챈다 */
+    __atomic_store_n(&hdr->tail_v, hdr->tail_v + step, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int make_room(shm_cache* shm, uint64_t end_v) {
+    while (end_v - shm->hdr->tail_v > shm->hdr->data_size)
+        if (evict_tail(shm) < 0)
+            return -1;
+    return 0;
+}
+
+/* need 바이트짜리 레코드 자리를 잡는다 (락 잡고). 링 끝에 안 맞으면 패딩 넣고 다음 바퀴 처음부터
+   복사 중인 레코드에 막혀서 못 잡으면 SHM_NIL */
+static uint64_t reserve(shm_cache* shm, uint64_t need) {
+    shm_header* hdr = shm->hdr;
+    uint64_t pos = hdr->head_v % hdr->data_size;
+    uint64_t rest = hdr->data_size - pos;
+    uint64_t v;
+    shm_record* pad;
+
+    if (rest < need) {
+        if (make_room(shm, hdr->head_v + rest) < 0)
+            return SHM_NIL;
+        if (rest >= sizeof(shm_record)) {
+            pad = rec_at(shm, hdr->head_v);
+            pad->magic = SHM_REC_MAGIC;
+            pad->flags = SHM_REC_PAD;
+            pad->size = rest;
+        }
+        hdr->head_v += rest;
+    }
+    if (make_room(shm, hdr->head_v + need) < 0)
+        return SHM_NIL;
+    v = hdr->head_v;
+    hdr->head_v += need;
+    return v;
+}
+
+shm_cache* shm_attach(const char* name, size_t size, cache_list* cache) {
+    shm_cache* shm;
+    shm_header* hdr;
+    pthread_mutexattr_t attr;
+    struct stat st;
+    uint64_t nbuckets, waited;
+    int fd, creator = 1;
+    void* base;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        creator = 0;
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "shm cache: cannot open %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    if (creator) {
+        if (ftruncate(fd, size) < 0) {
+            fprintf(stderr, "shm cache: cannot size %s: %s\n", name, strerror(errno));
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+    } else {
+        /* 먼저 만든 프로세스가 크기를 정한다, 내 --shm-size는 무시 */
+        for (waited = 0; fstat(fd, &st) == 0 && st.st_size == 0 && waited < 2000; waited += SHM_WAIT_STEP_MS)
+            usleep(SHM_WAIT_STEP_MS * 1000);
+        if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(shm_header)) {
+            fprintf(stderr, "shm cache: %s is not initialized\n", name);
+            close(fd);
+            return NULL;
+        }
+        size = st.st_size;
+    }
+
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "shm cache: mmap %s failed: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    shm = Calloc(1, sizeof(shm_cache));
+    shm->name = strdup(name);
+    shm->hdr = hdr = base;
+    shm->base = base;
+    shm->cache = cache;
+
+    if (creator) {
+        /* 오브젝트 평균 8KB 정도로 잡고 버킷 수를 정한다 (2의 거듭제곱일 필요는 없다) */
+        nbuckets = size / 8192;
+        if (nbuckets < 1024)
+            nbuckets = 1024;
+        hdr->magic = SHM_MAGIC;
+        hdr->version = SHM_VERSION;
+        hdr->size = size;
+        hdr->nbuckets = nbuckets;
+        hdr->buckets_off = SHM_ALIGN(sizeof(shm_header));
+        hdr->data_off = SHM_ALIGN(hdr->buckets_off + nbuckets * sizeof(uint64_t));
+        if (hdr->data_off + 4 * MAX_OBJECT_SIZE > size) {
+            fprintf(stderr, "shm cache: %zu bytes is too small\n", size);
+            munmap(base, size);
+            shm_unlink(name);
+            Free(shm->name);
+            Free(shm);
+            return NULL;
+        }
+        hdr->data_size = size - hdr->data_off;
+        hdr->head_v = hdr->tail_v = 0;
+
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&hdr->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+
+        reset_index(shm);
+        __atomic_store_n(&hdr->ready, 1, __ATOMIC_RELEASE);
+    } else {
+        for (waited = 0; !__atomic_load_n(&hdr->ready, __ATOMIC_ACQUIRE) && waited < 2000;
+             waited += SHM_WAIT_STEP_MS)
+            usleep(SHM_WAIT_STEP_MS * 1000);
+        if (!hdr->ready || hdr->magic != SHM_MAGIC || hdr->version != SHM_VERSION || hdr->size != size) {
+            fprintf(stderr, "shm cache: %s has an incompatible layout\n", name);
+            munmap(base, size);
+            Free(shm->name);
+            Free(shm);
+            return NULL;
+        }
+    }
+    return shm;
+}
+
+/* 공유 캐시에서 찾아서 이 프로세스의 메모리 캐시로 올린다
+   본문 복사는 락 없이 하고, 끝난 뒤 그 사이에 링이 덮어쓰지 않았는지만 확인
+   polling이면 (shm_wait에서 기다리는 중) miss로 세지 않는다 */
+static int promote(shm_cache* shm, cache_key* ck, cache_object** out, int polling) {
+    shm_header* hdr = shm->hdr;
+    const char* key = ck->id;
+    size_t key_len = ck->len;
+    uint64_t hash = ck->hash;
+    uint64_t v, body_v, pos;
+    shm_record* rec = NULL;
+    unsigned int body_len;
+    cache_meta meta;
+    cache_fill fill;
+    int ok;
+
+    shm_lock(shm);
+    for (v = buckets(shm)[hash % hdr->nbuckets]; v != SHM_NIL; v = rec->next_v) {
+        rec = rec_at(shm, v);
+        if (rec_matches(rec, hash, key, key_len))
+            break;
+    }
+    if (v == SHM_NIL) {
+        if (!polling)
+            hdr->misses++;
+        shm_unlock(shm);
+        return -1;
+    }
+    body_len = rec->body_len;
+    body_v = v + sizeof(shm_record) + key_len;
+    meta = rec->meta;
+    shm_unlock(shm);
+
+    /* 레코드는 링에서 끊기지 않게 잡았으니 본문은 연속이다 */
+    pos = body_v % hdr->data_size;
+    cache_fill_begin(&fill, shm->cache, ck);
+    fill.meta = meta;
+    cache_fill_append(&fill, shm->base + hdr->data_off + pos, body_len);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    ok = __atomic_load_n(&hdr->tail_v, __ATOMIC_ACQUIRE) <= v;
+
+    shm_lock(shm);
+    if (ok)
+        hdr->hits++;
+    else
+        hdr->lapped++;
+    shm_unlock(shm);
+
+    if (!ok) {
+        cache_fill_abort(&fill);
+        return -1;
+    }
+    return cache_fill_commit(&fill, out);
+}
+
+int shm_promote(shm_cache* shm, cache_key* key, cache_object** out) {
+    return promote(shm, key, out, 0);
+}
+
+/* 원 서버에서 받아 메모리 캐시에 넣은 객체를 공유 캐시에도 넣는다
+   자리만 락 잡고 예약하고, 복사는 락 없이 한 뒤 다시 락 잡고 인덱스에 건다
+   복사하는 동안은 SHM_REC_WRITING으로 표시해둬서 다른 프로세스가 링을 돌아 이 자리를 다시 잡지 못한다 */
+int shm_put(shm_cache* shm, cache_object* obj) {
+    shm_header* hdr = shm->hdr;
+    size_t key_len = strlen(obj->id);
+    uint64_t hash = obj->hash;
+    uint64_t need = SHM_ALIGN(sizeof(shm_record) + key_len + obj->length);
+    uint64_t v, old, *slot;
+    shm_record* rec;
+
+    if (need > hdr->data_size / 4)
+        return -1;
+
+    shm_lock(shm);
+    hdr->dirty = 1;
+    if ((v = reserve(shm, need)) == SHM_NIL) {
+        hdr->busy++;
+        hdr->dirty = 0;
+        shm_unlock(shm);
+        return -1;
+    }
+    rec = rec_at(shm, v);
+    rec->magic = SHM_REC_MAGIC;
+    rec->flags = SHM_REC_WRITING; // 인덱스에 걸기 전까지는 아무도 못 본다, 여기서 죽으면 tail이 writer를 보고 지나간다
+    rec->writer = getpid();
+    rec->key_len = key_len;
+    rec->body_len = obj->length;
+    rec->hash = hash;
+    rec->next_v = SHM_NIL;
+    rec->size = need;
+    rec->meta = obj->meta;
+    hdr->dirty = 0;
+    shm_unlock(shm);
+
+    memcpy((char*)(rec + 1), obj->id, key_len);
+    cache_object_read(obj, 0, (char*)(rec + 1) + key_len, obj->length);
+
+    shm_lock(shm);
+    if (hdr->tail_v > v) {
+        /* 복사하는 사이 인덱스가 초기화됐다 (다른 프로세스가 락 쥔 채 죽었다) - 이 자리는 이미 남의 것일 수 있다 */
+        hdr->lapped++;
+        shm_unlock(shm);
+        return -1;
+    }
+    hdr->dirty = 1;
+    slot = &buckets(shm)[hash % hdr->nbuckets];
+    for (old = *slot; old != SHM_NIL; old = rec_at(shm, old)->next_v) {
+        if (rec_matches(rec_at(shm, old), hash, obj->id, key_len)) {
+            unlink_record(shm, old);
+            break;
+        }
+    }
+    rec->next_v = *slot;
+    rec->flags = SHM_REC_LIVE; // WRITING도 같이 풀린다
+    *slot = v;
+    hdr->objects++;
+    hdr->inserts++;
+    hdr->dirty = 0;
+    shm_unlock(shm);
+    return 0;
+}
+
+/* 이 키를 원 서버에서 받아오겠다고 표시한다
+   이미 다른 프로세스가 받는 중이면 0 (shm_wait로 기다리면 된다), 내가 맡았으면 1 */
+int shm_claim(shm_cache* shm, cache_key* key) {
+    shm_header* hdr = shm->hdr;
+    uint64_t hash = key->hash;
+    uint64_t now = now_ms();
+    shm_inflight* slot = NULL;
+    int i;
+
+    shm_lock(shm);
+    for (i = 0; i < SHM_INFLIGHT; i++) {
+        shm_inflight* f = &hdr->inflight[i];
+        int expired = !f->used || now - f->since_ms > SHM_INFLIGHT_TIMEOUT_MS;
+        if (!expired && f->hash == hash) {
+            shm_unlock(shm);
+            return 0;
+        }
+        if (expired && slot == NULL)
+            slot = f;
+    }
+    /* 표시할 자리가 없으면 그냥 각자 받아온다 */
+    if (slot != NULL) {
+        slot->hash = hash;
+        slot->since_ms = now;
+        slot->pid = getpid();
+        slot->used = 1;
+    }
+    shm_unlock(shm);
+    return 1;
+}
+
+void shm_unclaim(shm_cache* shm, cache_key* key) {
+    shm_header* hdr = shm->hdr;
+    uint64_t hash = key->hash;
+    int pid = getpid(), i;
+
+    shm_lock(shm);
+    for (i = 0; i < SHM_INFLIGHT; i++) {
+        if (hdr->inflight[i].used && hdr->inflight[i].hash == hash && hdr->inflight[i].pid == pid) {
+            hdr->inflight[i].used = 0;
+            break;
+        }
+    }
+    shm_unlock(shm);
+}
+
+/* PURGE: 이 키의 레코드를 인덱스에서 뗀다 (자리는 링이 돌아올 때 그냥 지나간다), 있었으면 1
+   이미 복사해 간 프로세스의 메모리 캐시에 있는 건 어쩔 수 없다 - ban은 프로세스마다 따로다 */
+int shm_remove(shm_cache* shm, cache_key* key) {
+    shm_header* hdr = shm->hdr;
+    uint64_t v;
+    int found = 0;
+
+    shm_lock(shm);
+    hdr->dirty = 1;
+    for (v = buckets(shm)[key->hash % hdr->nbuckets]; v != SHM_NIL; v = rec_at(shm, v)->next_v) {
+        if (rec_matches(rec_at(shm, v), key->hash, key->id, key->len)) {
+            unlink_record(shm, v);
+            found = 1;
+            break;
+        }
+    }
+    hdr->dirty = 0;
+    shm_unlock(shm);
+    return found;
+}
+
+/* 다른 프로세스가 받아오는 중인 객체가 공유 캐시에 들어오길 기다린다
+   받는 쪽이 포기하거나(표시가 사라짐) 시간이 지나면 -1, 그럼 직접 받으러 가면 된다 */
+int shm_wait(shm_cache* shm, cache_key* key, cache_object** out) {
+    shm_header* hdr = shm->hdr;
+    uint64_t hash = key->hash;
+    uint64_t start = now_ms();
+    int i, pending;
+
+    while (now_ms() - start < SHM_INFLIGHT_TIMEOUT_MS) {
+        usleep(SHM_WAIT_STEP_MS * 1000);
+        if (promote(shm, key, out, 1) == 0) {
+            shm_lock(shm);
+            hdr->waits++;
+            shm_unlock(shm);
+            return 0;
+        }
+        pending = 0;
+        shm_lock(shm);
+        for (i = 0; i < SHM_INFLIGHT; i++)
+            if (hdr->inflight[i].used && hdr->inflight[i].hash == hash)
+                pending = 1;
+        shm_unlock(shm);
+        if (!pending)
+            return -1;
+    }
+    return -1;
+}
+
+int shm_stats_text(shm_cache* shm, char* buf, size_t len) {
+    shm_header snap;
+    int n;
+
+    shm_lock(shm);
+    snap = *shm->hdr;
+    shm_unlock(shm);
+
+    n = snprintf(buf, len,
+        "shm_name: %s\n"
+        "shm_capacity: %llu\n"
+        "shm_objects: %llu\n"
+        "shm_bytes: %llu\n"
+        "shm_hits: %llu\n"
+        "shm_misses: %llu\n"
+        "shm_inserts: %llu\n"
+        "shm_evictions: %llu\n"
+        "shm_lapped: %llu\n"
+        "shm_busy: %llu\n"
+        "shm_waits: %llu\n"
+        "shm_recoveries: %llu\n",
+        shm->name, (unsigned long long)snap.data_size, (unsigned long long)snap.objects,
+        (unsigned long long)(snap.head_v - snap.tail_v),
+        (unsigned long long)snap.hits, (unsigned long long)snap.misses,
+        (unsigned long long)snap.inserts, (unsigned long long)snap.evictions,
+        (unsigned long long)snap.lapped, (unsigned long long)snap.busy, (unsigned long long)snap.waits,
+        (unsigned long long)snap.recoveries);
+    return n < (int)len ? n : (int)len - 1;
+}
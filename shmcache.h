@@ -0,0 +1,99 @@
+/* 여러 프록시 프로세스가 같이 쓰는 공유 메모리 캐시
+ * POSIX shm 세그먼트 하나 안에 해시 인덱스와 링 버퍼(로그)를 두고, 각 프로세스의 메모리 캐시 뒤에서
+ * 공용 계층으로 쓴다. 한 프로세스가 원 서버에서 받아온 객체는 다른 프로세스들이 그대로 가져다 쓴다
+ *
+ * - 세그먼트는 프로세스마다 다른 주소에 매핑되니 링크는 전부 오프셋 (포인터 X)
+ * - 오프셋은 링을 몇 바퀴 돌았는지까지 담은 가상 오프셋(v)이고, 실제 위치는 v % data_size
+ *   tail_v보다 앞에 있는 레코드는 이미 덮어써진 것 -> 읽는 쪽은 락 없이 복사한 뒤 tail_v만 다시 확인한다
+ * - 인덱스는 PTHREAD_PROCESS_SHARED + ROBUST 뮤텍스로 보호, 락을 쥔 채 죽은 프로세스가 있으면
+ *   (EOWNERDEAD) 고치던 중이었는지(dirty) 보고 인덱스를 초기화해서 복구한다
+ * - 같은 객체를 여러 프로세스가 동시에 원 서버에서 받아오지 않도록 "받는 중" 표시(inflight)를 둔다
+ */
+#ifndef __SHMCACHE_H__
+#define __SHMCACHE_H__
+
+#include "cache.h"
+
+#define SHM_MAGIC 0x53484d43U
+#define SHM_VERSION 8 // 2: 키가 path에서 절대 URL로, 3: 레코드에 HTTP 메타데이터, 4: 검증자(ETag/Last-Modified), 5: stale-while-revalidate/stale-if-error 기간, 6: Vary 변형 해시, 7: 압축된 본문 (raw_len), 8: 복사 중인 레코드 표시 (writer)
+#define SHM_DEFAULT_SIZE (64 * 1024 * 1024)
+#define SHM_NIL (~(uint64_t)0)
+#define SHM_INFLIGHT 64
+#define SHM_INFLIGHT_TIMEOUT_MS 3000 // 받는 중이라던 프로세스가 이 시간 안에 안 넣으면 직접 받으러 간다
+#define SHM_WAIT_STEP_MS 10
+
+#define SHM_REC_MAGIC 0x52454331U
+#define SHM_REC_LIVE 1
+#define SHM_REC_PAD  2
+#define SHM_REC_WRITING 4 // 자리만 잡고 아직 복사 중 - 링이 한 바퀴 돌아와도 이 레코드는 못 밀어낸다
+
+typedef struct shm_record {
+    uint32_t magic;
+    uint32_t flags;
+    uint32_t key_len;
+    uint32_t body_len;
+    uint64_t hash;
+    uint64_t next_v;   // 같은 버킷의 다음 레코드
+    uint64_t size;     // 헤더 포함, 8바이트 정렬된 전체 크기
+    uint64_t writer;   // SHM_REC_WRITING인 동안 복사하는 프로세스 pid, 그 프로세스가 죽었으면 밀어내도 된다
+    cache_meta meta;
+} shm_record;
+
+typedef struct shm_inflight {
+    uint64_t hash;
+    uint64_t since_ms;
+    int32_t pid;
+    int32_t used;
+} shm_inflight;
+
+typedef struct shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    volatile uint32_t ready;
+    uint32_t dirty;          // 인덱스를 고치는 중, 락 쥔 채로 죽었으면 믿을 수 없다
+    pthread_mutex_t lock;
+    uint32_t nbuckets;
+    uint64_t buckets_off;
+    uint64_t data_off;
+    uint64_t data_size;
+    uint64_t head_v;
+    uint64_t tail_v;
+    shm_inflight inflight[SHM_INFLIGHT];
+
+    /* 모든 프로세스 합계 */
+    uint64_t objects;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t lapped;         // 복사하는 사이 덮어써져서 버린 횟수
+    uint64_t busy;           // 링 꼬리가 아직 복사 중인 레코드라 자리를 못 잡은 횟수
+    uint64_t waits;          // 다른 프로세스가 받아오길 기다려서 해결된 횟수
+    uint64_t recoveries;
+} shm_header;
+
+typedef struct shm_cache {
+    char* name;
+    shm_header* hdr;
+    char* base;
+    cache_list* cache;       // 이 프로세스의 메모리 캐시 (여기로 올려서 서빙)
+} shm_cache;
+
+shm_cache* shm_attach(const char* name, size_t size, cache_list* cache);
+
+int shm_promote(shm_cache* shm, cache_key* key, cache_object** out);
+
+int shm_put(shm_cache* shm, cache_object* obj);
+
+int shm_claim(shm_cache* shm, cache_key* key);
+
+void shm_unclaim(shm_cache* shm, cache_key* key);
+
+int shm_remove(shm_cache* shm, cache_key* key);
+
+int shm_wait(shm_cache* shm, cache_key* key, cache_object** out);
+
+int shm_stats_text(shm_cache* shm, char* buf, size_t len);
+
+#endif /* __SHMCACHE_H__ */
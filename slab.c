@@ -0,0 +1,343 @@
+/* size-class slab 할당기, slab.h 참고 */
+#include <stdint.h>
+#include "slab.h"
+#include "numa.h"
+
+/* size class 테이블 만들기: 64B부터 1.25배씩, SLAB_MAX_SLOT까지 */
+static void init_classes(slab_arena* arena) {
+    size_t size = SLAB_MIN_SLOT;
+    int n = 0;
+
+    while (n < SLAB_MAX_CLASSES - 1 && size < SLAB_MAX_SLOT) {
+        arena->classes[n].slot_size = size;
+        arena->classes[n].per_page = SLAB_PAGE_SIZE / size;
+        n++;
+        size = (size * 5 / 4 + 7) & ~(size_t)7; // 8바이트 정렬 유지
+    }
+    arena->classes[n].slot_size = SLAB_MAX_SLOT;
+    arena->classes[n].per_page = SLAB_PAGE_SIZE / SLAB_MAX_SLOT;
+    arena->nclasses = n + 1;
+}
+
+/* huge page로 영역을 잡아본다, 크기는 2MB 단위로 올린다
+   1. MAP_HUGETLB: 예약된 huge page가 모자라면 실패한다 (MAP_POPULATE로 여기서 다 받아둔다)
+   2. THP: 2MB 경계에 맞춘 보통 영역에 MADV_HUGEPAGE - 건드리기 전에 madvise해야 처음부터 huge page로 채워진다
+   둘 다 안 되면 0. populate가 0이면 (노드에 붙일 거라) 여기서는 안 채운다 */
+static int map_huge(slab_arena* arena, int populate) {
+    size_t size = (arena->size + SLAB_HUGE_PAGE_SIZE - 1) & ~(size_t)(SLAB_HUGE_PAGE_SIZE - 1);
+    char* p;
+    uintptr_t aligned;
+
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (populate ? MAP_POPULATE : 0), -1, 0);
+    if (p != MAP_FAILED) {
+        arena->map_base = arena->base = p;
+        arena->map_size = size;
+        return SLAB_HUGE_TLB;
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    /* 2MB 더 잡아서 앞뒤를 잘라 경계를 맞춘다 */
+    p = mmap(NULL, size + SLAB_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return SLAB_HUGE_NONE;
+    aligned = ((uintptr_t)p + SLAB_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(SLAB_HUGE_PAGE_SIZE - 1);
+    if ((char*)aligned > p)
+        Munmap(p, (char*)aligned - p);
+    if ((char*)aligned + size < p + size + SLAB_HUGE_PAGE_SIZE)
+        Munmap((char*)aligned + size, p + size + SLAB_HUGE_PAGE_SIZE - ((char*)aligned + size));
+    arena->map_base = arena->base = (char*)aligned;
+    arena->map_size = size;
+    if (madvise(arena->base, size, MADV_HUGEPAGE) == 0)
+        return SLAB_HUGE_THP;
+    return SLAB_HUGE_NONE; // THP가 꺼진 커널 - 그냥 보통 페이지로 쓴다
+#else
+    return SLAB_HUGE_NONE;
+#endif
+}
+
+/* 예산(budget)을 페이지 단위로 내림해서 영역을 만든다, 앞의 populate 바이트는 미리 건드려서 page fault를 시작할 때 치른다
+   나머지는 나중에 캐시를 키울 자리 - 주소만 잡아두고 (MAP_NORESERVE) 쓸 때 메모리가 붙는다
+   huge면 huge page로 잡아보고, 안 되면 보통 페이지로
+   node >= 0이면 건드리기 전에 그 NUMA 노드 메모리로 정해둔다 (numa.c) - 그래서 이때는 MAP_POPULATE를 안 쓴다 */
+slab_arena* slab_create(size_t budget, size_t populate, int huge, int node) {
+    slab_arena* arena = Calloc(1, sizeof(slab_arena));
+    unsigned int i, populated;
+    int whole;
+
+    arena->npages = budget / SLAB_PAGE_SIZE;
+    if (arena->npages == 0)
+        arena->npages = 1;
+    arena->size = (size_t)arena->npages * SLAB_PAGE_SIZE;
+    populated = (populate + SLAB_PAGE_SIZE - 1) / SLAB_PAGE_SIZE;
+    if (populated > arena->npages)
+        populated = arena->npages;
+    whole = populated == arena->npages;
+    arena->node = node;
+    if (huge)
+        arena->huge = map_huge(arena, node < 0 && whole);
+    if (arena->map_base == NULL) {
+        arena->map_size = arena->size;
+        arena->map_base = arena->base = Mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+                                             MAP_PRIVATE | MAP_ANONYMOUS | (whole ? (node < 0 ? MAP_POPULATE : 0) : MAP_NORESERVE), -1, 0);
+    }
+    if (node >= 0 && numa_bind_memory(arena->map_base, arena->map_size, node) < 0)
+        arena->node = -1; // 커널이 NUMA를 모른다 - 그냥 어디든
+    memset(arena->base, 0, (size_t)populated * SLAB_PAGE_SIZE); // MAP_POPULATE가 안 먹는 환경 대비, THP는 여기서 처음 채워진다
+
+    arena->pages = Calloc(arena->npages, sizeof(slab_page));
+    for (i = 0; i < arena->npages; i++) {
+        arena->pages[i].cls = SLAB_PAGE_FREE;
+        arena->pages[i].trimmed = i >= populated;
+    }
+    arena->free_pages = arena->npages;
+    arena->limit_pages = populated;
+
+    init_classes(arena);
+    Sem_init(&arena->lock, 0, 1);
+    return arena;
+}
+
+void slab_destroy(slab_arena* arena) {
+    Munmap(arena->map_base, arena->map_size);
+    Free(arena->pages);
+    Free(arena);
+}
+
+static int class_of(slab_arena* arena, size_t size) {
+    int lo = 0, hi = arena->nclasses - 1;
+    while (lo < hi) { // slot_size >= size인 첫 class
+        int mid = (lo + hi) / 2;
+        if (arena->classes[mid].slot_size < size)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static unsigned int page_index(slab_arena* arena, void* ptr) {
+    return ((char*)ptr - arena->base) / SLAB_PAGE_SIZE;
+}
+
+static char* page_addr(slab_arena* arena, unsigned int idx) {
+    return arena->base + (size_t)idx * SLAB_PAGE_SIZE;
+}
+
+/* [0, end) 안에서 연속된 빈 페이지 n장을 찾아 run으로 잡는다, cursor부터 한 바퀴 (next-fit) */
+static int find_pages(slab_arena* arena, unsigned int n, unsigned int end) {
+    unsigned int scanned = 0, start, run, i;
+
+    start = arena->cursor < end ? arena->cursor : 0;
+    while (scanned < end) {
+        if (start + n > end) { // 끝에 걸리면 처음부터
+            scanned += end - start;
+            start = 0;
+            continue;
+        }
+        for (run = 0; run < n && arena->pages[start + run].cls == SLAB_PAGE_FREE; run++)
+            ;
+        if (run == n) {
+            for (i = 0; i < n; i++) {
+                arena->pages[start + i].cls = SLAB_PAGE_TAIL;
+                arena->pages[start + i].trimmed = 0;
+            }
+            arena->pages[start].npages = n;
+            arena->free_pages -= n;
+            arena->cursor = (start + n) % end;
+            return start;
+        }
+        scanned += run + 1;
+        start += run + 1;
+    }
+    return -1;
+}
+
+/* 캐시 크기 몫(limit_pages) 안에서 먼저 찾는다 - 키울 자리까지 흩어져서 메모리가 붙는 걸 줄인다 */
+static int take_pages(slab_arena* arena, unsigned int n) {
+    int idx;
+
+    if (arena->free_pages < n)
+        return -1;
+    if (arena->limit_pages < arena->npages && (idx = find_pages(arena, n, arena->limit_pages)) >= 0)
+        return idx;
+    return find_pages(arena, n, arena->npages);
+}
+
+static void release_pages(slab_arena* arena, unsigned int idx, unsigned int n) {
+    unsigned int i;
+    for (i = 0; i < n; i++) {
+        arena->pages[idx + i].cls = SLAB_PAGE_FREE;
+        arena->pages[idx + i].npages = 0;
+    }
+    arena->free_pages += n;
+}
+
+static void partial_push(slab_class* c, slab_page* pg) {
+    pg->prev = NULL;
+    pg->next = c->partial;
+    if (c->partial)
+        c->partial->prev = pg;
+    c->partial = pg;
+}
+
+static void partial_remove(slab_class* c, slab_page* pg) {
+    if (pg->prev)
+        pg->prev->next = pg->next;
+    else
+        c->partial = pg->next;
+    if (pg->next)
+        pg->next->prev = pg->prev;
+    pg->prev = pg->next = NULL;
+}
+
+/* size 바이트 이상짜리 슬롯 하나를 준다, charged에는 실제로 차지하는 크기가 써진다
+   영역이 꽉 찼으면 NULL - 호출한 쪽이 객체를 쫓아내고 다시 부르면 된다 */
+void* slab_alloc(slab_arena* arena, size_t size, size_t* charged) {
+    void* ptr = NULL;
+    slab_page* pg;
+    slab_class* c;
+    int idx, cls;
+
+    P(&arena->lock);
+    if (size > SLAB_MAX_SLOT) { // 큰 객체는 페이지 run
+        unsigned int n = (size + SLAB_PAGE_SIZE - 1) / SLAB_PAGE_SIZE;
+        if ((idx = take_pages(arena, n)) >= 0) {
+            arena->pages[idx].cls = SLAB_PAGE_RUN;
+            ptr = page_addr(arena, idx);
+            *charged = (size_t)n * SLAB_PAGE_SIZE;
+            arena->used += *charged;
+        }
+        V(&arena->lock);
+        return ptr;
+    }
+
+    cls = class_of(arena, size);
+    c = &arena->classes[cls];
+    if (c->partial == NULL) { // 이 class에 빈 슬롯이 없으면 페이지 하나 새로 받기
+        if ((idx = take_pages(arena, 1)) < 0) {
+            V(&arena->lock);
+            return NULL;
+        }
+        pg = &arena->pages[idx];
+        pg->cls = cls;
+        pg->npages = 1;
+        pg->used = pg->carved = 0;
+        pg->free = NULL;
+        partial_push(c, pg);
+    }
+
+    pg = c->partial;
+    idx = pg - arena->pages;
+    if (pg->free) {
+        ptr = pg->free;
+        pg->free = *(void**)ptr;
+    } else {
+        ptr = page_addr(arena, idx) + (size_t)pg->carved * c->slot_size;
+        pg->carved++;
+    }
+    pg->used++;
+    if (pg->used == c->per_page)
+        partial_remove(c, pg);
+
+    *charged = c->slot_size;
+    arena->used += c->slot_size;
+    V(&arena->lock);
+    return ptr;
+}
+
+/* 슬롯 반납, 페이지가 통째로 비면 다른 class나 run이 쓸 수 있게 돌려준다 */
+void slab_free(slab_arena* arena, void* ptr) {
+    unsigned int idx = page_index(arena, ptr);
+    slab_page* pg = &arena->pages[idx];
+    slab_class* c;
+
+    P(&arena->lock);
+    if (pg->cls == SLAB_PAGE_RUN) {
+        arena->used -= (size_t)pg->npages * SLAB_PAGE_SIZE;
+        release_pages(arena, idx, pg->npages);
+        V(&arena->lock);
+        return;
+    }
+
+    c = &arena->classes[pg->cls];
+    *(void**)ptr = pg->free;
+    pg->free = ptr;
+    if (pg->used == c->per_page)
+        partial_push(c, pg);
+    pg->used--;
+    arena->used -= c->slot_size;
+
+    if (pg->used == 0) {
+        partial_remove(c, pg);
+        release_pages(arena, idx, 1);
+    }
+    V(&arena->lock);
+}
+
+/* ptr이 속한 슬롯(또는 run)이 실제로 차지하는 크기 */
+size_t slab_slot_size(slab_arena* arena, void* ptr) {
+    slab_page* pg = &arena->pages[page_index(arena, ptr)];
+    if (pg->cls == SLAB_PAGE_RUN)
+        return (size_t)pg->npages * SLAB_PAGE_SIZE;
+    return arena->classes[pg->cls].slot_size;
+}
+
+/* 영역 중 huge page로 채워진 바이트
+   MAP_HUGETLB면 전부, THP면 /proc/self/smaps에서 이 영역의 AnonHugePages를 읽는다 (커널이 나중에 쪼갤 수도 있다) */
+size_t slab_huge_bytes(slab_arena* arena) {
+    char line[256];
+    char perms[8];
+    unsigned long start, end, kb;
+    int in_region = 0;
+    size_t bytes = 0;
+    FILE* fp;
+
+    if (arena->huge == SLAB_HUGE_TLB)
+        return arena->map_size;
+    if (arena->huge != SLAB_HUGE_THP || (fp = fopen("/proc/self/smaps", "r")) == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%lx-%lx %4s", &start, &end, perms) == 3) // 영역마다 첫 줄 "시작-끝 권한 ..."
+            in_region = start == (unsigned long)arena->base;
+        else if (in_region && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            bytes = (size_t)kb * 1024;
+            break;
+        }
+    }
+    fclose(fp);
+    return bytes;
+}
+
+/* 캐시 크기가 바뀌었다 - 이 영역의 몫을 limit 바이트로 */
+void slab_set_limit(slab_arena* arena, size_t limit) {
+    unsigned int pages = (limit + SLAB_PAGE_SIZE - 1) / SLAB_PAGE_SIZE;
+
+    P(&arena->lock);
+    arena->limit_pages = pages < arena->npages ? pages : arena->npages;
+    V(&arena->lock);
+}
+
+/* 몫(limit_pages) 뒤의 빈 페이지들을 커널에 돌려준다 (MADV_DONTNEED - 다시 잡아서 쓰면 0으로 채워진 페이지가 새로 붙는다), 돌려준 바이트 리턴
+   캐시를 줄인 뒤에 부른다, 몫 안의 빈 페이지는 미리 건드려둔 그대로 둔다. MAP_HUGETLB 영역은 2MB 단위로만 돌려줄 수 있어서 안 한다 */
+size_t slab_trim(slab_arena* arena) {
+    unsigned int i, start;
+    size_t bytes = 0;
+
+    if (arena->huge == SLAB_HUGE_TLB)
+        return 0;
+    P(&arena->lock);
+    i = arena->limit_pages;
+    while (i < arena->npages) {
+        if (arena->pages[i].cls != SLAB_PAGE_FREE || arena->pages[i].trimmed) {
+            i++;
+            continue;
+        }
+        for (start = i; i < arena->npages && arena->pages[i].cls == SLAB_PAGE_FREE && !arena->pages[i].trimmed; i++)
+            arena->pages[i].trimmed = 1;
+        if (madvise(page_addr(arena, start), (size_t)(i - start) * SLAB_PAGE_SIZE, MADV_DONTNEED) == 0)
+            bytes += (size_t)(i - start) * SLAB_PAGE_SIZE;
+    }
+    V(&arena->lock);
+    return bytes;
+}
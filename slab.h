@@ -0,0 +1,80 @@
+/* 캐시 전용 slab 할당기
+ * 시작할 때 캐시 용량만큼의 영역을 한 번에 잡아두고(pre-fault), 그 안에서만 객체를 나눠준다
+ * 객체 헤더 + 키 + 본문이 한 슬롯에 연속으로 들어가므로 malloc 세 번이 한 번이 되고,
+ * 캐시가 쓰는 메모리는 영역 크기를 절대 넘지 않는다
+ * 캐시가 크면 hit마다 TLB miss가 보인다 - 영역을 2MB huge page로 잡을 수 있다 (먼저 MAP_HUGETLB, 안 되면 THP)
+ * NUMA 박스에서는 노드마다 영역을 하나씩 만들어 그 노드 메모리에 붙인다 (cache.c, numa.c)
+ */
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include "csapp.h"
+
+#define SLAB_PAGE_SIZE (16 * 1024)   // 슬롯을 잘라 쓰는 단위 페이지
+#define SLAB_MIN_SLOT  64            // 가장 작은 size class
+#define SLAB_MAX_SLOT  (SLAB_PAGE_SIZE / 2) // 이보다 크면 페이지 여러 장을 연속으로 (run) 준다
+#define SLAB_MAX_CLASSES 32
+
+#define SLAB_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* 영역이 어떤 페이지로 잡혔나 */
+#define SLAB_HUGE_NONE  0   // 보통 페이지
+#define SLAB_HUGE_TLB   1   // MAP_HUGETLB, 미리 예약된 huge page (vm.nr_hugepages)
+#define SLAB_HUGE_THP   2   // madvise(MADV_HUGEPAGE), 실제로 몇 장 붙었는지는 커널 마음 - slab_huge_bytes로
+
+#define SLAB_PAGE_FREE  -1
+#define SLAB_PAGE_RUN   -2  // run의 첫 페이지
+#define SLAB_PAGE_TAIL  -3  // run의 나머지 페이지
+
+typedef struct slab_page {
+    int cls;                   // size class 번호 또는 SLAB_PAGE_* 상태
+    unsigned int npages;       // run이면 몇 장짜리인지
+    unsigned int used;         // 나가있는 슬롯 수
+    unsigned int carved;       // 아직 한 번도 안 쓴 슬롯은 free list 대신 앞에서부터 잘라준다
+    int trimmed;               // 메모리가 안 붙어 있다 (키울 자리라 처음부터 안 건드렸거나 slab_trim으로 돌려줬다), 다시 잡으면 0
+    void* free;                // 반납된 슬롯들의 free list
+    struct slab_page* prev;    // 빈 슬롯이 남은 페이지끼리의 리스트
+    struct slab_page* next;
+} slab_page;
+
+typedef struct slab_class {
+    size_t slot_size;
+    unsigned int per_page;
+    slab_page* partial;        // 빈 슬롯이 있는 페이지들
+} slab_class;
+
+typedef struct slab_arena {
+    char* base;
+    size_t size;               // npages * SLAB_PAGE_SIZE
+    char* map_base;            // mmap으로 받은 그대로 (huge page면 2MB로 맞추느라 base와 다를 수 있다)
+    size_t map_size;
+    int huge;                  // SLAB_HUGE_*
+    int node;                  // 메모리를 붙인 NUMA 노드, 안 붙였으면 -1
+    unsigned int npages;
+    unsigned int free_pages;
+    unsigned int cursor;       // 다음 빈 페이지 탐색을 시작할 위치 (next-fit)
+    unsigned int limit_pages;  // 새 페이지는 이 앞에서 먼저 찾는다 (캐시 크기 몫), 뒤는 키울 때 쓰는 자리
+    slab_page* pages;
+    slab_class classes[SLAB_MAX_CLASSES];
+    int nclasses;
+    size_t used;               // 나가있는 슬롯/run 크기의 합 (실제 점유 바이트)
+    sem_t lock;
+} slab_arena;
+
+slab_arena* slab_create(size_t budget, size_t populate, int huge, int node);
+
+void slab_destroy(slab_arena* arena);
+
+void* slab_alloc(slab_arena* arena, size_t size, size_t* charged);
+
+void slab_free(slab_arena* arena, void* ptr);
+
+size_t slab_slot_size(slab_arena* arena, void* ptr);
+
+size_t slab_huge_bytes(slab_arena* arena);
+
+void slab_set_limit(slab_arena* arena, size_t limit);
+
+size_t slab_trim(slab_arena* arena);
+
+#endif /* __SLAB_H__ */
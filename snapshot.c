@@ -0,0 +1,229 @@
+/* 캐시 스냅샷, snapshot.h 참고 */
+#include <stddef.h>
+#include "snapshot.h"
+
+static void* snapshot_timer(void* arg);
+
+/* interval이 0보다 크면 그 주기로 저장하는 쓰레드도 띄운다 */
+snapshot_state* snapshot_init(const char* path, int interval, int max_age, cache_list* cache) {
+    snapshot_state* snap = Calloc(1, sizeof(snapshot_state));
+    pthread_t tid;
+
+    snap->path = strdup(path);
+    snap->interval = interval;
+    snap->max_age = max_age;
+    snap->cache = cache;
+    Sem_init(&snap->lock, 0, 1);
+
+    if (interval > 0)
+        Pthread_create(&tid, NULL, snapshot_timer, snap);
+    return snap;
+}
+
+static void* snapshot_timer(void* arg) {
+    snapshot_state* snap = arg;
+
+    Pthread_detach(Pthread_self());
+    while (1) {
+        sleep(snap->interval);
+        snapshot_save(snap);
+    }
+    return NULL;
+}
+
+static uint64_t header_sum(snapshot_header* hdr) {
+    return cache_hash_continue(CACHE_HASH_INIT, hdr, offsetof(snapshot_header, header_checksum));
+}
+
+/* 체크섬을 누적하면서 쓴다 */
+static int write_sum(int fd, const void* buf, size_t n, uint64_t* sum) {
+    *sum = cache_hash_continue(*sum, buf, n);
+    return rio_writen(fd, (void*)buf, n) == (ssize_t)n ? 0 : -1;
+}
+
+/* 캐시 전체를 임시 파일에 쓰고 fsync 한 뒤 rename으로 바꿔치기 (쓰다 죽어도 예전 스냅샷은 멀쩡) */
+int snapshot_save(snapshot_state* snap) {
+    cache_object** objs;
+    snapshot_header hdr;
+    snapshot_entry ent;
+    char tmp[MAXLINE], buf[MAXBUF];
+    uint64_t sum = CACHE_HASH_INIT, off;
+    size_t done, n;
+    int count, kept, i, fd, ret = -1;
+
+    P(&snap->lock);
+    count = cache_collect(snap->cache, &objs);
+
+    /* 아직 확인 안 한 ban에 걸리는 객체는 캐시에서도 빼고 안 쓴다 - 안 그러면 재시작하면서 PURGE한 게 되살아난다 */
+    for (i = kept = 0; i < count; i++) {
+        if (snap->bans != NULL && ban_check(snap->bans, objs[i]->id, objs[i]->meta.resp_time, &objs[i]->ban_checked)) {
+            cache_remove(snap->cache, objs[i]);
+            cache_release(snap->cache, objs[i]);
+            continue;
+        }
+        objs[kept++] = objs[i];
+    }
+    count = kept;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", snap->path);
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        fprintf(stderr, "snapshot: cannot open %s: %s\n", tmp, strerror(errno));
+        goto out;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    if (lseek(fd, sizeof(hdr), SEEK_SET) < 0) // 헤더는 체크섬을 다 구한 뒤 맨 마지막에
+        goto fail;
+
+    /* 엔트리 테이블, 키와 본문은 테이블 바로 뒤에 순서대로 놓인다 */
+    off = sizeof(hdr) + (uint64_t)count * sizeof(snapshot_entry);
+    for (i = 0; i < count; i++) {
+        memset(&ent, 0, sizeof(ent));
+        ent.key_len = strlen(objs[i]->id);
+        ent.body_len = objs[i]->length;
+        ent.hash = objs[i]->hash;
+        ent.meta = objs[i]->meta;
+        ent.key_off = off;
+        ent.body_off = off + ent.key_len;
+        off += ent.key_len + ent.body_len;
+        if (write_sum(fd, &ent, sizeof(ent), &sum) < 0)
+            goto fail;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (write_sum(fd, objs[i]->id, strlen(objs[i]->id), &sum) < 0)
+            goto fail;
+        for (done = 0; done < (size_t)objs[i]->length; done += n) {
+            n = cache_object_read(objs[i], done, buf, sizeof(buf));
+            if (write_sum(fd, buf, n, &sum) < 0)
+                goto fail;
+        }
+    }
+
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.created = time(NULL);
+    hdr.count = count;
+    hdr.data_off = sizeof(hdr) + (uint64_t)count * sizeof(snapshot_entry);
+    hdr.file_size = off;
+    hdr.checksum = sum;
+    hdr.header_checksum = header_sum(&hdr);
+    if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || fsync(fd) < 0)
+        goto fail;
+    close(fd);
+    fd = -1;
+
+    if (rename(tmp, snap->path) < 0) {
+        fprintf(stderr, "snapshot: cannot rename to %s: %s\n", snap->path, strerror(errno));
+        goto out;
+    }
+    snap->saves++;
+    snap->last_count = count;
+    snap->last_save = hdr.created;
+    ret = 0;
+    goto out;
+
+fail:
+    fprintf(stderr, "snapshot: write to %s failed: %s\n", tmp, strerror(errno));
+    close(fd);
+    unlink(tmp);
+out:
+    for (i = 0; i < count; i++)
+        cache_release(snap->cache, objs[i]);
+    Free(objs);
+    V(&snap->lock);
+    return ret;
+}
+
+/* 스냅샷을 mmap 해서 검증하고 캐시에 올린다, 올린 객체 수 리턴 (없거나 못 믿을 파일이면 -1) */
+int snapshot_load(snapshot_state* snap) {
+    struct stat st;
+    snapshot_header* hdr;
+    snapshot_entry* ent;
+    cache_fill fill;
+    cache_key ck;
+    char* base;
+    char key[MAXLINE];
+    const char* why = NULL;
+    uint64_t i;
+    int fd, loaded = 0;
+
+    if ((fd = open(snap->path, O_RDONLY)) < 0)
+        return -1; // 처음 뜨는 경우
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(snapshot_header)) {
+        close(fd);
+        why = "truncated";
+        goto reject_nomap;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        why = strerror(errno);
+        goto reject_nomap;
+    }
+    hdr = (snapshot_header*)base;
+
+    if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)))
+        why = "bad magic";
+    else if (hdr->header_checksum != header_sum(hdr))
+        why = "header checksum mismatch";
+    else if (hdr->version != SNAPSHOT_VERSION || hdr->header_size != sizeof(snapshot_header))
+        why = "unsupported version";
+    else if (hdr->file_size != (uint64_t)st.st_size
+             || hdr->data_off != sizeof(snapshot_header) + hdr->count * sizeof(snapshot_entry)
+             || hdr->data_off > hdr->file_size)
+        why = "size mismatch";
+    else if (snap->max_age > 0 && time(NULL) - (time_t)hdr->created > snap->max_age)
+        why = "too old";
+    else if (cache_hash_continue(CACHE_HASH_INIT, base + sizeof(snapshot_header),
+                                 st.st_size - sizeof(snapshot_header)) != hdr->checksum)
+        why = "checksum mismatch";
+    if (why != NULL)
+        goto reject;
+
+    ent = (snapshot_entry*)(base + sizeof(snapshot_header));
+    for (i = 0; i < hdr->count; i++, ent++) {
+        if (ent->key_len >= sizeof(key) || ent->key_off + ent->key_len > hdr->file_size
+            || ent->body_off + ent->body_len > hdr->file_size) {
+            why = "entry out of range";
+            goto reject;
+        }
+        memcpy(key, base + ent->key_off, ent->key_len);
+        key[ent->key_len] = '\0';
+
+        /* 해시는 체크섬으로 검증된 걸 그대로 쓴다 */
+        ck.id = key;
+        ck.len = ent->key_len;
+        ck.hash = ent->hash;
+        cache_fill_begin(&fill, snap->cache, &ck);
+        fill.meta = ent->meta;
+        cache_fill_append(&fill, base + ent->body_off, ent->body_len);
+        if (cache_fill_commit(&fill, NULL) == 0)
+            loaded++;
+    }
+
+    munmap(base, st.st_size);
+    snap->loaded = loaded;
+    return loaded;
+
+reject:
+    munmap(base, st.st_size);
+reject_nomap:
+    fprintf(stderr, "snapshot: ignoring %s (%s)\n", snap->path, why);
+    snap->rejected++;
+    return -1;
+}
+
+int snapshot_stats_text(snapshot_state* snap, char* buf, size_t len) {
+    int n;
+
+    n = snprintf(buf, len,
+        "snapshot_loaded: %lu\n"
+        "snapshot_rejected: %lu\n"
+        "snapshot_saves: %lu\n"
+        "snapshot_last_count: %lu\n"
+        "snapshot_last_save: %ld\n",
+        snap->loaded, snap->rejected, snap->saves, snap->last_count, (long)snap->last_save);
+    return n < (int)len ? n : (int)len - 1;
+}
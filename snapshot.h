@@ -0,0 +1,61 @@
+/* 캐시 스냅샷 (warm restart)
+ * 종료(SIGTERM)할 때나 주기적으로 메모리 캐시 내용을 파일 하나로 떠두고,
+ * 다음에 뜰 때 mmap으로 읽어서 바로 캐시를 채운다
+ *
+ * 파일 구조: [snapshot_header][snapshot_entry * count][키와 본문들]
+ * 헤더 뒤의 전체 내용은 checksum으로 검증하고, 버전이 다르거나 너무 오래된 스냅샷은 버린다
+ */
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "cache.h"
+#include "ban.h"
+
+#define SNAPSHOT_MAGIC "PXYSNAP"
+#define SNAPSHOT_VERSION 7 // 2: 키가 path에서 절대 URL로, 3: 엔트리에 HTTP 메타데이터, 4: 검증자(ETag/Last-Modified), 5: stale-while-revalidate/stale-if-error 기간, 6: Vary 변형 해시, 7: 압축된 본문 (raw_len)
+#define SNAPSHOT_MAX_AGE (24 * 60 * 60)
+
+typedef struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t created;        // 떠둔 시각 (epoch 초)
+    uint64_t count;
+    uint64_t data_off;       // 키/본문 영역 시작
+    uint64_t file_size;
+    uint64_t checksum;       // 헤더 뒤 전체 (엔트리 + 데이터)
+    uint64_t header_checksum; // 이 필드 앞까지의 헤더
+} snapshot_header;
+
+typedef struct snapshot_entry {
+    uint64_t hash;
+    uint64_t key_off;        // 파일 안에서의 위치
+    uint64_t body_off;
+    uint32_t key_len;
+    uint32_t body_len;
+    cache_meta meta;
+} snapshot_entry;
+
+typedef struct snapshot_state {
+    char* path;
+    int interval;            // 초, 0이면 SIGTERM 때만
+    int max_age;
+    cache_list* cache;
+    ban_list* bans;          // 있으면 저장할 때 ban에 걸리는 객체는 뺀다 (ban 자체는 스냅샷에 안 남는다)
+    sem_t lock;              // 저장은 한 번에 하나만
+    unsigned long loaded;
+    unsigned long rejected;  // 버전/체크섬/나이 때문에 버린 스냅샷 수
+    unsigned long saves;
+    unsigned long last_count;
+    time_t last_save;
+} snapshot_state;
+
+snapshot_state* snapshot_init(const char* path, int interval, int max_age, cache_list* cache);
+
+int snapshot_load(snapshot_state* snap);
+
+int snapshot_save(snapshot_state* snap);
+
+int snapshot_stats_text(snapshot_state* snap, char* buf, size_t len);
+
+#endif /* __SNAPSHOT_H__ */